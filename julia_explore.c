@@ -10,38 +10,35 @@
 #include <stdbool.h>
 #include <GL/freeglut.h>
 #include <math.h>
+#include <unistd.h>
+#include "julia_render.h"
 
 typedef enum {
     MOUSE_NONE=0,
     MOUSE_SLIDER_REAL,
     MOUSE_SLIDER_CPLX,
-    MOUSE_RECT_DRAG
+    MOUSE_RECT_DRAG,
+    MOUSE_PAN
 } mose_state_t;
 
 // openGL things
 #define SCREEN_WIDTH 800
 #define SCREEN_HEIGHT 800
 #define UI_CLOSENESS 0.015
+#define PAN_PIXELS (SCREEN_WIDTH/8) // distance moved by each press of an arrow key
 int do_redraw_set = 1;
 mose_state_t hover_slider = MOUSE_NONE;
 mose_state_t clicked_slider = MOUSE_NONE;
 
 // julia set things
-#define NUM_ITERATIONS 64
-#define MOTION_DIVIDER 8
-#define VALUE_BOUND_SQUARED 16
-GLubyte texture_large[SCREEN_HEIGHT][SCREEN_WIDTH][3];
-GLubyte texture_small[SCREEN_HEIGHT/MOTION_DIVIDER][SCREEN_WIDTH/MOTION_DIVIDER][3];
-
-#define BASE_MIN_X -2.0
-#define BASE_MAX_X 2.0
-#define BASE_MIN_Y -2.0
-#define BASE_MAX_Y 2.0
+#define POLL_MS 15 // how often the render pool is checked for a finer level to display
+#define MIN_ITERATIONS 16
+#define MAX_ITERATIONS (1 << 20)
+struct julia_pool* render_pool = NULL;
+unsigned int displayed_version = 0; // render pool version of the level last uploaded
+int show_stats = 0; // print the periodicity statistics of each finished frame, toggled by the s key
+
 #define ZOOM_RECORD_LIMIT 8
-long double min_x = BASE_MIN_X;
-long double max_x = BASE_MAX_X;
-long double min_y = BASE_MIN_Y;
-long double max_y = BASE_MAX_Y;
 long double zoom_history[ZOOM_RECORD_LIMIT][4] = {0};
 unsigned int num_records = 0;
 
@@ -52,8 +49,6 @@ unsigned int num_records = 0;
 #define SLIDER_CPLX_Y 0.035
 #define SLIDER_VALUE_MIN -1
 #define SLIDER_VALUE_MAX 1
-long double julia_seed_real = 0.35;
-long double julia_seed_cplx = -0.5;
 int mouse_pointer_x = 0;
 int mouse_pointer_y = 0;
 int clicked = 0;
@@ -61,89 +56,8 @@ int rect_start_x = 0;
 int rect_start_y = 0;
 int rect_end_x = 0;
 int rect_end_y = 0;
-
-
-double num_julia_iterations(long double x, long double y) {
-    /* compute the number of iterations required for the quadratic relation z:= z^2+c
-    to become unbounded (or -1 if the relation remains bounded), where z_0 = x+yi
-    and c is julia_seed_real+julia_seed_cplx(i). Unbounded is defined as when the square
-    of the modulus of z exceeds VALUE_BOUND_SQUARED */
-        for (unsigned int i = 0; i < NUM_ITERATIONS; i++) {
-        long double next_x = x*x-y*y;
-        long double next_y = 2*x*y;
-        x = next_x + julia_seed_real;
-        y = next_y + julia_seed_cplx;
-        long double modulus_square = powl(x,2) + powl(y,2);
-        double scaled_result = i + 1 - logl(logl(modulus_square))/logl(2);
-        if (modulus_square > VALUE_BOUND_SQUARED) return scaled_result < 0 ? 0 : scaled_result;
-    }
-    return -1;
-}
-
-
-void hue_to_rgb(double hue, unsigned char* r, unsigned char* g, unsigned char* b) {
-    /* take a hue from the HSV colour model in the range [0,1) and compute the corresponding
-    RGB colour, assuming saturation and brightness are at maximum */
-    hue = fmodl(hue, 1);
-    unsigned int phase = hue * 6;
-    double delta = hue * 6 - phase; 
-    switch (phase)
-    {
-    case 0: // red-yellow
-        *r = 255;
-        *g = delta * 256;
-        *b = 0;
-        break;
-    case 1: // yellow-green
-        *r = (1-delta) * 256;
-        *g = 255;
-        *b = 0;
-        break;
-    case 2: // green-cyan
-        *r = 0;
-        *g = 255;
-        *b = delta * 256;
-        break;
-    case 3: //cyan-blue
-        *r = 0;
-        *g = (1-delta) * 256;
-        *b = 255;
-        break;
-    case 4: //blue-magenta
-        *r = delta * 256;
-        *g = 0;
-        *b = 255;
-        break;
-    case 5: //magenta-red
-        *r = 255;
-        *g = 0;
-        *b = (1-delta) * 256;
-        break;
-    default:
-        *r = 0;
-        *g = 0;
-        *b = 0;
-    }
-}
-
-
-void draw_fractal(unsigned int width, unsigned int height, GLubyte texture[width][height][3]) {
-    /* called at the start of each frame to draw the fractal */
-    for (unsigned int u = 0; u < width; u++) {
-        for (unsigned int v = 0; v < height; v++) {
-            long double x = (long double)u / (width-1) * (max_x - min_x) + min_x;
-            long double y = (long double)v / (height-1) * (max_y - min_y) + min_y;
-            double required_iterations = num_julia_iterations(x, y);
-            if (required_iterations == -1) {
-                texture[v][u][0]=0;
-                texture[v][u][1]=0;
-                texture[v][u][2]=0;
-            } else {
-                hue_to_rgb(((double)required_iterations) / NUM_ITERATIONS, &texture[v][u][0], &texture[v][u][1], &texture[v][u][2]);
-            }
-        } 
-    }
-}
+int pan_last_x = 0; // pointer position when the view was last moved by a right button drag
+int pan_last_y = 0;
 
 
 static void draw_text(float x, float y, void *font, const char* string) {
@@ -167,6 +81,64 @@ void reshape_window_free(int w, int h) {
 }
 
 
+void pan_view(int dx, int dy) {
+    /* move the view by whole pixels, dx to the right and dy up. The render pool shifts the frame it already has
+    and only renders the exposed strips */
+    if (dx == 0 && dy == 0) return;
+    if (do_redraw_set) {
+        // a new frame is about to be rendered from scratch anyway, so just move the view it will use
+        long double step_x = (max_x - min_x) / (SCREEN_WIDTH-1);
+        long double step_y = (max_y - min_y) / (SCREEN_HEIGHT-1);
+        min_x += step_x * dx;
+        max_x += step_x * dx;
+        min_y += step_y * dy;
+        max_y += step_y * dy;
+    } else {
+        struct julia_view view;
+        julia_pool_pan(render_pool, dx, dy, &view);
+        min_x = view.min_x;
+        max_x = view.max_x;
+        min_y = view.min_y;
+        max_y = view.max_y;
+    }
+    glutPostRedisplay();
+}
+
+
+void zoom_out_view(void) {
+    /* double the span of the view about its centre, reusing the current frame for the middle */
+    if (do_redraw_set) {
+        long double half_x = (max_x - min_x) / 2;
+        long double half_y = (max_y - min_y) / 2;
+        min_x -= half_x;
+        max_x += half_x;
+        min_y -= half_y;
+        max_y += half_y;
+    } else {
+        struct julia_view view;
+        julia_pool_zoom_out(render_pool, &view);
+        min_x = view.min_x;
+        max_x = view.max_x;
+        min_y = view.min_y;
+        max_y = view.max_y;
+    }
+    glutPostRedisplay();
+}
+
+
+void set_iterations(unsigned int max_iterations) {
+    /* change the iteration limit. Raising it continues the orbits still bounded rather than starting again */
+    if (max_iterations < MIN_ITERATIONS || max_iterations > MAX_ITERATIONS) return;
+    julia_max_iterations = max_iterations;
+    if (!do_redraw_set) {
+        struct julia_view view;
+        julia_pool_set_iterations(render_pool, max_iterations, &view);
+    }
+    printf("iteration limit %u\n", max_iterations);
+    glutPostRedisplay();
+}
+
+
 void key_pressed(unsigned char key, int x, int y) {
     /* handle keys being pressed */
     printf("key %c down\n", key);
@@ -185,6 +157,40 @@ void key_pressed(unsigned char key, int x, int y) {
             do_redraw_set = 1;
         }
         break;
+    case '-':
+        zoom_out_view();
+        break;
+    case ']':
+        set_iterations(julia_max_iterations * 2);
+        break;
+    case '[':
+        set_iterations(julia_max_iterations / 2);
+        break;
+    case 's':
+        show_stats = !show_stats;
+        break;
+    default:
+        break;
+    }
+}
+
+
+void special_key_pressed(int key, int x, int y) {
+    /* handle the arrow keys, which pan the view */
+    switch (key)
+    {
+    case GLUT_KEY_LEFT:
+        pan_view(-PAN_PIXELS, 0);
+        break;
+    case GLUT_KEY_RIGHT:
+        pan_view(PAN_PIXELS, 0);
+        break;
+    case GLUT_KEY_UP:
+        pan_view(0, PAN_PIXELS);
+        break;
+    case GLUT_KEY_DOWN:
+        pan_view(0, -PAN_PIXELS);
+        break;
     default:
         break;
     }
@@ -209,6 +215,12 @@ void mouse_event(int button, int state, int x, int y) {
             rect_end_x = x;
             rect_end_y = SCREEN_HEIGHT - y - 1;
         }
+    } else if (button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN && clicked_slider == MOUSE_NONE) {
+        clicked_slider = MOUSE_PAN;
+        pan_last_x = x;
+        pan_last_y = y;
+    } else if (button == GLUT_RIGHT_BUTTON && state == GLUT_UP && clicked_slider == MOUSE_PAN) {
+        clicked_slider = MOUSE_NONE;
     } else if (button == GLUT_LEFT_BUTTON  && state == GLUT_UP) {  
         if (clicked_slider == MOUSE_RECT_DRAG && rect_start_x != rect_end_x && rect_start_y != rect_end_y) {
             long double x_range = max_x - min_x;
@@ -255,7 +267,12 @@ void mouse_move(int x, int y) {
     double real_slider_pos = ((julia_seed_real - SLIDER_VALUE_MIN) / (SLIDER_VALUE_MAX - SLIDER_VALUE_MIN) + SLIDER_MIN_X) * (SLIDER_MAX_X - SLIDER_MIN_X);
     double cplx_slider_pos = ((julia_seed_cplx - SLIDER_VALUE_MIN) / (SLIDER_VALUE_MAX - SLIDER_VALUE_MIN) + SLIDER_MIN_X) * (SLIDER_MAX_X - SLIDER_MIN_X);
     double screen_slider_pos = (double)mouse_pointer_x / SCREEN_WIDTH;
-    if (clicked_slider == MOUSE_RECT_DRAG) {
+    if (clicked_slider == MOUSE_PAN) {
+        // drag the picture with the pointer. Window y runs downwards, the view's runs upwards
+        pan_view(pan_last_x - x, y - pan_last_y);
+        pan_last_x = x;
+        pan_last_y = y;
+    } else if (clicked_slider == MOUSE_RECT_DRAG) {
         rect_end_x = x;
         rect_end_y = SCREEN_HEIGHT - y - 1;
     } else if (clicked_slider == MOUSE_SLIDER_REAL) {
@@ -340,14 +357,25 @@ void gl_tick(void) {
     glClear(GL_COLOR_BUFFER_BIT);
     glPushMatrix();
     glEnable(GL_TEXTURE_2D);
-    if (clicked_slider == MOUSE_NONE || clicked_slider == MOUSE_RECT_DRAG) {
-        if (do_redraw_set) draw_fractal(SCREEN_WIDTH, SCREEN_HEIGHT, texture_large);
-        glTexImage2D(GL_TEXTURE_2D,0,3,SCREEN_WIDTH,SCREEN_HEIGHT,0,GL_RGB, GL_UNSIGNED_BYTE, texture_large);
-    } else {
-        if (do_redraw_set) draw_fractal(SCREEN_WIDTH/MOTION_DIVIDER, SCREEN_HEIGHT/MOTION_DIVIDER, texture_small);
-        glTexImage2D(GL_TEXTURE_2D,0,3,SCREEN_WIDTH/MOTION_DIVIDER,SCREEN_HEIGHT/MOTION_DIVIDER,0,GL_RGB, GL_UNSIGNED_BYTE, texture_small);
+    if (do_redraw_set) {
+        struct julia_view view = {min_x, max_x, min_y, max_y, julia_seed_real, julia_seed_cplx, julia_max_iterations};
+        julia_pool_render(render_pool, &view);
+        do_redraw_set = 0;
+    }
+    // the texture keeps the last level uploaded until a finer level or a new frame is ready
+    unsigned int version = julia_pool_version(render_pool);
+    unsigned int width, height;
+    const unsigned char* texture;
+    struct julia_stats stats;
+    int level;
+    if (version != displayed_version && (level = julia_pool_best(render_pool, &width, &height, &texture, &stats)) >= 0) {
+        glTexImage2D(GL_TEXTURE_2D,0,3,width,height,0,GL_RGB, GL_UNSIGNED_BYTE, texture);
+        if (show_stats && level == JULIA_LEVELS - 1) {
+            printf("periodicity check caught %lu pixels, saving %lu iterations (%s precision)\n", stats.periodic_pixels, stats.iterations_saved,
+                julia_precision_names[julia_precision_for(max_x - min_x, SCREEN_WIDTH)]);
+        }
+        displayed_version = version;
     }
-    do_redraw_set = 0;
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -387,6 +415,13 @@ void gl_tick(void) {
 }
 
 
+void poll_render_pool(int value) {
+    /* redraw when the render pool has completed a level that has not been displayed yet */
+    if (julia_pool_version(render_pool) != displayed_version) glutPostRedisplay();
+    glutTimerFunc(POLL_MS, poll_render_pool, 0);
+}
+
+
 void init_window(int *argc, char *argv[]) {
     /* Main init procedure for graphics */
     glutInit(argc,argv);
@@ -400,14 +435,23 @@ void init_window(int *argc, char *argv[]) {
     glutReshapeFunc(reshape_window_free);
     glutKeyboardFunc(key_pressed);
     glutKeyboardUpFunc(key_released);
+    glutSpecialFunc(special_key_pressed);
     glutMouseFunc(mouse_event);
 	glutMotionFunc(mouse_move);
 	glutPassiveMotionFunc(mouse_move);
-    draw_fractal(SCREEN_WIDTH, SCREEN_HEIGHT, texture_large);
-    draw_fractal(SCREEN_WIDTH/MOTION_DIVIDER, SCREEN_HEIGHT/MOTION_DIVIDER, texture_small);}
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows of the coarse levels are not a multiple of 4 bytes
+    glutTimerFunc(POLL_MS, poll_render_pool, 0);
+}
 
 
 int main(int argc, char *argv[]) {
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    render_pool = julia_pool_create(SCREEN_WIDTH, SCREEN_HEIGHT, num_threads > 0 ? num_threads : 1);
+    if (render_pool == NULL) {
+        fprintf(stderr, "Error: Unable to start render threads\n");
+        exit(EXIT_FAILURE);
+    }
     init_window(&argc, argv);
     glutMainLoop();
+    julia_pool_destroy(render_pool);
 }
\ No newline at end of file
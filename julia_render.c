@@ -0,0 +1,957 @@
+/* Source file for julia_render.c, the julia set kernel and colouring used by julia_explore.c, and a pool of
+    threads rendering frames progressively from coarse to fine. Kept free of OpenGL so the kernel can also be
+    driven headlessly
+    Author: Max Croucher
+    Email: mpccroucher@gmail.com
+    July 2025
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <float.h>
+#include "julia_render.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+#define VALUE_BOUND_SQUARED 16
+#define PERIODICITY_EPSILON (1.0 / 1024) // fraction of a pixel within which an orbit returning to a saved point is taken as a cycle
+#define JULIA_TILE_SIZE 64 // the pool hands out square tiles of this many pixels across
+#define PALETTE_SIZE (6 * 256) // one entry for each colour the hue ramp can produce
+#define SPARE_BITS 12 // bits of mantissa a precision must have beyond the pixel spacing to be used
+
+typedef struct {
+    double hi;
+    double lo;
+} dd_t; // double-double, an unevaluated sum hi + lo giving ~106 bits of mantissa
+
+enum orbit_status {
+    ORBIT_RUNNING, // bounded so far, and can be continued
+    ORBIT_ESCAPED,
+    ORBIT_CYCLE // caught in a cycle, so bounded however far it is iterated
+};
+
+struct orbits {
+    double* x_hi; // the point each orbit has reached, as a double-double
+    double* x_lo;
+    double* y_hi;
+    double* y_lo;
+    unsigned int* iterations; // iterations each orbit has run
+    unsigned char* status; // enum orbit_status
+    float* raw; // escape times, -1 for orbits that are bounded so far
+}; // the state of a run of pixels, one array per field so the vector kernels load neighbouring pixels together
+
+struct julia_level {
+    unsigned int width;
+    unsigned int height;
+    unsigned int tiles_x; // tiles across a row of this level
+    unsigned int num_tiles;
+    unsigned int done; // tiles of the current frame finished
+    struct orbits orbits; // width x height orbits, kept so that raising the iteration limit continues them
+    unsigned char* texture; // width x height RGB pixels, coloured from the escape times
+    struct julia_stats stats;
+};
+
+struct pixel_rect {
+    int u0;
+    int v0;
+    int u1;
+    int v1;
+}; // pixels u0 <= u < u1, v0 <= v < v1, empty when either range is
+
+struct julia_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work; // signalled when a new frame is started or the pool shuts down
+    pthread_cond_t idle; // signalled when the last worker drops a tile of an abandoned frame
+    _Atomic unsigned int generation; // incremented for every frame, workers abandon tiles of older frames
+    struct julia_view view;
+    struct julia_level levels[JULIA_LEVELS];
+    struct pixel_rect known; // pixels of the full resolution level still valid for view, which are not rendered again
+    unsigned int known_iterations; // iteration limit the known pixels were rendered to
+    unsigned int num_tiles; // tiles of every level, handed out coarse level first
+    unsigned int next_tile;
+    unsigned int active; // workers rendering a tile
+    int best; // finest level of the current frame complete, or -1
+    _Atomic unsigned int version; // incremented whenever a level is completed
+    int shutdown;
+    unsigned int num_threads;
+    pthread_t* threads;
+};
+
+static const unsigned int level_divisors[JULIA_LEVELS] = {16, 4, 1}; // linear resolution of each level, as a fraction of the full frame
+const char* julia_precision_names[] = {"float", "double", "long double", "double-double"};
+static unsigned char palette[PALETTE_SIZE][3]; // the hue ramp, sampled finely enough to reproduce hue_to_rgb exactly
+static int have_avx2 = 0;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+long double min_x = BASE_MIN_X;
+long double max_x = BASE_MAX_X;
+long double min_y = BASE_MIN_Y;
+long double max_y = BASE_MAX_Y;
+long double julia_seed_real = 0.35;
+long double julia_seed_cplx = -0.5;
+unsigned long periodic_pixels = 0;
+unsigned long iterations_saved = 0;
+unsigned long iterations_run = 0;
+unsigned int julia_max_iterations = NUM_ITERATIONS;
+
+
+void hue_to_rgb(double hue, unsigned char* r, unsigned char* g, unsigned char* b) {
+    /* take a hue from the HSV colour model in the range [0,1) and compute the corresponding
+    RGB colour, assuming saturation and brightness are at maximum */
+    hue = fmodl(hue, 1);
+    unsigned int phase = hue * 6;
+    double delta = hue * 6 - phase; 
+    switch (phase)
+    {
+    case 0: // red-yellow
+        *r = 255;
+        *g = delta * 256;
+        *b = 0;
+        break;
+    case 1: // yellow-green
+        *r = (1-delta) * 256;
+        *g = 255;
+        *b = 0;
+        break;
+    case 2: // green-cyan
+        *r = 0;
+        *g = 255;
+        *b = delta * 256;
+        break;
+    case 3: //cyan-blue
+        *r = 0;
+        *g = (1-delta) * 256;
+        *b = 255;
+        break;
+    case 4: //blue-magenta
+        *r = delta * 256;
+        *g = 0;
+        *b = 255;
+        break;
+    case 5: //magenta-red
+        *r = 255;
+        *g = 0;
+        *b = (1-delta) * 256;
+        break;
+    default:
+        *r = 0;
+        *g = 0;
+        *b = 0;
+    }
+}
+
+
+static void init_tables(void) {
+    /* fill the palette and find which vector kernels the CPU supports */
+    for (unsigned int i = 0; i < PALETTE_SIZE; i++) {
+        hue_to_rgb((double)i / PALETTE_SIZE, &palette[i][0], &palette[i][1], &palette[i][2]);
+    }
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+
+static void colour_pixel(double required_iterations, unsigned char* pixel) {
+    /* colour a pixel by its escape time, or black if it stays bounded. The palette repeats every NUM_ITERATIONS,
+    whatever the iteration limit, so raising the limit leaves the colour of escaped pixels alone */
+    if (required_iterations == -1) {
+        pixel[0] = 0;
+        pixel[1] = 0;
+        pixel[2] = 0;
+    } else {
+        const unsigned char* colour = palette[(unsigned int)(required_iterations / NUM_ITERATIONS * PALETTE_SIZE) % PALETTE_SIZE];
+        pixel[0] = colour[0];
+        pixel[1] = colour[1];
+        pixel[2] = colour[2];
+    }
+}
+
+
+static struct orbits orbits_at(const struct orbits* orbits, size_t offset) {
+    /* the orbits from pixel offset onwards */
+    return (struct orbits){
+        orbits->x_hi + offset, orbits->x_lo + offset, orbits->y_hi + offset, orbits->y_lo + offset,
+        orbits->iterations + offset, orbits->status + offset, orbits->raw + offset
+    };
+}
+
+
+static int orbit_pending(struct orbits o, unsigned int u, unsigned int max_iterations) {
+    /* whether the orbit of pixel u has to be iterated further to reach max_iterations */
+    return o.status[u] == ORBIT_RUNNING && o.iterations[u] < max_iterations;
+}
+
+
+static void orbit_escaped(struct orbits o, unsigned int u, unsigned int i, double modulus_square, struct julia_stats* stats) {
+    /* record the smooth escape time of an orbit that escaped on iteration i, only evaluated once it has escaped */
+    stats->iterations_run += i + 1 - o.iterations[u];
+    double scaled_result = i + 1 - log2(log(modulus_square));
+    o.raw[u] = scaled_result < 0 ? 0 : scaled_result;
+    o.iterations[u] = i + 1;
+    o.status[u] = ORBIT_ESCAPED;
+}
+
+
+static void orbit_cycled(struct orbits o, unsigned int u, unsigned int i, unsigned int max_iterations, struct julia_stats* stats) {
+    /* record an orbit caught in a cycle on iteration i, which stays bounded however far it is iterated */
+    stats->iterations_run += i + 1 - o.iterations[u];
+    stats->periodic_pixels++;
+    stats->iterations_saved += max_iterations - 1 - i;
+    o.raw[u] = -1;
+    o.iterations[u] = i + 1;
+    o.status[u] = ORBIT_CYCLE;
+}
+
+
+static void orbit_bounded(struct orbits o, unsigned int u, dd_t x, dd_t y, unsigned int max_iterations, struct julia_stats* stats) {
+    /* record an orbit still bounded at max_iterations, keeping where it got to so it can be continued */
+    stats->iterations_run += max_iterations - o.iterations[u];
+    o.x_hi[u] = x.hi;
+    o.x_lo[u] = x.lo;
+    o.y_hi[u] = y.hi;
+    o.y_lo[u] = y.lo;
+    o.raw[u] = -1;
+    o.iterations[u] = max_iterations;
+}
+
+
+static dd_t dd_add(dd_t a, dd_t b) {
+    /* add two double-doubles (two-sum of the high parts, with the low parts folded into the error) */
+    double s = a.hi + b.hi;
+    double v = s - a.hi;
+    double e = (a.hi - (s - v)) + (b.hi - v) + a.lo + b.lo;
+    double hi = s + e;
+    return (dd_t){hi, e - (hi - s)};
+}
+
+
+static dd_t dd_mul(dd_t a, dd_t b) {
+    /* multiply two double-doubles, using fma to recover the rounding error of the high product */
+    double p = a.hi * b.hi;
+    double e = fma(a.hi, b.hi, -p) + a.hi * b.lo + a.lo * b.hi;
+    double hi = p + e;
+    return (dd_t){hi, e - (hi - p)};
+}
+
+
+static dd_t dd_from_long_double(long double x) {
+    /* split a long double into a double-double, exactly */
+    double hi = x;
+    return (dd_t){hi, (double)(x - hi)};
+}
+
+
+static void julia_point_long_double(struct orbits o, unsigned int u, long double seed_real, long double seed_cplx, long double epsilon, unsigned int max_iterations, struct julia_stats* stats) {
+    /* continue the orbit of pixel u under the quadratic relation z:= z^2+c, where c is seed_real+seed_cplx(i),
+    until it becomes unbounded or reaches max_iterations. Unbounded is defined as when the square of the modulus
+    of z exceeds VALUE_BOUND_SQUARED. An orbit that returns within epsilon of the point saved at the last
+    power-of-two iteration of this run is caught in a cycle, and stays bounded */
+    long double x = (long double)o.x_hi[u] + o.x_lo[u];
+    long double y = (long double)o.y_hi[u] + o.y_lo[u];
+    long double saved_x = x;
+    long double saved_y = y;
+    unsigned int start = o.iterations[u];
+    unsigned int next_save = 1;
+    for (unsigned int i = start; i < max_iterations; i++) {
+        long double next_x = x*x-y*y;
+        long double next_y = 2*x*y;
+        x = next_x + seed_real;
+        y = next_y + seed_cplx;
+        long double modulus_square = x*x + y*y;
+        if (modulus_square > VALUE_BOUND_SQUARED) {
+            orbit_escaped(o, u, i, modulus_square, stats);
+            return;
+        }
+        if (fabsl(x - saved_x) < epsilon && fabsl(y - saved_y) < epsilon) {
+            orbit_cycled(o, u, i, max_iterations, stats);
+            return;
+        }
+        if (i - start == next_save) {
+            saved_x = x;
+            saved_y = y;
+            next_save <<= 1;
+        }
+    }
+    orbit_bounded(o, u, dd_from_long_double(x), dd_from_long_double(y), max_iterations, stats);
+}
+
+
+double num_julia_iterations(long double x, long double y, long double seed_real, long double seed_cplx, long double epsilon, struct julia_stats* stats) {
+    /* compute the number of iterations required for the orbit of z_0 = x+yi to become unbounded, or -1 if it
+    remains bounded for julia_max_iterations */
+    dd_t x_dd = dd_from_long_double(x), y_dd = dd_from_long_double(y);
+    unsigned int iterations = 0;
+    unsigned char status = ORBIT_RUNNING;
+    float raw;
+    struct orbits o = {&x_dd.hi, &x_dd.lo, &y_dd.hi, &y_dd.lo, &iterations, &status, &raw};
+    julia_point_long_double(o, 0, seed_real, seed_cplx, epsilon, julia_max_iterations, stats);
+    return raw;
+}
+
+
+static void julia_point_double(struct orbits o, unsigned int u, double seed_real, double seed_cplx, double epsilon, unsigned int max_iterations, struct julia_stats* stats) {
+    /* julia_point_long_double in double precision */
+    double x = o.x_hi[u];
+    double y = o.y_hi[u];
+    double saved_x = x;
+    double saved_y = y;
+    unsigned int start = o.iterations[u];
+    unsigned int next_save = 1;
+    for (unsigned int i = start; i < max_iterations; i++) {
+        double next_x = x*x-y*y;
+        double next_y = 2*x*y;
+        x = next_x + seed_real;
+        y = next_y + seed_cplx;
+        double modulus_square = x*x + y*y;
+        if (modulus_square > VALUE_BOUND_SQUARED) {
+            orbit_escaped(o, u, i, modulus_square, stats);
+            return;
+        }
+        if (fabs(x - saved_x) < epsilon && fabs(y - saved_y) < epsilon) {
+            orbit_cycled(o, u, i, max_iterations, stats);
+            return;
+        }
+        if (i - start == next_save) {
+            saved_x = x;
+            saved_y = y;
+            next_save <<= 1;
+        }
+    }
+    orbit_bounded(o, u, (dd_t){x, 0}, (dd_t){y, 0}, max_iterations, stats);
+}
+
+
+static void julia_point_dd(struct orbits o, unsigned int u, dd_t seed_real, dd_t seed_cplx, double epsilon, unsigned int max_iterations, struct julia_stats* stats) {
+    /* julia_point_long_double in double-double precision, for views too narrow for a long double */
+    dd_t x = {o.x_hi[u], o.x_lo[u]};
+    dd_t y = {o.y_hi[u], o.y_lo[u]};
+    dd_t saved_x = x;
+    dd_t saved_y = y;
+    unsigned int start = o.iterations[u];
+    unsigned int next_save = 1;
+    for (unsigned int i = start; i < max_iterations; i++) {
+        dd_t xy = dd_mul(x, y);
+        dd_t next_x = dd_add(dd_mul(x, x), dd_mul((dd_t){-y.hi, -y.lo}, y));
+        x = dd_add(next_x, seed_real);
+        y = dd_add((dd_t){2 * xy.hi, 2 * xy.lo}, seed_cplx);
+        double modulus_square = x.hi * x.hi + y.hi * y.hi;
+        if (modulus_square > VALUE_BOUND_SQUARED) {
+            orbit_escaped(o, u, i, modulus_square, stats);
+            return;
+        }
+        dd_t dx = dd_add(x, (dd_t){-saved_x.hi, -saved_x.lo});
+        dd_t dy = dd_add(y, (dd_t){-saved_y.hi, -saved_y.lo});
+        if (fabs(dx.hi) < epsilon && fabs(dy.hi) < epsilon) {
+            orbit_cycled(o, u, i, max_iterations, stats);
+            return;
+        }
+        if (i - start == next_save) {
+            saved_x = x;
+            saved_y = y;
+            next_save <<= 1;
+        }
+    }
+    orbit_bounded(o, u, x, y, max_iterations, stats);
+}
+
+
+#ifdef HAVE_X86_KERNELS
+/* The AVX2 kernels continue a group of orbits of a row together, each from its own iteration. A lane that
+escapes, is caught in a cycle or reaches the iteration limit has its iteration (and its point, at the limit)
+latched, and keeps computing harmlessly until every lane of the group is done. Lanes past the end of the row
+or with nothing left to do start out inactive. */
+
+static void finish_lane(struct orbits o, unsigned int u, int escape_i, double modulus_square, int cycle_i, double x, double y, unsigned int max_iterations, struct julia_stats* stats) {
+    /* record the lane of pixel u from the iteration at which it escaped or was caught in a cycle, -1 for neither */
+    if (escape_i >= 0) orbit_escaped(o, u, escape_i, modulus_square, stats);
+    else if (cycle_i >= 0) orbit_cycled(o, u, cycle_i, max_iterations, stats);
+    else orbit_bounded(o, u, (dd_t){x, 0}, (dd_t){y, 0}, max_iterations, stats);
+}
+
+
+__attribute__((target("avx2")))
+static void julia_row_double_avx2(struct orbits o, unsigned int n, long double seed_real, long double seed_cplx, long double epsilon, unsigned int max_iterations, struct julia_stats* stats) {
+    /* 4 pixels at a time in double precision */
+    const __m256d cr = _mm256_set1_pd(seed_real);
+    const __m256d ci = _mm256_set1_pd(seed_cplx);
+    const __m256d eps = _mm256_set1_pd(epsilon);
+    const __m256d bound = _mm256_set1_pd(VALUE_BOUND_SQUARED);
+    const __m256d last = _mm256_set1_pd(max_iterations - 1);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    for (unsigned int u = 0; u < n; u += 4) {
+        double lanes_x[4] = {0}, lanes_y[4] = {0}, starts[4] = {0};
+        int pending[4] = {0}, any = 0;
+        for (unsigned int l = 0; l < 4 && u + l < n; l++) {
+            if (!orbit_pending(o, u + l, max_iterations)) continue;
+            lanes_x[l] = o.x_hi[u + l];
+            lanes_y[l] = o.y_hi[u + l];
+            starts[l] = o.iterations[u + l];
+            pending[l] = any = -1;
+        }
+        if (!any) continue;
+        __m256d x = _mm256_loadu_pd(lanes_x);
+        __m256d y = _mm256_loadu_pd(lanes_y);
+        __m256d start_i = _mm256_loadu_pd(starts);
+        __m256d saved_x = x, saved_y = y, end_x = x, end_y = y;
+        __m256d active = _mm256_castsi256_pd(_mm256_set_epi64x(pending[3], pending[2], pending[1], pending[0]));
+        __m256d escape_i = _mm256_set1_pd(-1), escape_m = _mm256_setzero_pd(), cycle_i = _mm256_set1_pd(-1);
+        unsigned int next_save = 1;
+        for (unsigned int k = 0;; k++) {
+            __m256d xy = _mm256_mul_pd(x, y);
+            x = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y)), cr);
+            y = _mm256_add_pd(_mm256_add_pd(xy, xy), ci);
+            __m256d modulus_square = _mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y));
+            __m256d iteration = _mm256_add_pd(start_i, _mm256_set1_pd(k));
+            __m256d escaped = _mm256_and_pd(active, _mm256_cmp_pd(modulus_square, bound, _CMP_GT_OQ));
+            escape_i = _mm256_blendv_pd(escape_i, iteration, escaped);
+            escape_m = _mm256_blendv_pd(escape_m, modulus_square, escaped);
+            active = _mm256_andnot_pd(escaped, active);
+            __m256d cycled = _mm256_and_pd(
+                _mm256_cmp_pd(_mm256_andnot_pd(sign, _mm256_sub_pd(x, saved_x)), eps, _CMP_LT_OQ),
+                _mm256_cmp_pd(_mm256_andnot_pd(sign, _mm256_sub_pd(y, saved_y)), eps, _CMP_LT_OQ));
+            cycled = _mm256_and_pd(active, cycled);
+            cycle_i = _mm256_blendv_pd(cycle_i, iteration, cycled);
+            active = _mm256_andnot_pd(cycled, active);
+            __m256d limited = _mm256_and_pd(active, _mm256_cmp_pd(iteration, last, _CMP_GE_OQ));
+            end_x = _mm256_blendv_pd(end_x, x, limited);
+            end_y = _mm256_blendv_pd(end_y, y, limited);
+            active = _mm256_andnot_pd(limited, active);
+            if (_mm256_movemask_pd(active) == 0) break;
+            if (k == next_save) {
+                saved_x = x;
+                saved_y = y;
+                next_save <<= 1;
+            }
+        }
+        double escapes[4], moduli[4], cycles[4], ends_x[4], ends_y[4];
+        _mm256_storeu_pd(escapes, escape_i);
+        _mm256_storeu_pd(moduli, escape_m);
+        _mm256_storeu_pd(cycles, cycle_i);
+        _mm256_storeu_pd(ends_x, end_x);
+        _mm256_storeu_pd(ends_y, end_y);
+        for (unsigned int l = 0; l < 4; l++) {
+            if (pending[l]) finish_lane(o, u + l, escapes[l], moduli[l], cycles[l], ends_x[l], ends_y[l], max_iterations, stats);
+        }
+    }
+}
+
+
+__attribute__((target("avx2")))
+static void julia_row_float_avx2(struct orbits o, unsigned int n, long double seed_real, long double seed_cplx, long double epsilon, unsigned int max_iterations, struct julia_stats* stats) {
+    /* 8 pixels at a time in single precision */
+    const __m256 cr = _mm256_set1_ps(seed_real);
+    const __m256 ci = _mm256_set1_ps(seed_cplx);
+    const __m256 eps = _mm256_set1_ps(epsilon);
+    const __m256 bound = _mm256_set1_ps(VALUE_BOUND_SQUARED);
+    const __m256 last = _mm256_set1_ps(max_iterations - 1);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    for (unsigned int u = 0; u < n; u += 8) {
+        float lanes_x[8] = {0}, lanes_y[8] = {0}, starts[8] = {0};
+        int pending[8] = {0}, any = 0;
+        for (unsigned int l = 0; l < 8 && u + l < n; l++) {
+            if (!orbit_pending(o, u + l, max_iterations)) continue;
+            lanes_x[l] = o.x_hi[u + l];
+            lanes_y[l] = o.y_hi[u + l];
+            starts[l] = o.iterations[u + l];
+            pending[l] = any = -1;
+        }
+        if (!any) continue;
+        __m256 x = _mm256_loadu_ps(lanes_x);
+        __m256 y = _mm256_loadu_ps(lanes_y);
+        __m256 start_i = _mm256_loadu_ps(starts);
+        __m256 saved_x = x, saved_y = y, end_x = x, end_y = y;
+        __m256 active = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)pending));
+        __m256 escape_i = _mm256_set1_ps(-1), escape_m = _mm256_setzero_ps(), cycle_i = _mm256_set1_ps(-1);
+        unsigned int next_save = 1;
+        for (unsigned int k = 0;; k++) {
+            __m256 xy = _mm256_mul_ps(x, y);
+            x = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), cr);
+            y = _mm256_add_ps(_mm256_add_ps(xy, xy), ci);
+            __m256 modulus_square = _mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y));
+            __m256 iteration = _mm256_add_ps(start_i, _mm256_set1_ps(k));
+            __m256 escaped = _mm256_and_ps(active, _mm256_cmp_ps(modulus_square, bound, _CMP_GT_OQ));
+            escape_i = _mm256_blendv_ps(escape_i, iteration, escaped);
+            escape_m = _mm256_blendv_ps(escape_m, modulus_square, escaped);
+            active = _mm256_andnot_ps(escaped, active);
+            __m256 cycled = _mm256_and_ps(
+                _mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(x, saved_x)), eps, _CMP_LT_OQ),
+                _mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(y, saved_y)), eps, _CMP_LT_OQ));
+            cycled = _mm256_and_ps(active, cycled);
+            cycle_i = _mm256_blendv_ps(cycle_i, iteration, cycled);
+            active = _mm256_andnot_ps(cycled, active);
+            __m256 limited = _mm256_and_ps(active, _mm256_cmp_ps(iteration, last, _CMP_GE_OQ));
+            end_x = _mm256_blendv_ps(end_x, x, limited);
+            end_y = _mm256_blendv_ps(end_y, y, limited);
+            active = _mm256_andnot_ps(limited, active);
+            if (_mm256_movemask_ps(active) == 0) break;
+            if (k == next_save) {
+                saved_x = x;
+                saved_y = y;
+                next_save <<= 1;
+            }
+        }
+        float escapes[8], moduli[8], cycles[8], ends_x[8], ends_y[8];
+        _mm256_storeu_ps(escapes, escape_i);
+        _mm256_storeu_ps(moduli, escape_m);
+        _mm256_storeu_ps(cycles, cycle_i);
+        _mm256_storeu_ps(ends_x, end_x);
+        _mm256_storeu_ps(ends_y, end_y);
+        for (unsigned int l = 0; l < 8; l++) {
+            if (pending[l]) finish_lane(o, u + l, escapes[l], moduli[l], cycles[l], ends_x[l], ends_y[l], max_iterations, stats);
+        }
+    }
+}
+#endif
+
+
+static void start_orbits(enum julia_precision precision, struct orbits o, long double x0, long double step, long double y, unsigned int n) {
+    /* start the orbits of n pixels along a row at z_0 = x0 + yi, advancing by step */
+    dd_t x0_dd = dd_from_long_double(x0), y_dd = dd_from_long_double(y);
+    dd_t step_dd = dd_from_long_double(step);
+    for (unsigned int u = 0; u < n; u++) {
+        // the double-double tier needs the start point to more bits than a long double holds
+        dd_t x = precision == JULIA_DOUBLE_DOUBLE ? dd_add(x0_dd, dd_mul(step_dd, (dd_t){u, 0})) : dd_from_long_double(x0 + step * u);
+        o.x_hi[u] = x.hi;
+        o.x_lo[u] = x.lo;
+        o.y_hi[u] = y_dd.hi;
+        o.y_lo[u] = y_dd.lo;
+        o.iterations[u] = 0;
+        o.status[u] = ORBIT_RUNNING;
+    }
+}
+
+
+static void julia_row(enum julia_precision precision, struct orbits o, unsigned int n, long double seed_real, long double seed_cplx, long double epsilon, unsigned int max_iterations, struct julia_stats* stats) {
+    /* continue the orbits of n pixels along a row that are still bounded up to max_iterations, in the given
+    precision, leaving their escape times in raw */
+#ifdef HAVE_X86_KERNELS
+    if (have_avx2 && precision == JULIA_FLOAT) {
+        julia_row_float_avx2(o, n, seed_real, seed_cplx, epsilon, max_iterations, stats);
+        return;
+    }
+    if (have_avx2 && precision == JULIA_DOUBLE) {
+        julia_row_double_avx2(o, n, seed_real, seed_cplx, epsilon, max_iterations, stats);
+        return;
+    }
+#endif
+    dd_t seed_real_dd = dd_from_long_double(seed_real), seed_cplx_dd = dd_from_long_double(seed_cplx);
+    for (unsigned int u = 0; u < n; u++) {
+        if (!orbit_pending(o, u, max_iterations)) continue;
+        switch (precision) {
+        case JULIA_FLOAT: // without AVX2 a scalar float gains nothing over a double
+        case JULIA_DOUBLE:
+            julia_point_double(o, u, seed_real, seed_cplx, epsilon, max_iterations, stats);
+            break;
+        case JULIA_LONG_DOUBLE:
+            julia_point_long_double(o, u, seed_real, seed_cplx, epsilon, max_iterations, stats);
+            break;
+        default:
+            julia_point_dd(o, u, seed_real_dd, seed_cplx_dd, epsilon, max_iterations, stats);
+        }
+    }
+}
+
+
+static void colour_row(const float* raw, unsigned char* rgb, unsigned int n) {
+    /* colour n pixels from their escape times */
+    for (unsigned int u = 0; u < n; u++) colour_pixel(raw[u], rgb + u * 3);
+}
+
+
+enum julia_precision julia_precision_for(long double span, unsigned int width) {
+    /* the narrowest precision that resolves pixels of a view span wide with SPARE_BITS to spare. Orbits stay
+    within a modulus of 4, so this is relative to a magnitude of 4 */
+    long double spacing = fabsl(span) / (width > 1 ? width - 1 : 1);
+    if (spacing >= ldexpl(4, SPARE_BITS - FLT_MANT_DIG)) return JULIA_FLOAT;
+    if (spacing >= ldexpl(4, SPARE_BITS - DBL_MANT_DIG)) return JULIA_DOUBLE;
+    if (spacing >= ldexpl(4, SPARE_BITS - LDBL_MANT_DIG)) return JULIA_LONG_DOUBLE;
+    return JULIA_DOUBLE_DOUBLE;
+}
+
+
+void draw_fractal(unsigned int width, unsigned int height, unsigned char texture[width][height][3]) {
+    /* draw the fractal for the current view on the calling thread */
+    pthread_once(&init_once, init_tables);
+    long double step_x = (max_x - min_x) / (width-1);
+    long double step_y = (max_y - min_y) / (height-1);
+    long double epsilon = fabsl(step_x) * PERIODICITY_EPSILON;
+    enum julia_precision precision = julia_precision_for(max_x - min_x, width);
+    struct julia_stats stats = {0};
+    double x_hi[width], x_lo[width], y_hi[width], y_lo[width];
+    unsigned int iterations[width];
+    unsigned char status[width];
+    float raw[width];
+    struct orbits row = {x_hi, x_lo, y_hi, y_lo, iterations, status, raw};
+    for (unsigned int v = 0; v < height; v++) {
+        start_orbits(precision, row, min_x, step_x, min_y + step_y * v, width);
+        julia_row(precision, row, width, julia_seed_real, julia_seed_cplx, epsilon, julia_max_iterations, &stats);
+        colour_row(raw, texture[v][0], width);
+    }
+    periodic_pixels = stats.periodic_pixels;
+    iterations_saved = stats.iterations_saved;
+    iterations_run = stats.iterations_run;
+}
+
+
+static int render_tile(struct julia_pool* pool, unsigned int generation, const struct julia_view* view, unsigned int tile, struct julia_stats* stats) {
+    /* render one tile of the pool's frame, with tiles numbered through the levels from coarse to fine. Pixels of
+    the full resolution level that are already known are only continued, if the iteration limit has been raised
+    since they were rendered. Returns the level of the tile, or -1 if a newer frame was started before the tile was
+    finished */
+    unsigned int l = 0;
+    while (tile >= pool->levels[l].num_tiles) tile -= pool->levels[l++].num_tiles;
+    struct julia_level* level = &pool->levels[l];
+    unsigned int u0 = tile % level->tiles_x * JULIA_TILE_SIZE;
+    unsigned int v0 = tile / level->tiles_x * JULIA_TILE_SIZE;
+    unsigned int u1 = u0 + JULIA_TILE_SIZE < level->width ? u0 + JULIA_TILE_SIZE : level->width;
+    unsigned int v1 = v0 + JULIA_TILE_SIZE < level->height ? v0 + JULIA_TILE_SIZE : level->height;
+    long double step_x = (view->max_x - view->min_x) / (level->width-1);
+    long double step_y = (view->max_y - view->min_y) / (level->height-1);
+    long double epsilon = fabsl(step_x) * PERIODICITY_EPSILON;
+    enum julia_precision precision = julia_precision_for(view->max_x - view->min_x, level->width);
+    struct pixel_rect known = l == JULIA_LEVELS - 1 ? pool->known : (struct pixel_rect){0};
+    int deepen = pool->known_iterations != view->max_iterations;
+    for (unsigned int v = v0; v < v1; v++) {
+        if (atomic_load_explicit(&pool->generation, memory_order_relaxed) != generation) return -1;
+        // the row is split into the pixels left of, and right of, those already known
+        unsigned int segments[2][2] = {{u0, u1}, {u1, u1}};
+        if ((int)v >= known.v0 && (int)v < known.v1 && known.u0 < (int)u1 && known.u1 > (int)u0) {
+            segments[0][1] = known.u0 > (int)u0 ? known.u0 : u0;
+            segments[1][0] = known.u1 < (int)u1 ? known.u1 : u1;
+        }
+        for (unsigned int i = 0; i < 3; i++) {
+            // the known pixels between the two segments only need continuing when the limit has been raised
+            unsigned int start = i < 2 ? segments[i][0] : segments[0][1];
+            unsigned int end = i < 2 ? segments[i][1] : segments[1][0];
+            if (start >= end || (i == 2 && !deepen)) continue;
+            size_t offset = (size_t)v * level->width + start;
+            struct orbits row = orbits_at(&level->orbits, offset);
+            if (i < 2) start_orbits(precision, row, view->min_x + step_x * start, step_x, view->min_y + step_y * v, end - start);
+            julia_row(precision, row, end - start, view->seed_real, view->seed_cplx, epsilon, view->max_iterations, stats);
+            colour_row(row.raw, level->texture + offset * 3, end - start);
+        }
+    }
+    return l;
+}
+
+
+static void* pool_worker(void* pool_ptr) {
+    /* render tiles of the current frame until the pool shuts down */
+    struct julia_pool* pool = pool_ptr;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->shutdown && pool->next_tile >= pool->num_tiles) pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->shutdown) break;
+        unsigned int tile = pool->next_tile++;
+        unsigned int generation = pool->generation;
+        struct julia_view view = pool->view;
+        pool->active++;
+        pthread_mutex_unlock(&pool->lock);
+
+        struct julia_stats stats = {0};
+        int l = render_tile(pool, generation, &view, tile, &stats);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->active--;
+        if (l < 0 || generation != pool->generation) {
+            if (pool->active == 0) pthread_cond_broadcast(&pool->idle);
+            continue;
+        }
+        struct julia_level* level = &pool->levels[l];
+        level->stats.periodic_pixels += stats.periodic_pixels;
+        level->stats.iterations_saved += stats.iterations_saved;
+        level->stats.iterations_run += stats.iterations_run;
+        if (++level->done == level->num_tiles && l > pool->best) {
+            pool->best = l;
+            if (l == JULIA_LEVELS - 1) {
+                pool->known = (struct pixel_rect){0, 0, level->width, level->height};
+                pool->known_iterations = pool->view.max_iterations;
+            }
+            atomic_fetch_add(&pool->version, 1);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+
+struct julia_pool* julia_pool_create(unsigned int width, unsigned int height, unsigned int num_threads) {
+    /* start num_threads workers rendering frames of width x height pixels. Returns NULL on failure */
+    pthread_once(&init_once, init_tables);
+    struct julia_pool* pool = calloc(1, sizeof(struct julia_pool));
+    if (pool == NULL) return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    pool->best = -1;
+    for (unsigned int l = 0; l < JULIA_LEVELS; l++) {
+        struct julia_level* level = &pool->levels[l];
+        level->width = width / level_divisors[l] > 1 ? width / level_divisors[l] : 2;
+        level->height = height / level_divisors[l] > 1 ? height / level_divisors[l] : 2;
+        level->tiles_x = (level->width + JULIA_TILE_SIZE - 1) / JULIA_TILE_SIZE;
+        level->num_tiles = level->tiles_x * ((level->height + JULIA_TILE_SIZE - 1) / JULIA_TILE_SIZE);
+        size_t num_pixels = (size_t)level->width * level->height;
+        struct orbits* orbits = &level->orbits;
+        orbits->x_hi = malloc(num_pixels * sizeof(double));
+        orbits->x_lo = malloc(num_pixels * sizeof(double));
+        orbits->y_hi = malloc(num_pixels * sizeof(double));
+        orbits->y_lo = malloc(num_pixels * sizeof(double));
+        orbits->iterations = malloc(num_pixels * sizeof(unsigned int));
+        orbits->status = malloc(num_pixels);
+        orbits->raw = calloc(num_pixels, sizeof(float));
+        level->texture = calloc(num_pixels, 3);
+        pool->num_tiles += level->num_tiles;
+        if (orbits->x_hi == NULL || orbits->x_lo == NULL || orbits->y_hi == NULL || orbits->y_lo == NULL ||
+            orbits->iterations == NULL || orbits->status == NULL || orbits->raw == NULL || level->texture == NULL) {
+            julia_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    pool->next_tile = pool->num_tiles; // nothing to render until the first frame is started
+    pool->threads = calloc(num_threads, sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        julia_pool_destroy(pool);
+        return NULL;
+    }
+    for (; pool->num_threads < num_threads; pool->num_threads++) {
+        if (pthread_create(&pool->threads[pool->num_threads], NULL, pool_worker, pool)) {
+            julia_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+
+static void stop_frame(struct julia_pool* pool) {
+    /* abandon the frame being rendered, returning once no worker is still writing one of its tiles. The lock is held */
+    atomic_fetch_add(&pool->generation, 1);
+    pool->next_tile = pool->num_tiles;
+    while (pool->active) pthread_cond_wait(&pool->idle, &pool->lock);
+}
+
+
+static void start_frame(struct julia_pool* pool, const struct julia_view* view) {
+    /* hand out the tiles of a frame of view. When pixels of the full resolution level are already known, the
+    coarse levels are skipped and only the rest of the full level is rendered. The lock is held */
+    pool->view = *view;
+    for (unsigned int l = 0; l < JULIA_LEVELS; l++) {
+        pool->levels[l].done = 0;
+        pool->levels[l].stats = (struct julia_stats){0};
+    }
+    pool->best = -1;
+    int incremental = pool->known.u0 < pool->known.u1 && pool->known.v0 < pool->known.v1;
+    pool->next_tile = incremental ? pool->num_tiles - pool->levels[JULIA_LEVELS-1].num_tiles : 0;
+    pthread_cond_broadcast(&pool->work);
+}
+
+
+void julia_pool_render(struct julia_pool* pool, const struct julia_view* view) {
+    /* abandon the frame being rendered and start rendering view from scratch. Returns once no worker is still
+    writing a tile of an older frame, so every texture is free to be reused */
+    pthread_mutex_lock(&pool->lock);
+    stop_frame(pool);
+    pool->known = (struct pixel_rect){0};
+    start_frame(pool, view);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+static int ceil_div(int a, int b) {
+    /* a / b rounded up, for b > 0 */
+    return a >= 0 ? (a + b - 1) / b : -(-a / b);
+}
+
+
+static void move_pixels(struct julia_level* level, size_t target, size_t source, size_t count) {
+    /* move the orbits and colours of count pixels from source to target, which may overlap */
+    struct orbits* o = &level->orbits;
+    memmove(o->x_hi + target, o->x_hi + source, count * sizeof(double));
+    memmove(o->x_lo + target, o->x_lo + source, count * sizeof(double));
+    memmove(o->y_hi + target, o->y_hi + source, count * sizeof(double));
+    memmove(o->y_lo + target, o->y_lo + source, count * sizeof(double));
+    memmove(o->iterations + target, o->iterations + source, count * sizeof(unsigned int));
+    memmove(o->status + target, o->status + source, count);
+    memmove(o->raw + target, o->raw + source, count * sizeof(float));
+    memmove(level->texture + target * 3, level->texture + source * 3, count * 3);
+}
+
+
+static void copy_pixel(struct julia_level* level, size_t target, size_t source) {
+    /* copy the orbit and colour of one pixel */
+    struct orbits* o = &level->orbits;
+    o->x_hi[target] = o->x_hi[source];
+    o->x_lo[target] = o->x_lo[source];
+    o->y_hi[target] = o->y_hi[source];
+    o->y_lo[target] = o->y_lo[source];
+    o->iterations[target] = o->iterations[source];
+    o->status[target] = o->status[source];
+    o->raw[target] = o->raw[source];
+    memcpy(level->texture + target * 3, level->texture + source * 3, 3);
+}
+
+
+static void scale_row(struct julia_level* level, int scale, int offset_u, int v, int source_v, struct pixel_rect known) {
+    /* fill the known pixels of row v from every scale'th pixel of row source_v, outwards from the pixel that maps
+    to itself so that no pixel is overwritten before it is read */
+    int fixed_u = offset_u / (scale - 1);
+    size_t row = (size_t)v * level->width, source_row = (size_t)source_v * level->width;
+    for (int u = (fixed_u < known.u1 ? fixed_u : known.u1) - 1; u >= known.u0; u--) {
+        copy_pixel(level, row + u, source_row + scale * u - offset_u);
+    }
+    for (int u = fixed_u > known.u0 ? fixed_u : known.u0; u < known.u1; u++) {
+        copy_pixel(level, row + u, source_row + scale * u - offset_u);
+    }
+}
+
+
+static void reproject(struct julia_pool* pool, int scale, int offset_u, int offset_v) {
+    /* move the orbits of the full resolution level so that pixel (u, v) takes the orbit of pixel
+    (scale * u - offset_u, scale * v - offset_v), keeping track of which pixels remain known. The lock is held
+    and no worker is rendering */
+    struct julia_level* level = &pool->levels[JULIA_LEVELS-1];
+    struct pixel_rect old = pool->known;
+    struct pixel_rect known = {
+        ceil_div(old.u0 + offset_u, scale), ceil_div(old.v0 + offset_v, scale),
+        ceil_div(old.u1 + offset_u, scale), ceil_div(old.v1 + offset_v, scale)
+    };
+    if (known.u0 < 0) known.u0 = 0;
+    if (known.v0 < 0) known.v0 = 0;
+    if (known.u1 > (int)level->width) known.u1 = level->width;
+    if (known.v1 > (int)level->height) known.v1 = level->height;
+    if (old.u0 >= old.u1 || old.v0 >= old.v1 || known.u0 >= known.u1 || known.v0 >= known.v1) {
+        pool->known = (struct pixel_rect){0};
+        return;
+    }
+    if (scale == 1) {
+        // a pan moves whole rows, in place, in the order that reads every row before it is overwritten
+        int count = known.u1 - known.u0;
+        for (int i = 0; i < known.v1 - known.v0; i++) {
+            int v = offset_v > 0 ? known.v1 - 1 - i : known.v0 + i;
+            size_t target = (size_t)v * level->width + known.u0;
+            size_t source = (size_t)(v - offset_v) * level->width + known.u0 - offset_u;
+            move_pixels(level, target, source, count);
+        }
+        pool->known = known;
+        return;
+    }
+    // a zoom out gathers every scale'th pixel, working outwards from the row that maps to itself
+    int fixed_v = offset_v / (scale - 1);
+    for (int v = (fixed_v < known.v1 ? fixed_v : known.v1) - 1; v >= known.v0; v--) {
+        scale_row(level, scale, offset_u, v, scale * v - offset_v, known);
+    }
+    for (int v = fixed_v > known.v0 ? fixed_v : known.v0; v < known.v1; v++) {
+        scale_row(level, scale, offset_u, v, scale * v - offset_v, known);
+    }
+    pool->known = known;
+}
+
+
+void julia_pool_pan(struct julia_pool* pool, int dx, int dy, struct julia_view* view) {
+    /* move the view by whole pixels of the full resolution level, dx to the right and dy up, and render only the
+    pixels that were not already known. The new view is returned in view */
+    pthread_mutex_lock(&pool->lock);
+    stop_frame(pool);
+    struct julia_level* level = &pool->levels[JULIA_LEVELS-1];
+    *view = pool->view;
+    long double step_x = (view->max_x - view->min_x) / (level->width-1);
+    long double step_y = (view->max_y - view->min_y) / (level->height-1);
+    view->min_x += step_x * dx;
+    view->max_x += step_x * dx;
+    view->min_y += step_y * dy;
+    view->max_y += step_y * dy;
+    reproject(pool, 1, -dx, -dy);
+    start_frame(pool, view);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+void julia_pool_zoom_out(struct julia_pool* pool, struct julia_view* view) {
+    /* double the span of the view about its centre. The centre of the new frame is the current frame at every
+    other pixel, so only the border is rendered. The new view is returned in view */
+    pthread_mutex_lock(&pool->lock);
+    stop_frame(pool);
+    struct julia_level* level = &pool->levels[JULIA_LEVELS-1];
+    *view = pool->view;
+    long double step_x = (view->max_x - view->min_x) / (level->width-1);
+    long double step_y = (view->max_y - view->min_y) / (level->height-1);
+    // pixel u of the new frame lies on pixel 2u - width/2 of the current one
+    view->min_x -= step_x * (level->width / 2);
+    view->max_x = view->min_x + 2 * step_x * (level->width-1);
+    view->min_y -= step_y * (level->height / 2);
+    view->max_y = view->min_y + 2 * step_y * (level->height-1);
+    reproject(pool, 2, level->width / 2, level->height / 2);
+    start_frame(pool, view);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+void julia_pool_set_iterations(struct julia_pool* pool, unsigned int max_iterations, struct julia_view* view) {
+    /* change the iteration limit of the view. Raising it continues only the orbits of the full resolution level
+    still bounded, from where they stopped, while lowering it renders the frame again. The new view is returned
+    in view */
+    pthread_mutex_lock(&pool->lock);
+    stop_frame(pool);
+    *view = pool->view;
+    if (max_iterations < view->max_iterations) pool->known = (struct pixel_rect){0}; // orbits cannot be wound back
+    view->max_iterations = max_iterations;
+    start_frame(pool, view);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+unsigned int julia_pool_version(struct julia_pool* pool) {
+    /* a counter that changes whenever a level of a frame is completed */
+    return atomic_load(&pool->version);
+}
+
+
+int julia_pool_best(struct julia_pool* pool, unsigned int* width, unsigned int* height, const unsigned char** texture, struct julia_stats* stats) {
+    /* find the finest completed level of the current frame. Returns its index and its texture, or -1 if no level is
+    complete yet. The texture stays valid until the next call to julia_pool_render */
+    pthread_mutex_lock(&pool->lock);
+    int best = pool->best;
+    if (best >= 0) {
+        struct julia_level* level = &pool->levels[best];
+        *width = level->width;
+        *height = level->height;
+        *texture = level->texture;
+        if (stats) *stats = level->stats;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return best;
+}
+
+
+void julia_pool_destroy(struct julia_pool* pool) {
+    /* stop the workers and free the pool */
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    atomic_fetch_add(&pool->generation, 1);
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (unsigned int i = 0; i < pool->num_threads; i++) pthread_join(pool->threads[i], NULL);
+    for (unsigned int l = 0; l < JULIA_LEVELS; l++) {
+        struct orbits* orbits = &pool->levels[l].orbits;
+        free(orbits->x_hi);
+        free(orbits->x_lo);
+        free(orbits->y_hi);
+        free(orbits->y_lo);
+        free(orbits->iterations);
+        free(orbits->status);
+        free(orbits->raw);
+        free(pool->levels[l].texture);
+    }
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->idle);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,69 @@
+/* Header file for julia_render.c, the julia set kernel and render pool shared by julia_explore.c and the benchmarks
+    Author: Max Croucher
+    Email: mpccroucher@gmail.com
+    July 2025
+*/
+
+#ifndef JULIA_RENDER_H
+#define JULIA_RENDER_H
+
+#define NUM_ITERATIONS 64 // the default iteration limit, and the escape time over which the palette repeats
+#define JULIA_LEVELS 3 // the render pool draws each frame at 1/16, 1/4 and then full resolution
+
+#define BASE_MIN_X -2.0
+#define BASE_MAX_X 2.0
+#define BASE_MIN_Y -2.0
+#define BASE_MAX_Y 2.0
+
+struct julia_view {
+    long double min_x;
+    long double max_x;
+    long double min_y;
+    long double max_y;
+    long double seed_real;
+    long double seed_cplx;
+    unsigned int max_iterations;
+}; // the region drawn, the seed of the julia set and the iteration limit
+
+struct julia_stats {
+    unsigned long periodic_pixels; // pixels caught in a cycle
+    unsigned long iterations_saved; // iterations those pixels would otherwise have run
+    unsigned long iterations_run;
+};
+
+enum julia_precision {
+    JULIA_FLOAT,
+    JULIA_DOUBLE,
+    JULIA_LONG_DOUBLE,
+    JULIA_DOUBLE_DOUBLE
+};
+
+struct julia_pool;
+
+extern const char* julia_precision_names[]; // indexed by enum julia_precision
+
+extern long double min_x;
+extern long double max_x;
+extern long double min_y;
+extern long double max_y;
+extern long double julia_seed_real;
+extern long double julia_seed_cplx;
+extern unsigned long periodic_pixels; // pixels of the last full redraw caught in a cycle
+extern unsigned long iterations_saved; // iterations those pixels would otherwise have run
+extern unsigned long iterations_run; // iterations the last full redraw ran
+extern unsigned int julia_max_iterations;
+
+double num_julia_iterations(long double x, long double y, long double seed_real, long double seed_cplx, long double epsilon, struct julia_stats* stats);
+void hue_to_rgb(double hue, unsigned char* r, unsigned char* g, unsigned char* b);
+enum julia_precision julia_precision_for(long double span, unsigned int width);
+void draw_fractal(unsigned int width, unsigned int height, unsigned char texture[width][height][3]);
+struct julia_pool* julia_pool_create(unsigned int width, unsigned int height, unsigned int num_threads);
+void julia_pool_render(struct julia_pool* pool, const struct julia_view* view);
+void julia_pool_pan(struct julia_pool* pool, int dx, int dy, struct julia_view* view);
+void julia_pool_zoom_out(struct julia_pool* pool, struct julia_view* view);
+void julia_pool_set_iterations(struct julia_pool* pool, unsigned int max_iterations, struct julia_view* view);
+unsigned int julia_pool_version(struct julia_pool* pool);
+int julia_pool_best(struct julia_pool* pool, unsigned int* width, unsigned int* height, const unsigned char** texture, struct julia_stats* stats);
+void julia_pool_destroy(struct julia_pool* pool);
+
+#endif
@@ -4,144 +4,272 @@
     July 2025
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <math.h>
+#include <assert.h>
 #include <png.h>
 #include <glob.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <limits.h>
+#include <getopt.h>
+#include "tile_archive.h"
+#include "tile_render.h"
 
-#define IMAGE_SIZE 256
-#define IMAGE_BIT_DEPTH 8
-#define IMAGE_BYTES (((IMAGE_SIZE*IMAGE_BIT_DEPTH)+7)/8) // guarantees rounding up if IMAGE_SIZE is not divisible by 8
+#define TILE_CHUNK 16 // number of tiles a worker claims from the shared cursor at once
+#define JOURNAL_NAME "progress.journal"
+#define ITERATIONS_NAME "iterations.index" // sidecar to the journal of raw tiles, recording the iteration budget of each
+#define ID_MAX_DEPTH 29 // deepest level whose tiles fit the 58-bit index of a tile id
+#define PYRAMID_MAX_DEPTH 31 // deepest level of a whole pyramid or shard, whose 4^z tiles are counted in 64 bits
+#define DEDUP_TABLE_BITS 20 // log2 of the slots in the table of emitted tile contents
+#define DEDUP_MAX_PROBES 64 // slots searched before a tile is written without deduplication
+#define PROFILE_NAME "profile.json"
+#define SHARD_ROOTS 64 // subtrees dealt out per shard, so the cost can be balanced in steps of about 1/64 of a share
+#define SHARD_SAMPLES 8 // points sampled across each side of a subtree's root to estimate its cost
+#define REGION_WINDOW 8 // default tiles across the window rendered around a region on each level, a large screen's worth
+#define PLAN_NONE UINT64_MAX // ordinal of a tile outside the plan
+#define PENDING_BUCKETS 1024 // hash buckets of the parent tiles waiting for their children to be downsampled
+#define WRITE_QUEUE_TILES 256 // encoded tiles waiting for the writers before workers block, bounding their memory
+#define WRITE_BATCH 16 // tiles a writer takes from the queue at once, recorded in the journal with one write
+#define JOURNAL_BATCH 4096 // tile ids held back until their files are known to be on disk, then journalled and synced together
+#define JOURNAL_INTERVAL_NS 1000000000ULL // longest a finished tile waits for its batch to be journalled
 
-#define MAX_ITERATIONS 256
-#define MANDELBROT_BOUND 2
-#define MAX_DEPTH 58 // enables a 58-bit index and a 6-bit depth (6 bits are required to encode 58) as a single 64-bit value
-
-#define MIN_X -2.0
-#define MIN_Y -1.25
-#define BASE_RANGE_X 2.5
-#define BASE_RANGE_Y 2.5
+struct tile_digest {
+    uint64_t key;
+    uint64_t check;
+}; // 128-bit hash of the raw pixels of a tile
 
 char* dirname = "map";
 unsigned int max_zoom;
+int resume = 0;
+int journal_fd = -1;
+pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+uint64_t journal_pending[JOURNAL_BATCH]; // ids of written tiles not yet in the journal
+unsigned int journal_num_pending = 0;
+uint64_t journal_flushed_ns = 0; // when the last batch was journalled
+int level_dirs[MAX_DEPTH+1]; // open directory of each level, which tiles are written relative to
+uint64_t* completed_tiles = NULL; // bitmap of tiles found in the journal, indexed by plan ordinal
+int iterations_fd = -1;
+uint64_t* deepen_tiles = NULL; // bitmap of journalled tiles to render again with a larger budget, indexed by plan ordinal
+unsigned int raw_iterations = MAX_ITERATIONS; // iteration budget of raw tiles
+char* archive_name = NULL;
+struct tile_archive* archive = NULL; // when set, tiles are appended here instead of written to dirname
+int use_subdivision = 0;
+unsigned int antialias_samples = 0; // extra samples taken in each edge pixel, 0 for none
+int tile_format = TILE_PNG;
+double report_interval = 5; // seconds between progress reports, 0 to disable them
+char* profile_name = NULL; // where the JSON profile is written at exit
+_Atomic uint64_t* solid_tiles = NULL; // bitmap of tiles proven to lie inside the set, indexed by plan ordinal
+struct png_buffer solid_tile = {0}; // the encoded image of a tile inside the set
+struct tile_digest solid_digest; // digest of the pixels of solid_tile
+struct tile_encoder encoder_options; // compression settings copied into the encoder of every worker
+const char* strategy_name = "filtered";
+const char* filters_name = "all";
+struct dedup_entry* dedup_table = NULL;
+int merging = 0;
+int downsample_filter = -1; // how a parent is built from its four children, or -1 to render every level
+const char* downsample_name = NULL;
+unsigned int num_writers = UINT_MAX; // threads writing tiles queued by the workers, 0 for workers to write their own, one per worker unless set
+
+enum dedup_state {DEDUP_PENDING, DEDUP_WRITTEN, DEDUP_FAILED};
+
+struct shard {
+    unsigned int id;
+    unsigned int count;
+    unsigned int split_zoom; // level at which the quadtree is cut into subtrees dealt out to shards
+    uint64_t first_root; // Morton index on split_zoom of the first subtree of this shard
+    uint64_t end_root; // one past the last subtree of this shard
+} shard = {.count = 1}; // the part of the pyramid rendered by this process, all of it unless sharding
+
+struct region {
+    int enabled;
+    long double min_r, min_i, max_r, max_i; // box to follow down the levels, a single point when min == max
+    unsigned int window; // tiles across the window rendered around the box on each level
+} region = {.window = REGION_WINDOW}; // long double places the window to a fraction of a tile even at MAX_DEPTH
+
+struct tile_plan {
+    unsigned int min_zoom; // shallowest level rendered
+    uint64_t level_start[MAX_DEPTH+1]; // ordinal of the first tile of each level
+    uint64_t level_tiles[MAX_DEPTH+1]; // tiles of each level
+    uint64_t level_first[MAX_DEPTH+1]; // Morton index of the first tile of each level, when not following a region
+    uint64_t level_left[MAX_DEPTH+1]; // first column of the window of each level, when following a region
+    uint64_t level_top[MAX_DEPTH+1]; // first row of the window
+    uint64_t level_rows[MAX_DEPTH+1]; // rows of the window
+    uint64_t num_tiles;
+} plan; // the tiles this process renders, numbered by ordinal level by level. Bitmaps and the scheduler use ordinals
+
+struct iteration_record {
+    uint64_t id; // tile id
+    uint32_t budget; // iterations each point of the tile was given
+    uint32_t capped; // points still bounded when the budget ran out, which are all a larger budget can change
+}; // the sidecar holds one per raw tile written, a later record of a tile replacing earlier ones
+
+struct dedup_entry {
+    _Atomic uint64_t key; // digest key of the content held by this slot, 0 while the slot is free
+    uint64_t check; // rest of the digest, written before source is published
+    _Atomic uint64_t source; // 1 + index of the first tile emitted with this content, 0 until it is written or queued
+    _Atomic int state; // whether a queued copy has been written yet, for the writers linking to it
+};
+
+struct pending_tile {
+    uint64_t index; // ordinal of the parent being assembled
+    _Atomic unsigned int children; // quadrants written so far
+    struct pending_tile* next; // next in its bucket, or in the free list
+    png_byte pixels[IMAGE_SIZE][IMAGE_SIZE];
+}; // a parent tile waiting for the last of its four children
+
+struct tile_deque {
+    pthread_mutex_t lock;
+    uint64_t head; // next tile the owner will render
+    uint64_t tail; // one past the last tile held by this deque
+};
 
 struct shared_data {
-    unsigned int current_depth;
-    unsigned int current_row;
-    pthread_mutex_t mutex;
-    pthread_cond_t timereport;
+    atomic_uint_fast64_t next_tile; // first tile not yet claimed by any worker
+    uint64_t num_tiles;
+    unsigned int num_workers;
+    struct tile_deque* deques;
+    struct worker_data* workers;
+    uint64_t start_ns; // when the workers were started
+    _Atomic uint64_t level_done[MAX_DEPTH+1]; // tiles of each level finished, including those skipped on resume
+    _Atomic uint64_t level_finished_ns[MAX_DEPTH+1]; // time since start_ns at which the last tile of each level finished
+    pthread_mutex_t report_lock;
+    pthread_cond_t timereport; // signalled when the workers have finished, so the reporter stops waiting
+    int finished;
+    pthread_mutex_t pending_lock; // guards pending and pending_free
+    struct pending_tile* pending[PENDING_BUCKETS]; // parents with some but not all of their children downsampled
+    struct pending_tile* pending_free; // assembled parents kept for reuse
 };
 
+struct worker_profile {
+    _Atomic uint64_t tiles; // tiles finished, including those skipped on resume
+    _Atomic uint64_t iterate_ns; // time spent rendering pixels
+    _Atomic uint64_t encode_ns; // time spent hashing and PNG encoding, including writing a tile encoded straight to its file
+    _Atomic uint64_t filesystem_ns; // time spent writing and linking tiles, when there are no writers
+    _Atomic uint64_t queue_ns; // time spent queueing tiles for the writers, including waiting for room
+    _Atomic uint64_t lock_ns; // time spent waiting for a deque lock held by another worker
+    _Atomic uint64_t downsample_ns; // time spent reducing children into their parents
+}; // written by its worker and read by the reporter while the workers run
 
-static int mandelbrot_point(long double c_r, long double c_i) {
-    /* determine the number of iterations required for z = z^2 + c to diverge, where z,c are complex */
-    long double z_r = 0;
-    long double z_i = 0;
-    for (unsigned int i = 0; i < MAX_ITERATIONS; i++) {
-        long double x_r = pow(z_r, 2) - pow(z_i, 2);
-        long double x_i = 2 * z_r * z_i;
-        z_r = x_r + c_r;
-        z_i = x_i + c_i;
-        if (-2 > z_r || z_r > 2 || -2 > z_i || z_i > 2) return 0xFF - i;
-    }
-    return 0;
-    // return ((int)(x * 10) % 2 ^ (int)(y * 10) % 2);
-}
+struct worker_data {
+    struct shared_data* shared;
+    unsigned int id;
+    uint64_t tiles_rendered;
+    uint64_t tiles_downsampled;
+    uint64_t tiles_deepened; // raw tiles rendered again from their inside points only, with a larger budget
+    uint64_t tiles_capped; // raw tiles with points still bounded when their budget ran out
+    struct kernel_stats stats;
+    struct worker_profile profile;
+};
 
+struct write_job {
+    uint64_t index; // ordinal of the tile
+    uint64_t source; // ordinal of the identical tile to link to, or PLAN_NONE to write data
+    uint32_t capped; // points of a raw tile still bounded when its budget ran out, for the sidecar
+    struct dedup_entry* entry; // the dedup slot published for data, or the slot of source for a link
+    struct png_buffer data; // the encoded tile. Buffers are swapped rather than copied, so each keeps its capacity
+};
 
-static png_byte* mandelbrot_row(png_structp png_ptr, long double start_x, long double y, long double range) {
-    /* render a slice of the mandelbrot set between (start_x, y) and (start_x+range, y) */
-    png_byte* row = png_malloc(png_ptr, IMAGE_BYTES);
-    for (unsigned int x = 0; x < IMAGE_SIZE; x++) {
-        row[x] = mandelbrot_point(start_x+(range/IMAGE_SIZE*x), y);
-    }
-    return row;
+struct writer_data {
+    pthread_t thread;
+    _Atomic uint64_t tiles; // tiles written or linked
+    _Atomic uint64_t write_ns; // time spent writing, linking and journaling
+}; // written by its writer and read by the reporter
+
+struct write_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // signalled when a tile is queued or the queue is closed
+    pthread_cond_t room; // broadcast when writers take tiles, for workers waiting on a full queue
+    pthread_cond_t written; // broadcast when a tile that others may link to has been written
+    struct write_job jobs[WRITE_QUEUE_TILES]; // ring of queued tiles, written in the order they were queued
+    unsigned int head;
+    unsigned int length;
+    int closed; // no more tiles will be queued
+    struct writer_data* writers;
+} writes; // tiles encoded by the workers on their way to storage, so that slow storage never stalls rendering
+
+
+static uint64_t clock_ns(void) {
+    /* monotonic time in nanoseconds */
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000ULL + time.tv_nsec;
 }
 
 
-static void render_tile(char* filename, long double start_x, long double start_y, long double range_x, long double range_y) {
-    /* save a square image IMAGE_SIZE pixels in width. The coordinates for the image are given by start_x and start_y */
-     // Open and safety check the png file
-    FILE *png_file = fopen(filename, "wb");
-    if (!png_file) { // opening file failed
-        fprintf(stderr, "Error: Unable to create file %s\n", filename);
-        return;
-    }
-    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (png_ptr == NULL) { // creating write struct failed
-        fclose(png_file);
-        fprintf(stderr, "Error: Unable to initialise PNG image %s\n", filename);
-        return;
-    }
-    png_infop png_info = png_create_info_struct(png_ptr);
-    if (png_info == NULL || setjmp(png_jmpbuf(png_ptr))) { // creating info struct failed
-        png_destroy_write_struct(&png_ptr, &png_info);
-        fclose(png_file);
-        fprintf(stderr, "Error: Unable to initialise PNG metadata %s\n", filename);
-        return;
-    }
-    // Set header
-    png_set_IHDR(
-        png_ptr,
-        png_info,
-        IMAGE_SIZE,
-        IMAGE_SIZE,
-        IMAGE_BIT_DEPTH,
-        PNG_COLOR_TYPE_GRAY,
-        PNG_INTERLACE_NONE,
-        PNG_COMPRESSION_TYPE_DEFAULT,
-        PNG_FILTER_TYPE_DEFAULT
-    );
+static uint64_t charge(_Atomic uint64_t* counter, uint64_t start) {
+    /* add the time since start to a profile counter, returning the current time */
+    uint64_t end = clock_ns();
+    atomic_fetch_add_explicit(counter, end - start, memory_order_relaxed);
+    return end;
+}
 
-    // create and fill buffers to store bitmap data
-    png_byte **row_pointers = png_malloc(png_ptr, IMAGE_SIZE * sizeof(png_byte *));
-    for (unsigned int y = 0; y < IMAGE_SIZE; y++) {
-        row_pointers[y] = mandelbrot_row(png_ptr, start_x, start_y+(range_y/IMAGE_SIZE*y), range_x);
-    }
-    png_init_io(png_ptr, png_file);
-    png_set_rows(png_ptr, png_info, row_pointers);
 
-    // write png
-    png_write_png(png_ptr, png_info, PNG_TRANSFORM_IDENTITY, NULL);
+static void level_path(char* name, uint64_t x, uint64_t y) {
+    /* the name of tile (x, y) within the directory of its level */
+    sprintf(name, "%" PRIu64 "/%" PRIu64 ".%s", x, y, tile_format_extension(tile_format));
+}
 
-    // free arrays and clean up
-    for (unsigned int y = 0; y < IMAGE_SIZE; y++) {
-        png_free(png_ptr, row_pointers[y]);
+
+static int save_tile(unsigned int z, const char* name, const struct png_buffer* encoded, struct tile_encoder* encoder, png_byte pixels[IMAGE_SIZE][IMAGE_SIZE]) {
+    /* write a tile to name in the directory of level z, either already encoded or by encoding pixels straight into
+    the file. The image is written under a temporary name and renamed once complete, so a partially written tile
+    never looks finished. It is only journalled once the filesystem has been synced, see journal_flush_locked */
+    char tmp_name[64 + 4];
+    sprintf(tmp_name, "%s.tmp", name);
+    int fd = openat(level_dirs[z], tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    FILE *png_file = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!png_file) { // opening file failed
+        if (fd >= 0) close(fd);
+        fprintf(stderr, "Error: Unable to create file %s/%u/%s\n", dirname, z, tmp_name);
+        return -1;
+    }
+    int failed;
+    if (encoded) failed = fwrite(encoded->data, 1, encoded->length, png_file) != encoded->length;
+    else failed = encode_tile(encoder, tile_sink_file(png_file), pixels) != 0;
+    if (fclose(png_file) || failed || renameat(level_dirs[z], tmp_name, level_dirs[z], name)) {
+        fprintf(stderr, "Error: Unable to save file %s/%u/%s\n", dirname, z, name);
+        return -1;
     }
-    free(row_pointers); // png_free doesn't correctly free memory
-    png_destroy_write_struct(&png_ptr, &png_info);
-    fclose(png_file);
+    return 0;
 }
 
 
 static int rm_recurse(char* current_dir) {
-    /* recursively remove png files and directories from the current directory. Exits with failure if a directory contains non-png files */
+    /* recursively remove tiles, of either format, and directories from the current directory. Fails if a directory contains other files */
               
-    // remove existing pngs
+    // remove existing tiles
     glob_t glob_struct;
     char glob_str[256];
-    sprintf(glob_str, "%s/*.png", current_dir);
-    int code = glob(glob_str, GLOB_ERR, NULL, &glob_struct);
-    if (code) {
-        if (code == GLOB_NOMATCH) {
-            goto remove_directories;
+    for (int format = TILE_PNG; format <= TILE_RAW; format++) {
+        sprintf(glob_str, "%s/*.%s", current_dir, tile_format_extension(format));
+        int code = glob(glob_str, GLOB_ERR, NULL, &glob_struct);
+        if (code == GLOB_NOMATCH) continue;
+        if (code) {
+            fprintf(stderr, "Error: Unable to initialise directory\n");
+            exit(EXIT_FAILURE);
+        }
+        while(*glob_struct.gl_pathv) {
+            int code = remove(*glob_struct.gl_pathv);
+            if (code) return code;
+            glob_struct.gl_pathv++;
         }
-        fprintf(stderr, "Error: Unable to initialise directory\n");
-        exit(EXIT_FAILURE);
-    }
-    while(*glob_struct.gl_pathv) {
-        int code = remove(*glob_struct.gl_pathv);
-        if (code) return code;
-        glob_struct.gl_pathv++;
     }
-remove_directories:
+
     // remove existing directories
     sprintf(glob_str, "%s/*", current_dir);
-    code = glob(glob_str, GLOB_ERR, NULL, &glob_struct);
+    int code = glob(glob_str, GLOB_ERR, NULL, &glob_struct);
     if (code) {
         if (code == GLOB_NOMATCH) {
             return 0;
@@ -163,114 +291,1726 @@ remove_directories:
 }
 
 
+static void remove_stale(int level_dir, const char* x_dir_name) {
+    /* remove the temporary files a crash left behind in a column directory when resuming */
+    int fd = openat(level_dir, x_dir_name, O_RDONLY | O_DIRECTORY);
+    DIR* dir = fd < 0 ? NULL : fdopendir(fd);
+    if (dir == NULL) {
+        if (fd >= 0) close(fd);
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        size_t length = strlen(entry->d_name);
+        if (length > 4 && !strcmp(entry->d_name + length - 4, ".tmp")) unlinkat(fd, entry->d_name, 0);
+    }
+    closedir(dir);
+}
+
+
 static void init_dir(void) {
-    /* initialise the dirname/z/y/x.png directory structure, and remove existing files */
+    /* initialise the dirname/z/x/y.png (or .raw) directory structure, and remove existing files unless resuming,
+    or then only the temporary files of tiles that were never finished. Every directory is made up front and each
+    level's is kept open, so writing a tile never creates a directory and only looks up the names below its level */
     mkdir(dirname, 0755);
-    int code = rm_recurse(dirname);
+    int code = resume ? 0 : rm_recurse(dirname);
     if (code) {
         fprintf(stderr, "Unable to clean map directory\n");
         exit(EXIT_FAILURE);
     }
-    for (unsigned int z = 0; z <= max_zoom; z++) {
+    for (unsigned int z = plan.min_zoom; z <= max_zoom; z++) {
         char z_dir_name[256];
         sprintf(z_dir_name, "%s/%d", dirname, z);
         mkdir(z_dir_name, 0755);
+        level_dirs[z] = open(z_dir_name, O_RDONLY | O_DIRECTORY);
+        if (level_dirs[z] < 0) {
+            fprintf(stderr, "Error: Unable to open directory %s\n", z_dir_name);
+            exit(EXIT_FAILURE);
+        }
+        uint64_t first = 0, end = 1ULL << z;
+        if (region.enabled) { // only the columns of the window
+            first = plan.level_left[z];
+            end = first + plan.level_tiles[z] / plan.level_rows[z];
+        }
+        for (uint64_t x = first; x < end; x++) {
+            char x_dir_name[32];
+            sprintf(x_dir_name, "%" PRIu64, x);
+            if (mkdirat(level_dirs[z], x_dir_name, 0755) && resume) remove_stale(level_dirs[z], x_dir_name);
+        }
     }
 }
 
 
-static void generate_tile_row(unsigned int z, unsigned int x) {
-    /* generate tiles along a given y axis and at the desired zoom level */
-    char y_dir_name[256];
-    sprintf(y_dir_name, "%s/%d/%d", dirname, z, x);
-    mkdir(y_dir_name, 0755);
-    long double range_x = BASE_RANGE_X / pow(2, z);
-    long double start_x = MIN_X + range_x * x;
-    for (unsigned int y = 0; y < pow(2, z); y++) {
-        char tile_name[256];
-        sprintf(tile_name, "%s/%d/%d/%d.png", dirname, z, x, y);
-        long double range_y = BASE_RANGE_Y / pow(2, z);
-        long double start_y = MIN_Y + range_y * y;
-        render_tile(tile_name, start_x, start_y, range_x, range_y);
+static void close_dir(void) {
+    /* close the directories opened by init_dir */
+    for (unsigned int z = plan.min_zoom; z <= max_zoom; z++) close(level_dirs[z]);
+}
+
+
+static uint64_t level_offset(unsigned int z) {
+    /* index of the first tile of level z when every level is laid out one after the other */
+    assert(z <= PYRAMID_MAX_DEPTH);
+    return ((1ULL << (2 * z)) - 1) / 3;
+}
+
+
+static uint64_t spread_bits(uint64_t v) {
+    /* move bit k of a 32-bit value to bit 2k */
+    v &= 0xFFFFFFFFULL;
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+    v = (v | (v << 8)) & 0x00FF00FF00FF00FFULL;
+    v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v << 2)) & 0x3333333333333333ULL;
+    return (v | (v << 1)) & 0x5555555555555555ULL;
+}
+
+
+static uint64_t compact_bits(uint64_t v) {
+    /* inverse of spread_bits, gathering the even bits of v */
+    v &= 0x5555555555555555ULL;
+    v = (v | (v >> 1)) & 0x3333333333333333ULL;
+    v = (v | (v >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v >> 4)) & 0x00FF00FF00FF00FFULL;
+    v = (v | (v >> 8)) & 0x0000FFFF0000FFFFULL;
+    return (v | (v >> 16)) & 0x00000000FFFFFFFFULL;
+}
+
+
+static uint64_t tile_id(unsigned int z, uint64_t x, uint64_t y) {
+    /* the 64-bit id of a tile, a 58-bit Morton index of (x, y) above a 6-bit depth, as archives key tiles by.
+    Only unique up to ID_MAX_DEPTH */
+    return tile_archive_id(z, x, y);
+}
+
+
+static void tile_from_id(uint64_t id, unsigned int* z, uint64_t* x, uint64_t* y) {
+    /* inverse of tile_id */
+    *z = id & 0x3F;
+    *x = compact_bits(id >> 7);
+    *y = compact_bits(id >> 6);
+}
+
+
+static uint64_t morton_index(uint64_t x, uint64_t y) {
+    /* position of tile (x, y) along the Z-order curve through its level, the bits of tile_id above the depth */
+    return (spread_bits(x) << 1) | spread_bits(y);
+}
+
+
+static uint64_t shard_level_bound(unsigned int z, uint64_t root) {
+    /* the Morton index on level z where the subtree of root, a tile of the split level, begins. A tile above the
+    split level belongs with its first descendant on the split level, so this rounds up */
+    assert(z <= PYRAMID_MAX_DEPTH);
+    if (z >= shard.split_zoom) return root << (2 * (z - shard.split_zoom));
+    unsigned int shift = 2 * (shard.split_zoom - z);
+    return (root + (1ULL << shift) - 1) >> shift;
+}
+
+
+static uint64_t root_cost(uint64_t root) {
+    /* estimate the work below a tile of the split level from the iterations run by a grid of SHARD_SAMPLES x
+    SHARD_SAMPLES points across it. Every level below covers the same region, so this is proportional to the cost
+    of the whole subtree. Encoding needs no term of its own: uniform tiles far from the boundary are deduplicated
+    rather than encoded, and the rest take longer to encode the more detail they have, much as they take more
+    iterations. Only the scalar kernel is used, so that every shard, whichever CPU it runs on, computes the same
+    partition */
+    double range_x = ldexp(BASE_RANGE_X, -shard.split_zoom);
+    double range_y = ldexp(BASE_RANGE_Y, -shard.split_zoom);
+    double start_x = MIN_X + range_x * compact_bits(root >> 1);
+    double start_y = MIN_Y + range_y * compact_bits(root);
+    double epsilon = range_x / IMAGE_SIZE * PERIODICITY_EPSILON;
+    uint64_t cost = 0;
+    for (unsigned int i = 0; i < SHARD_SAMPLES; i++) {
+        for (unsigned int j = 0; j < SHARD_SAMPLES; j++) {
+            struct kernel_stats stats = {0};
+            int value = mandelbrot_point(start_x + range_x * (i + 0.5) / SHARD_SAMPLES, start_y + range_y * (j + 0.5) / SHARD_SAMPLES, epsilon, &stats);
+            if (value) cost += 0x100 - value; // escaped after 0xFF - value iterations
+            else if (!use_subdivision) cost += MAX_ITERATIONS - stats.iterations_saved;
+            // inside the set, subdivision fills or prunes the tile without iterating much of it
+        }
+    }
+    return cost;
+}
+
+
+static void plan_shard(void) {
+    /* work out which subtrees this shard renders. The quadtree is cut at the shallowest level with SHARD_ROOTS
+    subtrees per shard, and the subtrees are dealt out in Morton order so each shard gets a compact region,
+    with the boundaries placed to give every shard an equal share of the estimated cost. Each level of a shard
+    is then a contiguous run of Morton indices */
+    shard.split_zoom = 0;
+    while (shard.count > 1 && shard.split_zoom < max_zoom && (1ULL << (2 * shard.split_zoom)) < (uint64_t)SHARD_ROOTS * shard.count) {
+        shard.split_zoom++;
+    }
+    uint64_t num_roots = 1ULL << (2 * shard.split_zoom);
+    shard.first_root = 0;
+    shard.end_root = num_roots;
+    if (shard.count > 1) {
+        uint64_t* costs = malloc(num_roots * sizeof(uint64_t));
+        if (costs == NULL) {fprintf(stderr, "Error: Unable to plan shard\n"); exit(EXIT_FAILURE);}
+        uint64_t total = 0;
+        for (uint64_t root = 0; root < num_roots; root++) total += costs[root] = root_cost(root);
+        // shard i starts at the first root whose preceding roots cost at least i/count of the total
+        uint64_t before = 0;
+        shard.end_root = 0;
+        for (uint64_t root = 0; root < num_roots; root++) {
+            if (before * shard.count < total * shard.id) shard.first_root = root + 1;
+            if (before * shard.count < total * (shard.id + 1)) shard.end_root = root + 1;
+            before += costs[root];
+        }
+        free(costs);
+    }
+}
+
+
+static void window_axis(unsigned int z, long double low, long double high, long double origin, double range, uint64_t* first, uint64_t* count) {
+    /* the tiles of level z along one axis that cover [low, high], widened to at least region.window tiles centred
+    on it and shifted to lie within the level */
+    long double tiles = ldexpl(1, z);
+    long double scale = tiles / range;
+    long double start = floorl((low - origin) * scale);
+    long double end = floorl((high - origin) * scale) + 1;
+    if (end - start < region.window) {
+        start = floorl(((low + high) / 2 - origin) * scale - region.window / 2.0L);
+        end = start + region.window;
+    }
+    if (start < 0) {
+        end -= start;
+        start = 0;
+    }
+    if (end > tiles) {
+        start -= end - tiles;
+        end = tiles;
+    }
+    if (start < 0) start = 0;
+    *first = start;
+    *count = end - start;
+}
+
+
+static void plan_tiles(void) {
+    /* lay out the tiles of each level from min_zoom down: the window around the region, or otherwise the run of
+    Morton indices of this shard */
+    plan.num_tiles = 0;
+    for (unsigned int z = 0; z <= max_zoom; z++) {
+        plan.level_start[z] = plan.num_tiles;
+        if (z < plan.min_zoom) {
+            plan.level_tiles[z] = 0;
+        } else if (region.enabled) {
+            uint64_t columns;
+            window_axis(z, region.min_r, region.max_r, MIN_X, BASE_RANGE_X, &plan.level_left[z], &columns);
+            window_axis(z, region.min_i, region.max_i, MIN_Y, BASE_RANGE_Y, &plan.level_top[z], &plan.level_rows[z]);
+            plan.level_tiles[z] = columns * plan.level_rows[z];
+        } else {
+            plan.level_first[z] = shard_level_bound(z, shard.first_root);
+            plan.level_tiles[z] = shard_level_bound(z, shard.end_root) - plan.level_first[z];
+        }
+        plan.num_tiles += plan.level_tiles[z];
     }
 }
 
 
-static void* tile_worker(void* shared_data_ptr) {
-    /* Asynchronous worker to to generate tiles, where a job is the generation of every tile along
-    a given row at a given depth */
-    struct shared_data* data = (struct shared_data*)shared_data_ptr;
-  
+static unsigned int plan_level(uint64_t ordinal) {
+    /* the level of the tile with the given ordinal */
+    unsigned int z = plan.min_zoom;
+    while (ordinal >= plan.level_start[z] + plan.level_tiles[z]) z++;
+    return z;
+}
+
+
+static void plan_tile(uint64_t ordinal, unsigned int* z, uint64_t* x, uint64_t* y) {
+    /* the tile with the given ordinal. A region's window is ordered by column, a shard's run by Morton index */
+    *z = plan_level(ordinal);
+    uint64_t i = ordinal - plan.level_start[*z];
+    if (region.enabled) {
+        *x = plan.level_left[*z] + i / plan.level_rows[*z];
+        *y = plan.level_top[*z] + i % plan.level_rows[*z];
+        return;
+    }
+    uint64_t morton = plan.level_first[*z] + i;
+    *x = compact_bits(morton >> 1);
+    *y = compact_bits(morton);
+}
+
+
+static uint64_t plan_ordinal(unsigned int z, uint64_t x, uint64_t y) {
+    /* inverse of plan_tile, or PLAN_NONE for a tile this process does not render */
+    if (z > max_zoom || plan.level_tiles[z] == 0) return PLAN_NONE;
+    if (region.enabled) {
+        uint64_t column = x - plan.level_left[z];
+        uint64_t row = y - plan.level_top[z];
+        if (column >= plan.level_tiles[z] / plan.level_rows[z] || row >= plan.level_rows[z]) return PLAN_NONE;
+        return plan.level_start[z] + column * plan.level_rows[z] + row;
+    }
+    uint64_t i = morton_index(x, y) - plan.level_first[z];
+    return i < plan.level_tiles[z] ? plan.level_start[z] + i : PLAN_NONE;
+}
+
+
+static void open_journal(void) {
+    /* open the journal of completed tiles, a sequence of 64-bit tile ids. When resuming, every tile already
+    in the journal is marked as complete, and a record torn by a crash during its append is discarded */
+    char journal_name[256];
+    sprintf(journal_name, "%s/%s", dirname, JOURNAL_NAME);
+    journal_fd = open(journal_name, O_RDWR | O_CREAT | O_APPEND | (resume ? 0 : O_TRUNC), 0644);
+    if (journal_fd < 0) {
+        fprintf(stderr, "Error: Unable to open journal %s\n", journal_name);
+        exit(EXIT_FAILURE);
+    }
+    if (!resume) return;
+
+    completed_tiles = calloc((plan.num_tiles + 63) / 64, sizeof(uint64_t));
+    if (completed_tiles == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the journal bitmap\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t records[1024];
+    uint64_t num_completed = 0;
+    off_t length = 0;
+    ssize_t bytes;
+    while ((bytes = pread(journal_fd, records, sizeof(records), length)) > 0) {
+        length += bytes;
+        for (unsigned int r = 0; r < bytes / sizeof(uint64_t); r++) {
+            unsigned int z;
+            uint64_t x, y;
+            tile_from_id(records[r], &z, &x, &y);
+            uint64_t index = plan_ordinal(z, x, y);
+            if (index == PLAN_NONE) continue;
+            num_completed += !(completed_tiles[index / 64] & (1ULL << (index % 64)));
+            completed_tiles[index / 64] |= 1ULL << (index % 64);
+        }
+        if (bytes % sizeof(uint64_t)) break; // torn final record
+    }
+    if (length % sizeof(uint64_t) && ftruncate(journal_fd, length - length % sizeof(uint64_t))) {
+        fprintf(stderr, "Error: Unable to repair journal %s\n", journal_name);
+        exit(EXIT_FAILURE);
+    }
+    printf("Resuming with %" PRIu64 " of %" PRIu64 " tiles already complete\n", num_completed, plan.num_tiles);
+}
+
+
+static void open_iterations(void) {
+    /* open the sidecar index of raw tile budgets. When resuming, a tile in the journal whose latest record shows
+    points still bounded by a smaller budget than raw_iterations is taken out of the complete tiles and marked
+    to be deepened, as is one without a record, which was rendered with MAX_ITERATIONS before the sidecar was
+    written. Tiles that had no such points are final whatever the budget */
+    char iterations_name[256];
+    sprintf(iterations_name, "%s/%s", dirname, ITERATIONS_NAME);
+    iterations_fd = open(iterations_name, O_RDWR | O_CREAT | O_APPEND | (resume ? 0 : O_TRUNC), 0644);
+    if (iterations_fd < 0) {
+        fprintf(stderr, "Error: Unable to open %s\n", iterations_name);
+        exit(EXIT_FAILURE);
+    }
+    if (!resume) return;
+
+    uint64_t words = (plan.num_tiles + 63) / 64;
+    uint64_t* recorded = calloc(words, sizeof(uint64_t)); // tiles with a record
+    uint64_t* final = calloc(words, sizeof(uint64_t)); // tiles whose latest record needs no larger budget
+    deepen_tiles = calloc(words, sizeof(uint64_t));
+    if (recorded == NULL || final == NULL || deepen_tiles == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the iteration bitmaps\n");
+        exit(EXIT_FAILURE);
+    }
+    struct iteration_record records[512];
+    off_t length = 0;
+    ssize_t bytes;
+    while ((bytes = pread(iterations_fd, records, sizeof(records), length)) > 0) {
+        length += bytes;
+        for (unsigned int r = 0; r < bytes / sizeof(struct iteration_record); r++) {
+            unsigned int z;
+            uint64_t x, y;
+            tile_from_id(records[r].id, &z, &x, &y);
+            uint64_t index = plan_ordinal(z, x, y);
+            if (index == PLAN_NONE) continue;
+            recorded[index / 64] |= 1ULL << (index % 64);
+            if (records[r].budget >= raw_iterations || records[r].capped == 0) final[index / 64] |= 1ULL << (index % 64);
+            else final[index / 64] &= ~(1ULL << (index % 64));
+        }
+        if (bytes % sizeof(struct iteration_record)) break; // torn final record
+    }
+    if (length % sizeof(struct iteration_record) && ftruncate(iterations_fd, length - length % sizeof(struct iteration_record))) {
+        fprintf(stderr, "Error: Unable to repair %s\n", iterations_name);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t num_deepened = 0;
+    for (uint64_t w = 0; w < words; w++) {
+        uint64_t deepen = completed_tiles[w] & ~final[w];
+        if (raw_iterations <= MAX_ITERATIONS) deepen &= recorded[w];
+        completed_tiles[w] &= ~deepen;
+        deepen_tiles[w] = deepen;
+        num_deepened += __builtin_popcountll(deepen);
+    }
+    if (num_deepened) printf("Deepening %" PRIu64 " complete tiles with points still bounded by a budget below %u iterations\n", num_deepened, raw_iterations);
+    free(recorded);
+    free(final);
+}
+
+
+static void journal_flush_locked(void) {
+    /* journal the pending tiles with journal_lock held. The filesystem is synced first, so the contents and the
+    renames of the tiles, spread over every column directory, are on disk before any record vouching for them,
+    and the journal is synced after. A power loss then costs at most the tiles of one batch, which are rendered
+    again on resuming */
+    journal_flushed_ns = clock_ns();
+    if (journal_num_pending == 0) return;
+    size_t length = journal_num_pending * sizeof(uint64_t);
+    if (syncfs(journal_fd) || write(journal_fd, journal_pending, length) != length || fdatasync(journal_fd)) {
+        fprintf(stderr, "Error: Unable to write to journal\n");
+    }
+    journal_num_pending = 0;
+}
+
+
+static void journal_flush(void) {
+    /* journal every tile still pending, once all of them have been written */
+    pthread_mutex_lock(&journal_lock);
+    journal_flush_locked();
+    pthread_mutex_unlock(&journal_lock);
+}
+
+
+static void journal_append(const uint64_t* ids, unsigned int count) {
+    /* record finished tiles by their ids, held back and journalled in batches of up to JOURNAL_BATCH tiles, or
+    at least every JOURNAL_INTERVAL_NS. Each batch is a single O_APPEND write of whole records, so the journal
+    only ever holds whole records */
+    pthread_mutex_lock(&journal_lock);
+    for (unsigned int i = 0; i < count; i++) {
+        if (journal_num_pending == JOURNAL_BATCH) journal_flush_locked();
+        journal_pending[journal_num_pending++] = ids[i];
+    }
+    if (clock_ns() - journal_flushed_ns >= JOURNAL_INTERVAL_NS) journal_flush_locked();
+    pthread_mutex_unlock(&journal_lock);
+}
+
+
+static void record_tiles(const uint64_t* ids, const uint32_t* capped, unsigned int count) {
+    /* record tiles written to dirname in the sidecar with their budget if they are raw, and in the journal. The
+    sidecar record comes first, so a tile in the journal never has an older record than its file, and a tile
+    with a record but no journal entry is simply rendered again on resuming */
+    if (iterations_fd >= 0) {
+        struct iteration_record records[count];
+        for (unsigned int i = 0; i < count; i++) records[i] = (struct iteration_record){ids[i], raw_iterations, capped[i]};
+        if (write(iterations_fd, records, sizeof(records)) != sizeof(records)) {
+            fprintf(stderr, "Error: Unable to write to %s/%s\n", dirname, ITERATIONS_NAME);
+        }
+    }
+    journal_append(ids, count);
+}
+
+
+static void digest_bytes(const void* data, size_t length, struct tile_digest* digest) {
+    /* hash the content of a tile, a multiple of 8 bytes long, with two independent multiply-xorshift chains, so
+    that telling tiles apart by their digest is as good as comparing them */
+    const unsigned char* bytes = data;
+    uint64_t a = 0x243F6A8885A308D3ULL;
+    uint64_t b = 0x13198A2E03707344ULL;
+    for (size_t i = 0; i < length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        a = (a ^ word) * 0x9E3779B97F4A7C15ULL;
+        a ^= a >> 32;
+        b = (b + word) * 0xC2B2AE3D27D4EB4FULL;
+        b ^= b >> 29;
+    }
+    digest->key = a ? a : 1; // 0 marks a free slot
+    digest->check = b;
+}
+
+
+static void digest_tile(png_byte pixels[IMAGE_SIZE][IMAGE_SIZE], struct tile_digest* digest) {
+    /* hash the pixels of a tile */
+    digest_bytes(pixels, IMAGE_SIZE * IMAGE_SIZE, digest);
+}
+
+
+static int dedup_lookup(const struct tile_digest* digest, uint64_t* source, struct dedup_entry** claim) {
+    /* look a tile's content up in the table of emitted tiles. Returns 1 and the index of the emitted copy in
+    source if the content has been written or queued before, with claim set to its slot. Otherwise claim is set
+    to the slot the caller should publish once its copy is written or queued, or NULL when another worker is
+    still writing it or the table is too full */
+    *claim = NULL;
+    uint64_t mask = (1ULL << DEDUP_TABLE_BITS) - 1;
+    uint64_t slot = digest->key & mask;
+    for (unsigned int probe = 0; probe < DEDUP_MAX_PROBES; probe++, slot = (slot + 1) & mask) {
+        struct dedup_entry* entry = &dedup_table[slot];
+        uint64_t key = atomic_load_explicit(&entry->key, memory_order_relaxed);
+        if (key == 0) {
+            if (atomic_compare_exchange_strong(&entry->key, &key, digest->key)) {
+                entry->check = digest->check;
+                *claim = entry;
+                return 0;
+            }
+        }
+        if (key != digest->key) continue;
+        uint64_t first = atomic_load_explicit(&entry->source, memory_order_acquire);
+        if (first == 0 || entry->check != digest->check) return 0;
+        *source = first - 1;
+        *claim = entry;
+        return 1;
+    }
+    return 0;
+}
+
+
+static int link_tile(unsigned int z, uint64_t x, uint64_t y, uint64_t source) {
+    /* emit a tile as a copy of the identical tile with ordinal source: another index entry for the same data in an
+    archive, or a hardlink to its file */
+    unsigned int source_z;
+    uint64_t source_x, source_y;
+    plan_tile(source, &source_z, &source_x, &source_y);
+    if (archive) return tile_archive_link(archive, tile_id(z, x, y), tile_id(source_z, source_x, source_y));
+    char source_name[64], tile_name[64], tmp_name[64 + 4];
+    level_path(source_name, source_x, source_y);
+    level_path(tile_name, x, y);
+    sprintf(tmp_name, "%s.tmp", tile_name);
+    unlinkat(level_dirs[z], tmp_name, 0);
+    if (linkat(level_dirs[source_z], source_name, level_dirs[z], tmp_name, 0) || renameat(level_dirs[z], tmp_name, level_dirs[z], tile_name)) return -1;
+    return 0;
+}
+
+
+static int emit_tile(unsigned int z, uint64_t x, uint64_t y, const struct png_buffer* encoded, struct tile_encoder* encoder, png_byte pixels[IMAGE_SIZE][IMAGE_SIZE]) {
+    /* write a tile to its file, or append it to the archive. A tile not already encoded is encoded from pixels,
+    straight into its file. The archive has to know the length of a tile before reserving space for it, so
+    encoded must be given when writing one */
+    if (archive) {
+        if (tile_archive_append(archive, tile_id(z, x, y), encoded->data, encoded->length)) {
+            fprintf(stderr, "Error: Unable to append tile %d/%" PRIu64 "/%" PRIu64 " to the archive\n", z, x, y);
+            return -1;
+        }
+        return 0;
+    }
+    char tile_name[64];
+    level_path(tile_name, x, y);
+    return save_tile(z, tile_name, encoded, encoder, pixels);
+}
+
+
+static int is_complete(uint64_t index) {
+    /* whether a tile was found in the journal on resuming */
+    return completed_tiles && completed_tiles[index / 64] & (1ULL << (index % 64));
+}
+
+
+static int assembled(unsigned int z, uint64_t x, uint64_t y) {
+    /* whether tile (z, x, y) is built by downsampling its four children instead of being rendered. Only a tile whose
+    children are all rendered by this process can be, so the edges of a region or a shard are rendered */
+    if (downsample_filter < 0 || z >= max_zoom || plan_ordinal(z, x, y) == PLAN_NONE) return 0;
+    for (unsigned int child = 0; child < 4; child++) {
+        if (plan_ordinal(z+1, 2*x + (child >> 1), 2*y + (child & 1)) == PLAN_NONE) return 0;
+    }
+    return 1;
+}
+
+
+static int needed_by_parent(unsigned int z, uint64_t x, uint64_t y) {
+    /* whether the pixels of tile (z, x, y) go into its parent: the parent is assembled and still to be written.
+    The four children of a parent always agree */
+    return z > 0 && assembled(z-1, x >> 1, y >> 1) && !is_complete(plan_ordinal(z-1, x >> 1, y >> 1));
+}
+
+
+static void write_queue_push(uint64_t index, uint64_t source, struct dedup_entry* entry, uint32_t capped, const struct png_buffer* encoded, struct png_buffer* buffer) {
+    /* queue a tile for the writers, waiting while the queue is full. A tile encoded into the worker's buffer is
+    swapped with the empty buffer of its slot, others are copied. Links carry no data */
+    pthread_mutex_lock(&writes.lock);
+    while (writes.length == WRITE_QUEUE_TILES) pthread_cond_wait(&writes.room, &writes.lock);
+    struct write_job* job = &writes.jobs[(writes.head + writes.length++) % WRITE_QUEUE_TILES];
+    job->index = index;
+    job->source = source;
+    job->entry = entry;
+    job->capped = capped;
+    job->data.length = 0;
+    if (encoded == buffer) {
+        struct png_buffer empty = job->data;
+        job->data = *buffer;
+        *buffer = empty;
+    } else if (encoded && tile_sink_buffer(&job->data).write(&job->data, encoded->data, encoded->length)) {
+        fprintf(stderr, "Error: Unable to allocate a queued tile\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_cond_signal(&writes.ready);
+    pthread_mutex_unlock(&writes.lock);
+}
+
+
+static void write_tile(uint64_t index, unsigned int z, uint64_t x, uint64_t y, const struct png_buffer* encoded, const struct tile_digest* digest,
+    uint32_t capped, struct tile_encoder* encoder, struct png_buffer* buffer, png_byte pixels[IMAGE_SIZE][IMAGE_SIZE], struct worker_data* worker, uint64_t time) {
+    /* write a tile whose pixels have been hashed, charging the time since time to the worker. capped is recorded
+    in the sidecar of a raw tile. A tile identical to one already emitted is linked to that copy instead of being
+    encoded again. With writers, tiles are encoded into buffer and queued for them. Otherwise tiles bound for the
+    archive are encoded into buffer, and others straight into their file */
+    struct worker_profile* profile = &worker->profile;
+    uint64_t source;
+    struct dedup_entry* claim;
+    if (dedup_lookup(digest, &source, &claim)) {
+        time = charge(&profile->encode_ns, time);
+        if (num_writers) {
+            write_queue_push(index, source, claim, capped, NULL, buffer);
+            charge(&profile->queue_ns, time);
+            worker->stats.duplicates++;
+            return;
+        }
+        int linked = link_tile(z, x, y, source);
+        if (linked == 0 && !archive) {
+            uint64_t id = tile_id(z, x, y);
+            record_tiles(&id, &capped, 1);
+        }
+        time = charge(&profile->filesystem_ns, time);
+        if (linked == 0) {
+            worker->stats.duplicates++;
+            return;
+        }
+        fprintf(stderr, "Error: Unable to link tile %d/%" PRIu64 "/%" PRIu64 ", writing a copy\n", z, x, y);
+        claim = NULL;
+    }
+    if (encoded == NULL && (archive || num_writers)) {
+        buffer->length = 0;
+        if (encode_tile(encoder, tile_sink_buffer(buffer), pixels)) {
+            fprintf(stderr, "Error: Unable to encode tile %d/%" PRIu64 "/%" PRIu64 "\n", z, x, y);
+            return;
+        }
+        encoded = buffer;
+    }
+    time = charge(&profile->encode_ns, time);
+    if (num_writers) {
+        write_queue_push(index, PLAN_NONE, claim, capped, encoded, buffer);
+        // published once queued, so every link to this copy is queued after it
+        if (claim) atomic_store_explicit(&claim->source, index + 1, memory_order_release);
+        charge(&profile->queue_ns, time);
+        return;
+    }
+    if (emit_tile(z, x, y, encoded, encoder, pixels) == 0) {
+        if (!archive) {
+            uint64_t id = tile_id(z, x, y);
+            record_tiles(&id, &capped, 1);
+        }
+        if (claim) atomic_store_explicit(&claim->source, index + 1, memory_order_release);
+    }
+    charge(encoded ? &profile->filesystem_ns : &profile->encode_ns, time);
+}
+
+
+static int run_write(struct write_job* job) {
+    /* write or link a queued tile. A link first waits for its source to be written, which cannot wait forever
+    since the source was queued, and so taken by a writer, before it */
+    unsigned int z;
+    uint64_t x, y;
+    plan_tile(job->index, &z, &x, &y);
+    if (job->source != PLAN_NONE) {
+        if (atomic_load_explicit(&job->entry->state, memory_order_acquire) == DEDUP_PENDING) {
+            pthread_mutex_lock(&writes.lock);
+            while (atomic_load_explicit(&job->entry->state, memory_order_acquire) == DEDUP_PENDING) {
+                pthread_cond_wait(&writes.written, &writes.lock);
+            }
+            pthread_mutex_unlock(&writes.lock);
+        }
+        if (atomic_load_explicit(&job->entry->state, memory_order_acquire) == DEDUP_WRITTEN && link_tile(z, x, y, job->source) == 0) return 0;
+        fprintf(stderr, "Error: Unable to link tile %d/%" PRIu64 "/%" PRIu64 ", resume to render it\n", z, x, y);
+        return -1;
+    }
+    int code = emit_tile(z, x, y, &job->data, NULL, NULL);
+    if (job->entry) {
+        atomic_store_explicit(&job->entry->state, code ? DEDUP_FAILED : DEDUP_WRITTEN, memory_order_release);
+        pthread_mutex_lock(&writes.lock);
+        pthread_cond_broadcast(&writes.written);
+        pthread_mutex_unlock(&writes.lock);
+    }
+    return code;
+}
+
+
+static void* tile_writer(void* writer_data_ptr) {
+    /* write the tiles queued by the workers, WRITE_BATCH at a time, until the queue is closed and empty. The tiles
+    of a batch written to dirname are recorded in the journal together */
+    struct writer_data* writer = writer_data_ptr;
+    struct write_job batch[WRITE_BATCH] = {0};
+    uint64_t ids[WRITE_BATCH];
+    uint32_t capped[WRITE_BATCH];
+    pthread_mutex_lock(&writes.lock);
     while (1) {
-        pthread_mutex_lock(&data->mutex);
+        while (writes.length == 0 && !writes.closed) pthread_cond_wait(&writes.ready, &writes.lock);
+        if (writes.length == 0) break;
+        unsigned int count = 0;
+        for (; count < WRITE_BATCH && writes.length; count++) {
+            struct write_job* job = &writes.jobs[writes.head];
+            struct png_buffer empty = batch[count].data;
+            batch[count] = *job;
+            job->data = empty;
+            writes.head = (writes.head + 1) % WRITE_QUEUE_TILES;
+            writes.length--;
+        }
+        pthread_cond_broadcast(&writes.room);
+        pthread_mutex_unlock(&writes.lock);
+
+        uint64_t time = clock_ns();
+        unsigned int written = 0;
+        for (unsigned int i = 0; i < count; i++) {
+            if (run_write(&batch[i])) continue;
+            unsigned int z;
+            uint64_t x, y;
+            plan_tile(batch[i].index, &z, &x, &y);
+            capped[written] = batch[i].capped;
+            ids[written++] = tile_id(z, x, y);
+        }
+        if (written && !archive) record_tiles(ids, capped, written);
+        atomic_fetch_add_explicit(&writer->tiles, written, memory_order_relaxed);
+        charge(&writer->write_ns, time);
+        pthread_mutex_lock(&writes.lock);
+    }
+    pthread_mutex_unlock(&writes.lock);
+    for (unsigned int i = 0; i < WRITE_BATCH; i++) free(batch[i].data.data);
+    return NULL;
+}
+
+
+static void writers_start(void) {
+    /* start the writers on an empty queue */
+    pthread_mutex_init(&writes.lock, NULL);
+    pthread_cond_init(&writes.ready, NULL);
+    pthread_cond_init(&writes.room, NULL);
+    pthread_cond_init(&writes.written, NULL);
+    writes.writers = calloc(num_writers, sizeof(struct writer_data));
+    if (writes.writers == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the writers\n");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned int i = 0; i < num_writers; i++) pthread_create(&writes.writers[i].thread, NULL, tile_writer, &writes.writers[i]);
+}
+
+
+static void writers_finish(void) {
+    /* close the queue once the workers are done, and wait for the writers to empty it */
+    pthread_mutex_lock(&writes.lock);
+    writes.closed = 1;
+    pthread_cond_broadcast(&writes.ready);
+    pthread_mutex_unlock(&writes.lock);
+    for (unsigned int i = 0; i < num_writers; i++) pthread_join(writes.writers[i].thread, NULL);
+    for (unsigned int i = 0; i < WRITE_QUEUE_TILES; i++) free(writes.jobs[i].data.data);
+    pthread_cond_destroy(&writes.written);
+    pthread_cond_destroy(&writes.room);
+    pthread_cond_destroy(&writes.ready);
+    pthread_mutex_destroy(&writes.lock);
+}
+
+
+static int generate_tile(uint64_t index, struct tile_encoder* encoder, struct png_buffer* buffer, png_byte pixels[IMAGE_SIZE][IMAGE_SIZE], struct worker_data* worker) {
+    /* render and write the tile with the given ordinal. Returns 1 when its pixels are left in pixels to be
+    downsampled into its parent. When resuming, a tile already written is only read back for its parent,
+    and rendered and written again if that fails, as the file on disk is missing or damaged */
+    unsigned int z;
+    uint64_t x, y;
+    plan_tile(index, &z, &x, &y);
+    if (index == plan.level_start[z]) printf("Generating level %d\n", z);
+    int needed = needed_by_parent(z, x, y);
+    int decode_failed = 0;
+    if (is_complete(index)) {
+        if (!needed) return 0;
+        char tile_name[256];
+        sprintf(tile_name, "%s/%d/%" PRIu64 "/%" PRIu64 ".%s", dirname, z, x, y, tile_format_extension(tile_format));
+        if (decode_tile(tile_name, pixels) == 0) return 1;
+        decode_failed = 1;
+    }
+
+    const struct png_buffer* encoded = NULL;
+    struct tile_digest digest;
+    if (solid_tiles && z > 0) {
+        uint64_t parent = plan_ordinal(z-1, x >> 1, y >> 1); // not rendered here when it belongs to another shard
+        if (parent != PLAN_NONE && solid_tiles[parent / 64] & (1ULL << (parent % 64))) { // pruned, the whole subtree is inside the set
+            atomic_fetch_or(&solid_tiles[index / 64], 1ULL << (index % 64));
+            worker->stats.solid_tiles++;
+            encoded = &solid_tile;
+            digest = solid_digest;
+        }
+    }
+    uint64_t time = clock_ns();
+    if (encoded == NULL) {
+        struct worker_profile* profile = &worker->profile;
+        int solid = render_tile(pixels, z, x, y, use_subdivision, antialias_samples, NULL, &worker->stats);
+        worker->tiles_rendered++;
+        if (solid && solid_tiles) atomic_fetch_or(&solid_tiles[index / 64], 1ULL << (index % 64));
+        time = charge(&profile->iterate_ns, time);
+        digest_tile(pixels, &digest);
+    }
+    if (!is_complete(index) || decode_failed) write_tile(index, z, x, y, encoded, &digest, 0, encoder, buffer, pixels, worker, time);
+    return needed;
+}
+
+
+static void generate_raw_tile(uint64_t index, struct tile_encoder* encoder, struct png_buffer* buffer, uint16_t values[IMAGE_SIZE][IMAGE_SIZE], struct worker_data* worker) {
+    /* render and write the tile with the given ordinal as a raw tile. Raw tiles are always encoded into buffer,
+    since the encoder has no file sink of its own for them. A tile to be deepened is read back so that only its
+    points inside the set are iterated again, or rendered afresh if that fails */
+    unsigned int z;
+    uint64_t x, y;
+    plan_tile(index, &z, &x, &y);
+    if (index == plan.level_start[z]) printf("Generating level %d\n", z);
+    if (is_complete(index)) return;
+
+    uint64_t time = clock_ns();
+    int deepen = deepen_tiles && deepen_tiles[index / 64] & (1ULL << (index % 64));
+    if (deepen) {
+        char tile_name[256];
+        sprintf(tile_name, "%s/%d/%" PRIu64 "/%" PRIu64 ".raw", dirname, z, x, y);
+        deepen = decode_raw_tile(tile_name, values) == 0;
+    }
+    int capped = render_raw_tile(values, z, x, y, raw_iterations, deepen, NULL, &worker->stats);
+    worker->tiles_rendered++;
+    worker->tiles_deepened += deepen;
+    worker->tiles_capped += capped > 0;
+    time = charge(&worker->profile.iterate_ns, time);
+    struct tile_digest digest;
+    digest_bytes(values, IMAGE_SIZE * IMAGE_SIZE * sizeof(uint16_t), &digest);
+    buffer->length = 0;
+    if (encode_raw_tile(encoder, tile_sink_buffer(buffer), values)) return;
+    write_tile(index, z, x, y, buffer, &digest, capped, encoder, buffer, NULL, worker, time);
+}
+
+
+static void finish_tile(struct shared_data* data, struct worker_data* worker, uint64_t index) {
+    /* count a finished tile towards its worker and its level, noting when the level is complete */
+    unsigned int z = plan_level(index);
+    atomic_fetch_add_explicit(&worker->profile.tiles, 1, memory_order_relaxed);
+    if (atomic_fetch_add_explicit(&data->level_done[z], 1, memory_order_relaxed) + 1 == plan.level_tiles[z]) {
+        atomic_store_explicit(&data->level_finished_ns[z], clock_ns() - data->start_ns, memory_order_relaxed);
+    }
+}
+
+
+static struct pending_tile* claim_pending(struct shared_data* data, uint64_t index) {
+    /* find the parent being assembled with the given ordinal, starting it if no child has arrived yet */
+    struct pending_tile** bucket = &data->pending[index % PENDING_BUCKETS];
+    pthread_mutex_lock(&data->pending_lock);
+    struct pending_tile* tile = *bucket;
+    while (tile && tile->index != index) tile = tile->next;
+    if (tile == NULL) {
+        tile = data->pending_free;
+        if (tile) data->pending_free = tile->next;
+        else tile = malloc(sizeof(struct pending_tile));
+        if (tile == NULL) {
+            fprintf(stderr, "Error: Unable to allocate a tile to downsample into\n");
+            exit(EXIT_FAILURE);
+        }
+        tile->index = index;
+        atomic_init(&tile->children, 0);
+        tile->next = *bucket;
+        *bucket = tile;
+    }
+    pthread_mutex_unlock(&data->pending_lock);
+    return tile;
+}
+
+
+static void release_pending(struct shared_data* data, struct pending_tile* tile, int assembled) {
+    /* take a parent out of the table once its last child has arrived, or put one that has been written and
+    downsampled in turn on the free list */
+    pthread_mutex_lock(&data->pending_lock);
+    if (assembled) {
+        struct pending_tile** link = &data->pending[tile->index % PENDING_BUCKETS];
+        while (*link != tile) link = &(*link)->next;
+        *link = tile->next;
+    } else {
+        tile->next = data->pending_free;
+        data->pending_free = tile;
+    }
+    pthread_mutex_unlock(&data->pending_lock);
+}
 
-        if (data->current_depth > max_zoom) { // exit thread
-            pthread_mutex_unlock(&data->mutex);
-            return NULL;
+
+static void assemble_parents(struct shared_data* data, struct worker_data* worker, uint64_t index, png_byte pixels[IMAGE_SIZE][IMAGE_SIZE],
+    struct tile_encoder* encoder, struct png_buffer* buffer) {
+    /* downsample a finished tile into its quadrant of its parent. Children reach a parent in any order, and the
+    worker that brings the last of the four writes the parent and carries on up the quadtree with it, so each
+    level is built as soon as the tiles below it are done */
+    struct pending_tile* done = NULL; // the parent written on the last step, whose pixels are being passed up
+    unsigned int z;
+    uint64_t x, y;
+    plan_tile(index, &z, &x, &y);
+    while (needed_by_parent(z, x, y)) {
+        uint64_t time = clock_ns();
+        uint64_t parent = plan_ordinal(z-1, x >> 1, y >> 1);
+        struct pending_tile* tile = claim_pending(data, parent);
+        downsample_tile(tile->pixels, x & 1, y & 1, pixels, downsample_filter);
+        if (done) release_pending(data, done, 0);
+        done = NULL;
+        unsigned int children = atomic_fetch_add_explicit(&tile->children, 1, memory_order_acq_rel) + 1;
+        time = charge(&worker->profile.downsample_ns, time);
+        if (children < 4) return;
+
+        release_pending(data, tile, 1);
+        z--;
+        x >>= 1;
+        y >>= 1;
+        worker->tiles_downsampled++;
+        struct tile_digest digest;
+        digest_tile(tile->pixels, &digest);
+        write_tile(parent, z, x, y, NULL, &digest, 0, encoder, buffer, tile->pixels, worker, time);
+        finish_tile(data, worker, parent);
+        pixels = tile->pixels;
+        done = tile;
+    }
+    if (done) release_pending(data, done, 0);
+}
+
+
+static void lock_deque(struct tile_deque* deque, struct worker_data* worker) {
+    /* lock a deque, charging the wait to the worker's profile when another worker holds it */
+    if (pthread_mutex_trylock(&deque->lock) == 0) return;
+    uint64_t start = clock_ns();
+    pthread_mutex_lock(&deque->lock);
+    charge(&worker->profile.lock_ns, start);
+}
+
+
+static int deque_pop(struct tile_deque* deque, uint64_t* index, struct worker_data* worker) {
+    /* take the next tile from the front of a worker's own deque */
+    lock_deque(deque, worker);
+    int found = deque->head < deque->tail;
+    if (found) *index = deque->head++;
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+
+static int deque_steal(struct shared_data* data, struct worker_data* thief) {
+    /* move the back half of another worker's deque into the thief's own deque. Victims are visited
+    starting after the thief so that idle workers spread out over the busy ones */
+    for (unsigned int offset = 1; offset < data->num_workers; offset++) {
+        struct tile_deque* victim = &data->deques[(thief->id + offset) % data->num_workers];
+        lock_deque(victim, thief);
+        uint64_t remaining = victim->tail - victim->head;
+        if (remaining == 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
         }
-        unsigned int z = data->current_depth;
-        unsigned int x = data->current_row;
-        data->current_row++;
-        if (data->current_row >= pow(2, data->current_depth)) {
-            data->current_row = 0;
-            data->current_depth++;
+        uint64_t tail = victim->tail;
+        victim->tail -= (remaining + 1) / 2;
+        uint64_t head = victim->tail;
+        pthread_mutex_unlock(&victim->lock);
+
+        struct tile_deque* own = &data->deques[thief->id];
+        lock_deque(own, thief);
+        own->head = head;
+        own->tail = tail;
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    return 0;
+}
+
+
+static void* tile_worker(void* worker_data_ptr) {
+    /* Asynchronous worker to generate tiles. Each worker renders tiles from its own deque, refills it
+    with the next TILE_CHUNK tiles of the pyramid, and once the pyramid is exhausted steals from the
+    other workers. Levels are laid out back to back, so the next level starts while the last tiles
+    of the previous one are still being rendered. When downsampling, tiles built from their children
+    are passed over here and written by assemble_parents instead */
+    struct worker_data* worker = (struct worker_data*)worker_data_ptr;
+    struct shared_data* data = worker->shared;
+    struct tile_deque* own = &data->deques[worker->id];
+    struct tile_encoder encoder = encoder_options;
+    struct png_buffer buffer = {0};
+    png_byte (*pixels)[IMAGE_SIZE] = malloc(IMAGE_SIZE * IMAGE_SIZE);
+    uint16_t (*values)[IMAGE_SIZE] = tile_format == TILE_RAW ? malloc(IMAGE_SIZE * IMAGE_SIZE * sizeof(uint16_t)) : NULL;
+    if (pixels == NULL || (tile_format == TILE_RAW && values == NULL)) {
+        fprintf(stderr, "Error: Unable to allocate tile buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1) {
+        uint64_t index;
+        if (deque_pop(own, &index, worker)) {
+            if (values) {
+                generate_raw_tile(index, &encoder, &buffer, values, worker);
+                finish_tile(data, worker, index);
+                continue;
+            }
+            unsigned int z;
+            uint64_t x, y;
+            plan_tile(index, &z, &x, &y);
+            if (assembled(z, x, y) && !is_complete(index)) continue; // built once its children are done
+            int needed = generate_tile(index, &encoder, &buffer, pixels, worker);
+            finish_tile(data, worker, index);
+            if (needed) assemble_parents(data, worker, index, pixels, &encoder, &buffer);
+            continue;
         }
-        if (data->current_depth > max_zoom && data->current_row) { // exit thread
-            pthread_mutex_unlock(&data->mutex);
-            return NULL;
+        uint64_t head = atomic_fetch_add(&data->next_tile, TILE_CHUNK);
+        if (head < data->num_tiles) {
+            lock_deque(own, worker);
+            own->head = head;
+            own->tail = head + TILE_CHUNK < data->num_tiles ? head + TILE_CHUNK : data->num_tiles;
+            pthread_mutex_unlock(&own->lock);
+            continue;
+        }
+        if (!deque_steal(data, worker)) break; // no work left that isn't already being rendered
+    }
+    free(pixels);
+    free(values);
+    free(buffer.data);
+    tile_encoder_free(&encoder);
+    return NULL;
+}
+
+
+static void format_duration(char* text, double seconds) {
+    /* write a duration as h:mm:ss */
+    uint64_t total = seconds + 0.5;
+    sprintf(text, "%" PRIu64 ":%02u:%02u", total / 3600, (unsigned int)(total / 60 % 60), (unsigned int)(total % 60));
+}
+
+
+static void print_progress(struct shared_data* data, uint64_t* last_done, uint64_t* last_ns) {
+    /* print the tiles finished on each level, the recent rate and the time left, then how each worker has spent
+    its time so far */
+    uint64_t time = clock_ns();
+    double elapsed = (time - data->start_ns) * 1e-9;
+    uint64_t done = 0;
+    for (unsigned int i = 0; i < data->num_workers; i++) {
+        done += atomic_load_explicit(&data->workers[i].profile.tiles, memory_order_relaxed);
+    }
+    double rate = (done - *last_done) / ((time - *last_ns) * 1e-9);
+    double average = done / elapsed;
+    char eta[32];
+    if (average > 0) format_duration(eta, (data->num_tiles - done) / average);
+    else strcpy(eta, "unknown");
+    printf("Progress: %" PRIu64 " of %" PRIu64 " tiles (%.1f%%), %.1f tiles/s, ETA %s\n",
+        done, data->num_tiles, 100.0 * done / data->num_tiles, rate, eta);
+    *last_done = done;
+    *last_ns = time;
+
+    // levels finished so far are summarised, levels in progress are listed
+    unsigned int complete = 0;
+    while (complete <= max_zoom && atomic_load_explicit(&data->level_done[complete], memory_order_relaxed) == plan.level_tiles[complete]) {
+        complete++;
+    }
+    const char* separator = "  ";
+    if (complete) {
+        printf("  levels 0-%u done", complete - 1);
+        separator = ", ";
+    }
+    for (unsigned int z = complete; z <= max_zoom; z++) {
+        uint64_t level_done = atomic_load_explicit(&data->level_done[z], memory_order_relaxed);
+        if (level_done == 0) break;
+        uint64_t level_tiles = plan.level_tiles[z];
+        printf("%slevel %u %" PRIu64 "/%" PRIu64 " (%.1f%%)", separator, z, level_done, level_tiles, 100.0 * level_done / level_tiles);
+        separator = ", ";
+    }
+    printf("\n");
+
+    for (unsigned int i = 0; i < data->num_workers; i++) {
+        struct worker_profile* profile = &data->workers[i].profile;
+        double scale = 100 / (elapsed * 1e9);
+        printf("  worker %u: %" PRIu64 " tiles, iterate %.1f%%, downsample %.1f%%, encode %.1f%%, filesystem %.1f%%, queue %.1f%%, lock wait %.1f%%\n", i,
+            atomic_load_explicit(&profile->tiles, memory_order_relaxed),
+            atomic_load_explicit(&profile->iterate_ns, memory_order_relaxed) * scale,
+            atomic_load_explicit(&profile->downsample_ns, memory_order_relaxed) * scale,
+            atomic_load_explicit(&profile->encode_ns, memory_order_relaxed) * scale,
+            atomic_load_explicit(&profile->filesystem_ns, memory_order_relaxed) * scale,
+            atomic_load_explicit(&profile->queue_ns, memory_order_relaxed) * scale,
+            atomic_load_explicit(&profile->lock_ns, memory_order_relaxed) * scale);
+    }
+    if (num_writers) {
+        pthread_mutex_lock(&writes.lock);
+        unsigned int queued = writes.length;
+        pthread_mutex_unlock(&writes.lock);
+        printf("  write queue: %u of %u tiles\n", queued, WRITE_QUEUE_TILES);
+    }
+    for (unsigned int i = 0; i < num_writers; i++) {
+        printf("  writer %u: %" PRIu64 " tiles, busy %.1f%%\n", i, atomic_load_explicit(&writes.writers[i].tiles, memory_order_relaxed),
+            atomic_load_explicit(&writes.writers[i].write_ns, memory_order_relaxed) * 100 / (elapsed * 1e9));
+    }
+    fflush(stdout);
+}
+
+
+static void* progress_reporter(void* shared_data_ptr) {
+    /* print a progress report every report_interval seconds until the workers signal timereport on finishing */
+    struct shared_data* data = shared_data_ptr;
+    uint64_t last_done = 0;
+    uint64_t last_ns = data->start_ns;
+    uint64_t interval_ns = report_interval * 1e9;
+    pthread_mutex_lock(&data->report_lock);
+    while (!data->finished) {
+        uint64_t deadline = clock_ns() + interval_ns;
+        struct timespec wake = {.tv_sec = deadline / 1000000000ULL, .tv_nsec = deadline % 1000000000ULL};
+        if (pthread_cond_timedwait(&data->timereport, &data->report_lock, &wake) == ETIMEDOUT && !data->finished) {
+            print_progress(data, &last_done, &last_ns);
         }
+    }
+    pthread_mutex_unlock(&data->report_lock);
+    return NULL;
+}
 
-        pthread_mutex_unlock(&data->mutex);
-        
-        // do the work
-        if (x == 0) printf("Generating level %d\n", z);
-        generate_tile_row(z, x);
+
+static void write_profile(struct shared_data* data, struct worker_data* workers, uint64_t elapsed_ns, const struct kernel_stats* stats) {
+    /* write a JSON summary of the run: when each level finished and where each worker spent its time */
+    FILE* file = fopen(profile_name, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to write profile %s\n", profile_name);
+        return;
+    }
+    fprintf(file, "{\n  \"max_zoom\": %u,\n  \"threads\": %u,\n  \"kernel\": \"%s\",\n  \"subdivision\": %s,\n  \"archive\": %s,\n",
+        max_zoom, data->num_workers, row_kernel_name, use_subdivision ? "true" : "false", archive ? "true" : "false");
+    fprintf(file, "  \"min_zoom\": %u,\n  \"downsample\": %s%s%s,\n  \"antialias_samples\": %u,\n  \"format\": \"%s\",\n", plan.min_zoom,
+        downsample_name ? "\"" : "", downsample_name ? downsample_name : "null", downsample_name ? "\"" : "", antialias_samples, tile_format_extension(tile_format));
+    if (region.enabled) {
+        fprintf(file, "  \"region\": {\"min_r\": %.21Lg, \"min_i\": %.21Lg, \"max_r\": %.21Lg, \"max_i\": %.21Lg, \"window\": %u},\n",
+            region.min_r, region.min_i, region.max_r, region.max_i, region.window);
+    }
+    fprintf(file, "  \"shard\": {\"id\": %u, \"count\": %u, \"split_zoom\": %u, \"first_root\": %" PRIu64 ", \"end_root\": %" PRIu64 "},\n",
+        shard.id, shard.count, shard.split_zoom, shard.first_root, shard.end_root);
+    fprintf(file, "  \"encoder\": {\"level\": %d, \"strategy\": \"%s\", \"filters\": \"%s\"},\n",
+        encoder_options.level, strategy_name, filters_name);
+    fprintf(file, "  \"tiles\": %" PRIu64 ",\n  \"seconds\": %.6f,\n  \"tiles_per_s\": %.2f,\n",
+        data->num_tiles, elapsed_ns * 1e-9, data->num_tiles / (elapsed_ns * 1e-9));
+    fprintf(file, "  \"stats\": {\"cardioid\": %" PRIu64 ", \"bulb\": %" PRIu64 ", \"periodic\": %" PRIu64 ", \"iterations_saved\": %" PRIu64
+        ", \"filled\": %" PRIu64 ", \"solid_tiles\": %" PRIu64 ", \"duplicates\": %" PRIu64 ", \"refined\": %" PRIu64 ", \"iterations\": %u, \"capped\": %" PRIu64 "},\n",
+        stats->cardioid, stats->bulb, stats->periodic, stats->iterations_saved, stats->filled, stats->solid_tiles, stats->duplicates, stats->refined,
+        raw_iterations, stats->capped);
+    fprintf(file, "  \"levels\": [\n");
+    for (unsigned int z = 0; z <= max_zoom; z++) {
+        fprintf(file, "    {\"z\": %u, \"tiles\": %" PRIu64 ", \"finished_s\": %.6f}%s\n", z, plan.level_tiles[z],
+            atomic_load(&data->level_finished_ns[z]) * 1e-9, z < max_zoom ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"workers\": [\n");
+    for (unsigned int i = 0; i < data->num_workers; i++) {
+        struct worker_profile* profile = &workers[i].profile;
+        uint64_t accounted = profile->iterate_ns + profile->downsample_ns + profile->encode_ns + profile->filesystem_ns + profile->queue_ns + profile->lock_ns;
+        fprintf(file, "    {\"id\": %u, \"tiles\": %" PRIu64 ", \"rendered\": %" PRIu64 ", \"downsampled\": %" PRIu64 ", \"iterate_s\": %.6f, "
+            "\"downsample_s\": %.6f, \"encode_s\": %.6f, \"filesystem_s\": %.6f, \"queue_s\": %.6f, \"lock_wait_s\": %.6f, \"other_s\": %.6f}%s\n",
+            i, atomic_load(&profile->tiles), workers[i].tiles_rendered, workers[i].tiles_downsampled, profile->iterate_ns * 1e-9,
+            profile->downsample_ns * 1e-9, profile->encode_ns * 1e-9, profile->filesystem_ns * 1e-9, profile->queue_ns * 1e-9,
+            profile->lock_ns * 1e-9, accounted < elapsed_ns ? (elapsed_ns - accounted) * 1e-9 : 0.0, i + 1 < data->num_workers ? "," : "");
     }
+    fprintf(file, "  ],\n  \"writers\": [\n");
+    for (unsigned int i = 0; i < num_writers; i++) {
+        fprintf(file, "    {\"id\": %u, \"tiles\": %" PRIu64 ", \"write_s\": %.6f}%s\n", i, atomic_load(&writes.writers[i].tiles),
+            atomic_load(&writes.writers[i].write_ns) * 1e-9, i + 1 < num_writers ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    if (fclose(file)) fprintf(stderr, "Unable to write profile %s\n", profile_name);
 }
 
 
 static void worker_dispatch(unsigned int num_workers) {
-    /* Asynchronously generates the tilemap by dispatching the generation of rows to different worker threads. */
-    
-    // initialise mutex and shared data
+    /* Asynchronously generates the tilemap by dispatching tiles to different worker threads. */
+
+    // initialise deques and shared data
+    struct tile_deque deques[num_workers];
+    struct worker_data worker_data[num_workers];
     struct shared_data data = {
-        .current_depth = 0,
-        .current_row = 0
+        .num_tiles = plan.num_tiles,
+        .num_workers = num_workers,
+        .deques = deques,
+        .workers = worker_data
     };
-    pthread_mutex_init(&data.mutex, NULL);
+    atomic_init(&data.next_tile, 0);
     pthread_t workers[num_workers];
+    pthread_t reporter;
+    pthread_mutex_init(&data.report_lock, NULL);
+    pthread_mutex_init(&data.pending_lock, NULL);
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&data.timereport, &condattr);
+    pthread_condattr_destroy(&condattr);
 
     // initialise workers
     for (unsigned int i = 0; i < num_workers; i++) {
-        pthread_create(&workers[i], NULL, tile_worker, &data);
+        pthread_mutex_init(&deques[i].lock, NULL);
+        deques[i].head = deques[i].tail = 0;
+    }
+    data.start_ns = clock_ns();
+    if (num_writers) writers_start();
+    for (unsigned int i = 0; i < num_workers; i++) {
+        worker_data[i] = (struct worker_data){.shared = &data, .id = i};
+        pthread_create(&workers[i], NULL, tile_worker, &worker_data[i]);
     }
+    if (report_interval > 0) pthread_create(&reporter, NULL, progress_reporter, &data);
 
     // Wait for workers to exit
+    struct kernel_stats stats = {0};
+    uint64_t tiles_rendered = 0, tiles_downsampled = 0, tiles_deepened = 0, tiles_capped = 0;
     for (int w = 0; w < num_workers; w++) {
         pthread_join(workers[w], NULL);
+        tiles_rendered += worker_data[w].tiles_rendered;
+        tiles_downsampled += worker_data[w].tiles_downsampled;
+        tiles_deepened += worker_data[w].tiles_deepened;
+        tiles_capped += worker_data[w].tiles_capped;
+        stats.cardioid += worker_data[w].stats.cardioid;
+        stats.bulb += worker_data[w].stats.bulb;
+        stats.periodic += worker_data[w].stats.periodic;
+        stats.iterations_saved += worker_data[w].stats.iterations_saved;
+        stats.filled += worker_data[w].stats.filled;
+        stats.solid_tiles += worker_data[w].stats.solid_tiles;
+        stats.duplicates += worker_data[w].stats.duplicates;
+        stats.refined += worker_data[w].stats.refined;
+        stats.capped += worker_data[w].stats.capped;
+    }
+    if (num_writers) writers_finish();
+    uint64_t elapsed_ns = clock_ns() - data.start_ns;
+    pthread_mutex_lock(&data.report_lock);
+    data.finished = 1;
+    pthread_cond_signal(&data.timereport);
+    pthread_mutex_unlock(&data.report_lock);
+    if (report_interval > 0) pthread_join(reporter, NULL);
+    printf("Generated %" PRIu64 " tiles in %.1f s, %.1f tiles/s\n", data.num_tiles, elapsed_ns * 1e-9, data.num_tiles / (elapsed_ns * 1e-9));
+    printf("Interior shortcuts: %" PRIu64 " cardioid, %" PRIu64 " bulb and %" PRIu64 " periodic pixels, saving %" PRIu64 " iterations (%.0f per tile)\n",
+        stats.cardioid, stats.bulb, stats.periodic, stats.iterations_saved, tiles_rendered ? (double)stats.iterations_saved / tiles_rendered : 0.0);
+    if (use_subdivision) {
+        printf("Subdivision: %" PRIu64 " pixels filled without rendering, %" PRIu64 " tiles pruned as solid\n", stats.filled, stats.solid_tiles);
+    }
+    if (antialias_samples) {
+        printf("Anti-aliasing: %" PRIu64 " edge pixels refined with %u extra samples each, %.2f%% of those rendered\n", stats.refined,
+            antialias_samples, tiles_rendered ? 100.0 * stats.refined / (tiles_rendered * IMAGE_SIZE * IMAGE_SIZE) : 0.0);
+    }
+    if (downsample_filter >= 0) {
+        printf("Downsampling: %" PRIu64 " tiles built from their children, %" PRIu64 " rendered\n", tiles_downsampled, tiles_rendered);
     }
-    pthread_mutex_destroy(&data.mutex);
+    if (tile_format == TILE_RAW) {
+        printf("Iterations: %" PRIu64 " pixels in %" PRIu64 " tiles still bounded after %u iterations, %" PRIu64 " tiles deepened\n",
+            stats.capped, tiles_capped, raw_iterations, tiles_deepened);
+    }
+    uint64_t tiles_emitted = tiles_rendered + tiles_downsampled + stats.solid_tiles;
+    printf("Deduplication: %" PRIu64 " of %" PRIu64 " tiles were duplicates emitted as %s, dedup ratio %.2f:1\n",
+        stats.duplicates, tiles_emitted, archive ? "shared archive entries" : "hardlinks",
+        tiles_emitted > stats.duplicates ? (double)tiles_emitted / (tiles_emitted - stats.duplicates) : 1.0);
+    if (profile_name) write_profile(&data, worker_data, elapsed_ns, &stats);
+    for (unsigned int i = 0; i < num_workers; i++) {
+        pthread_mutex_destroy(&deques[i].lock);
+    }
+    free(writes.writers);
+    while (data.pending_free) {
+        struct pending_tile* next = data.pending_free->next;
+        free(data.pending_free);
+        data.pending_free = next;
+    }
+    pthread_cond_destroy(&data.timereport);
+    pthread_mutex_destroy(&data.report_lock);
+    pthread_mutex_destroy(&data.pending_lock);
 }
 
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {fprintf(stderr, "Usage: %s <zoom-levels> <max-threads>\n", argv[0]); exit(EXIT_FAILURE);}
-    max_zoom = atoi(argv[1]);
-    if (max_zoom > MAX_DEPTH) {fprintf(stderr, "Error: Zoom level must be at most %d\n", MAX_DEPTH); exit(EXIT_FAILURE);}
-    unsigned int num_threads = atoi(argv[2]);
-    init_dir();
-    printf("Generating tile maps with zoom level %d using %d threads. Target resolution: %.0fx%.0f pixels\n", max_zoom, num_threads, IMAGE_SIZE * pow(2, max_zoom), IMAGE_SIZE * pow(2, max_zoom));
-    worker_dispatch(num_threads);
-
-    // write params file for leaflet
-    char param_filename[256];
+static int write_params(void) {
+    /* write the parameter file read by leaflet, which also tells a merge how deep a shard's pyramid goes */
+    char param_filename[256 + 16];
     sprintf(param_filename, "%s/params.js", dirname);
     FILE* param_file = fopen(param_filename, "w");
     if (param_file == NULL) {
         fprintf(stderr, "Unable to write parameter file\n");
-        return EXIT_FAILURE;
+        return -1;
     }
     fprintf(param_file, "const max_zoom = %d;\nconst image_size = %d;\n", max_zoom, IMAGE_SIZE);
+    if (tile_format == TILE_RAW) fprintf(param_file, "const tile_format = \"raw\";\n"); // for mandelbrot-clientside.html to colour
+    if (region.enabled) { // where the client opens the map, in the pixels of level 0 that leaflet uses as coordinates
+        long double centre_r = (region.min_r + region.max_r) / 2, centre_i = (region.min_i + region.max_i) / 2;
+        fprintf(param_file, "const centre = [%.17Lg, %.17Lg];\nconst start_zoom = %u;\n", -(centre_i - MIN_Y) / BASE_RANGE_Y * IMAGE_SIZE,
+            (centre_r - MIN_X) / BASE_RANGE_X * IMAGE_SIZE, plan.min_zoom);
+    }
+    return fclose(param_file);
+}
+
+
+static int read_params(const char* dir, unsigned int* zoom, unsigned int* image_size, int* format) {
+    /* read back the parameter file of a finished pyramid, whose tiles are PNGs unless it names another format */
+    char param_filename[256 + 16];
+    snprintf(param_filename, sizeof(param_filename), "%s/params.js", dir);
+    FILE* param_file = fopen(param_filename, "r");
+    if (param_file == NULL) return -1;
+    char name[4];
+    int count = fscanf(param_file, "const max_zoom = %u; const image_size = %u;", zoom, image_size);
+    *format = count == 2 && fscanf(param_file, " const tile_format = \"%3[a-z]\";", name) == 1 ? tile_format_from_name(name) : TILE_PNG;
     fclose(param_file);
+    return count == 2 && *format >= 0 ? 0 : -1;
+}
+
+
+static int same_file(const char* a, const char* b) {
+    /* whether two paths name the same file or directory */
+    char path_a[PATH_MAX], path_b[PATH_MAX];
+    return realpath(a, path_a) && realpath(b, path_b) && strcmp(path_a, path_b) == 0;
+}
+
+
+static int copy_file(const char* source, const char* destination) {
+    /* copy a tile that cannot be hardlinked because it is on another filesystem */
+    int in = open(source, O_RDONLY);
+    if (in < 0) return -1;
+    int out = open(destination, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+    char buffer[1 << 16];
+    ssize_t count;
+    int code = 0;
+    while ((count = read(in, buffer, sizeof(buffer))) > 0) {
+        if (write(out, buffer, count) != count) {
+            code = -1;
+            break;
+        }
+    }
+    if (count < 0) code = -1;
+    close(in);
+    return close(out) | code;
+}
+
+
+static uint64_t parse_index(const char* name, const char* suffix, unsigned int z) {
+    /* the x or y of a tile on level z from the name of its column directory or of its file, which is the number
+    followed by suffix, or UINT64_MAX for any other name */
+    char* end;
+    if (*name < '0' || *name > '9') return UINT64_MAX;
+    uint64_t value = strtoull(name, &end, 10);
+    return strcmp(end, suffix) || value >> z ? UINT64_MAX : value;
+}
+
+
+static uint64_t merge_level(const char* input, unsigned int z) {
+    /* link every tile of level z in an input directory into dirname, walking the columns and tiles the input
+    actually has, so a sparse shard costs only what it holds. Returns the number of tiles merged */
+    char level_name[256 + 16];
+    snprintf(level_name, sizeof(level_name), "%s/%u", input, z);
+    DIR* level = opendir(level_name);
+    if (level == NULL) return 0; // a shard may have no tiles on this level
+    char suffix[8];
+    sprintf(suffix, ".%s", tile_format_extension(tile_format));
+    uint64_t merged = 0;
+    struct dirent* column_entry;
+    while ((column_entry = readdir(level))) {
+        uint64_t x = parse_index(column_entry->d_name, "", z);
+        if (x == UINT64_MAX) continue;
+        int column_fd = openat(dirfd(level), column_entry->d_name, O_RDONLY | O_DIRECTORY);
+        DIR* column = column_fd < 0 ? NULL : fdopendir(column_fd);
+        if (column == NULL) {fprintf(stderr, "Error: Unable to read %s/%s\n", level_name, column_entry->d_name); exit(EXIT_FAILURE);}
+        struct dirent* tile_entry;
+        while ((tile_entry = readdir(column))) {
+            uint64_t y = parse_index(tile_entry->d_name, suffix, z);
+            if (y == UINT64_MAX) continue; // not a tile
+            char source_name[sizeof(level_name) + 24 + sizeof(tile_entry->d_name)], tile_name[64];
+            snprintf(source_name, sizeof(source_name), "%s/%" PRIu64 "/%s", level_name, x, tile_entry->d_name);
+            level_path(tile_name, x, y);
+            if (linkat(column_fd, tile_entry->d_name, level_dirs[z], tile_name, 0)) {
+                char destination[256 + 64];
+                snprintf(destination, sizeof(destination), "%s/%u/%s", dirname, z, tile_name);
+                if ((errno != EXDEV && errno != EPERM) || copy_file(source_name, destination)) {
+                    if (errno == EEXIST) fprintf(stderr, "Error: Tile %u/%" PRIu64 "/%" PRIu64 " is in more than one shard\n", z, x, y);
+                    else fprintf(stderr, "Error: Unable to merge %s\n", source_name);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            uint64_t id = tile_id(z, x, y);
+            journal_append(&id, 1);
+            merged++;
+        }
+        closedir(column);
+    }
+    closedir(level);
+    return merged;
+}
+
+
+static void merge_directories(char** inputs, unsigned int num_inputs) {
+    /* combine the directories written by each shard into one pyramid in dirname, with a single params.js and a
+    journal so a missing part can be rendered by resuming. Tiles are hardlinked into place, or copied when an
+    input is on another filesystem, so tiles deduplicated within a shard stay shared. A tile found in two
+    inputs means the shards overlap. The pyramid takes the tile format of its inputs */
+    for (unsigned int i = 0; i < num_inputs; i++) {
+        unsigned int zoom, image_size;
+        int format;
+        if (read_params(inputs[i], &zoom, &image_size, &format)) {fprintf(stderr, "Error: %s has no params.js, is it a finished shard?\n", inputs[i]); exit(EXIT_FAILURE);}
+        if (image_size != IMAGE_SIZE) {fprintf(stderr, "Error: %s has %upx tiles, not %dpx\n", inputs[i], image_size, IMAGE_SIZE); exit(EXIT_FAILURE);}
+        if (zoom > ID_MAX_DEPTH) {fprintf(stderr, "Error: Merging is only supported up to zoom level %d\n", ID_MAX_DEPTH); exit(EXIT_FAILURE);}
+        if (i > 0 && zoom != max_zoom) {fprintf(stderr, "Error: %s goes to level %u but %s goes to level %u\n", inputs[i], zoom, inputs[0], max_zoom); exit(EXIT_FAILURE);}
+        if (i > 0 && format != tile_format) {fprintf(stderr, "Error: %s has %s tiles but %s has %s tiles\n", inputs[i], tile_format_extension(format), inputs[0], tile_format_extension(tile_format)); exit(EXIT_FAILURE);}
+        if (same_file(inputs[i], dirname)) {fprintf(stderr, "Error: Cannot merge %s into itself\n", dirname); exit(EXIT_FAILURE);}
+        max_zoom = zoom;
+        tile_format = format;
+    }
+    init_dir();
+    open_journal();
+    if (tile_format == TILE_RAW) open_iterations();
+
+    uint64_t merged = 0;
+    for (unsigned int i = 0; i < num_inputs; i++) {
+        if (iterations_fd >= 0) { // the budgets of raw tiles carry over, so a resume deepens only what needs it
+            char iterations_name[256 + sizeof(ITERATIONS_NAME)];
+            snprintf(iterations_name, sizeof(iterations_name), "%s/%s", inputs[i], ITERATIONS_NAME);
+            int in = open(iterations_name, O_RDONLY);
+            struct iteration_record records[512];
+            ssize_t bytes;
+            while (in >= 0 && (bytes = read(in, records, sizeof(records))) >= (ssize_t)sizeof(struct iteration_record)) {
+                size_t length = bytes - bytes % sizeof(struct iteration_record);
+                if (write(iterations_fd, records, length) != length) {fprintf(stderr, "Error: Unable to write to %s/%s\n", dirname, ITERATIONS_NAME); exit(EXIT_FAILURE);}
+            }
+            if (in >= 0) close(in);
+        }
+        for (unsigned int z = 0; z <= max_zoom; z++) merged += merge_level(inputs[i], z);
+    }
+    journal_flush();
+    close(journal_fd);
+    if (iterations_fd >= 0) close(iterations_fd);
+    close_dir();
+    if (write_params()) exit(EXIT_FAILURE);
+    printf("Merged %" PRIu64 " tiles from %u shards into %s\n", merged, num_inputs, dirname);
+    if (merged < level_offset(max_zoom+1)) {
+        printf("Warning: %" PRIu64 " tiles are missing, resume with -r to render them\n", level_offset(max_zoom+1) - merged);
+    }
+}
+
+
+struct merge_entry {
+    uint64_t id;
+    uint64_t offset;
+    uint32_t length;
+    unsigned int input;
+};
+
+
+static int compare_merge_id(const void* a, const void* b) {
+    /* qsort comparison of merge entries by tile id */
+    const struct merge_entry* x = a;
+    const struct merge_entry* y = b;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+
+static int compare_merge_offset(const void* a, const void* b) {
+    /* qsort comparison of merge entries by where their data lies, so entries sharing data are adjacent */
+    const struct merge_entry* x = a;
+    const struct merge_entry* y = b;
+    if (x->input != y->input) return (x->input > y->input) - (x->input < y->input);
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+
+static void merge_archives(char** inputs, unsigned int num_inputs) {
+    /* combine the archives written by each shard into archive_name. Entries of one input that share data
+    are linked in the output too, so each tile is copied once */
+    struct tile_archive* sources[num_inputs];
+    uint64_t num_entries = 0;
+    for (unsigned int i = 0; i < num_inputs; i++) {
+        if (same_file(inputs[i], archive_name)) {fprintf(stderr, "Error: Cannot merge %s into itself\n", archive_name); exit(EXIT_FAILURE);}
+        sources[i] = tile_archive_open(inputs[i]);
+        if (sources[i] == NULL) {fprintf(stderr, "Error: Unable to open archive %s\n", inputs[i]); exit(EXIT_FAILURE);}
+        struct tile_archive_header* header = sources[i]->header;
+        if (header->image_size != IMAGE_SIZE) {fprintf(stderr, "Error: %s has %upx tiles, not %dpx\n", inputs[i], header->image_size, IMAGE_SIZE); exit(EXIT_FAILURE);}
+        if (i > 0 && header->max_zoom != max_zoom) {fprintf(stderr, "Error: %s goes to level %u but %s goes to level %u\n", inputs[i], header->max_zoom, inputs[0], max_zoom); exit(EXIT_FAILURE);}
+        max_zoom = header->max_zoom;
+        num_entries += header->index_capacity;
+    }
+    struct merge_entry* entries = malloc((num_entries ? num_entries : 1) * sizeof(struct merge_entry));
+    if (entries == NULL) {fprintf(stderr, "Error: Unable to allocate the merge index\n"); exit(EXIT_FAILURE);}
+    num_entries = 0;
+    for (unsigned int i = 0; i < num_inputs; i++) {
+        for (uint64_t slot = 0; slot < sources[i]->header->index_capacity; slot++) {
+            struct tile_archive_entry* entry = &sources[i]->index[slot];
+            uint64_t id = atomic_load(&entry->id);
+            uint32_t length = atomic_load(&entry->length);
+            if (id == TILE_ARCHIVE_EMPTY || length == 0) continue; // unused, or never finished
+            if (entry->offset + length > sources[i]->map_length) {fprintf(stderr, "Error: %s is truncated\n", inputs[i]); exit(EXIT_FAILURE);}
+            entries[num_entries++] = (struct merge_entry){.id = id, .offset = entry->offset, .length = length, .input = i};
+        }
+    }
+    qsort(entries, num_entries, sizeof(struct merge_entry), compare_merge_id);
+    for (uint64_t e = 1; e < num_entries; e++) {
+        if (entries[e].id == entries[e-1].id) {
+            unsigned int z;
+            uint64_t x, y;
+            tile_from_id(entries[e].id, &z, &x, &y);
+            fprintf(stderr, "Error: Tile %u/%" PRIu64 "/%" PRIu64 " is in more than one shard\n", z, x, y);
+            exit(EXIT_FAILURE);
+        }
+    }
+    qsort(entries, num_entries, sizeof(struct merge_entry), compare_merge_offset);
+
+    archive = tile_archive_create(archive_name, IMAGE_SIZE, max_zoom, num_entries);
+    if (archive == NULL) {fprintf(stderr, "Error: Unable to create archive %s\n", archive_name); exit(EXIT_FAILURE);}
+    uint64_t shared = 0;
+    for (uint64_t e = 0; e < num_entries; e++) {
+        struct merge_entry* entry = &entries[e];
+        int code;
+        if (e > 0 && entry->input == entry[-1].input && entry->offset == entry[-1].offset) {
+            code = tile_archive_link(archive, entry->id, entry[-1].id);
+            shared++;
+        } else {
+            code = tile_archive_append(archive, entry->id, sources[entry->input]->map + entry->offset, entry->length);
+        }
+        if (code) {fprintf(stderr, "Error: Unable to write archive %s\n", archive_name); exit(EXIT_FAILURE);}
+    }
+    if (tile_archive_close(archive)) {fprintf(stderr, "Error: Unable to finish archive %s\n", archive_name); exit(EXIT_FAILURE);}
+    for (unsigned int i = 0; i < num_inputs; i++) {
+        tile_archive_close(sources[i]);
+    }
+    free(entries);
+    printf("Merged %" PRIu64 " tiles (%" PRIu64 " shared) from %u shards into %s\n", num_entries, shared, num_inputs, archive_name);
+    if (num_entries < level_offset(max_zoom+1)) {
+        printf("Warning: %" PRIu64 " tiles are missing from the archive\n", level_offset(max_zoom+1) - num_entries);
+    }
+}
+
+
+static void usage(char* name) {
+    /* print the command line options and exit */
+    fprintf(stderr, "Usage: %s [options] <zoom-levels> <max-threads>\n", name);
+    fprintf(stderr, "       %s --merge [options] <shard>...\n", name);
+    fprintf(stderr, "  -r, --resume    keep existing tiles and skip those recorded in %s/%s.\n", dirname, JOURNAL_NAME);
+    fprintf(stderr, "                  A larger zoom level extends an existing pyramid\n");
+    fprintf(stderr, "  -a, --archive <file>\n");
+    fprintf(stderr, "                  write every tile into a single archive file instead of %s/\n", dirname);
+    fprintf(stderr, "  -s, --subdivide render by Mariani-Silver subdivision, skipping the quadtree below tiles\n");
+    fprintf(stderr, "                  proven to be inside the set\n");
+    fprintf(stderr, "  -A, --antialias <samples>\n");
+    fprintf(stderr, "                  anti-alias the edges of the set, taking up to %d more samples in each pixel that\n", ANTIALIAS_MAX_SAMPLES);
+    fprintf(stderr, "                  differs sharply from a neighbour (%d is a good start)\n", ANTIALIAS_DEFAULT_SAMPLES);
+    fprintf(stderr, "  -i, --interval <s>\n");
+    fprintf(stderr, "                  seconds between progress reports, 0 to disable them (default 5)\n");
+    fprintf(stderr, "  -p, --profile <file>\n");
+    fprintf(stderr, "                  write a JSON profile of the run here (default %s/%s, or next to the archive)\n", dirname, PROFILE_NAME);
+    fprintf(stderr, "  -l, --level <0-9>\n");
+    fprintf(stderr, "                  zlib compression level (default %d)\n", ENCODER_DEFAULT_LEVEL);
+    fprintf(stderr, "  -S, --strategy <name>\n");
+    fprintf(stderr, "                  zlib strategy: default, filtered, huffman, rle or fixed (default filtered)\n");
+    fprintf(stderr, "  -f, --filter <name>\n");
+    fprintf(stderr, "                  PNG row filter: none, sub, up, average, paeth, or all to choose per row (default all)\n");
+    fprintf(stderr, "  -d, --dir <dir>\n");
+    fprintf(stderr, "                  write tiles under this directory (default %s, or map-<i>-of-<n> for a shard)\n", dirname);
+    fprintf(stderr, "  -n, --shard <i>/<n>\n");
+    fprintf(stderr, "                  render only shard i of n, a share of the pyramid of about equal cost. Every\n");
+    fprintf(stderr, "                  process or machine given the same zoom level and options computes the same split\n");
+    fprintf(stderr, "  -m, --merge     combine finished shards, directories or with -a archives, into one pyramid\n");
+    fprintf(stderr, "  -c, --centre <re>,<im>\n");
+    fprintf(stderr, "                  render only a corridor of tiles around this point on each level, so that deep\n");
+    fprintf(stderr, "                  levels cost the same as shallow ones\n");
+    fprintf(stderr, "  -b, --box <min-re>,<min-im>,<max-re>,<max-im>\n");
+    fprintf(stderr, "                  render only the tiles covering this box, or a corridor around it once it is small\n");
+    fprintf(stderr, "  -w, --window <tiles>\n");
+    fprintf(stderr, "                  tiles across the corridor on each level (default %d)\n", REGION_WINDOW);
+    fprintf(stderr, "  -u, --downsample <filter>\n");
+    fprintf(stderr, "                  render only the deepest level and build each level above from the one below:\n");
+    fprintf(stderr, "                  box to average each 2x2 block, anti-aliasing, or min to keep its darkest pixel\n");
+    fprintf(stderr, "  -z, --from <zoom>\n");
+    fprintf(stderr, "                  shallowest level to render (default 0)\n");
+    fprintf(stderr, "  -F, --format <name>\n");
+    fprintf(stderr, "                  tile format: png, coloured when rendered, or raw, smooth 16-bit iteration counts\n");
+    fprintf(stderr, "                  coloured by mandelbrot-clientside.html (default png). A merge keeps its shards' format\n");
+    fprintf(stderr, "  -W, --writers <n>\n");
+    fprintf(stderr, "                  threads writing tiles from a queue filled by the workers, so rendering never waits\n");
+    fprintf(stderr, "                  on slow storage until the queue is full, or 0 for workers to write their own (default one per thread)\n");
+    fprintf(stderr, "  -I, --iterations <n>\n");
+    fprintf(stderr, "                  iteration budget of raw tiles, up to %d (default %d). With -r, complete tiles that\n", RAW_MAX_ITERATIONS, MAX_ITERATIONS);
+    fprintf(stderr, "                  had points still bounded at a smaller budget are deepened, iterating only those points\n");
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"resume", no_argument, NULL, 'r'},
+        {"archive", required_argument, NULL, 'a'},
+        {"subdivide", no_argument, NULL, 's'},
+        {"antialias", required_argument, NULL, 'A'},
+        {"interval", required_argument, NULL, 'i'},
+        {"profile", required_argument, NULL, 'p'},
+        {"level", required_argument, NULL, 'l'},
+        {"strategy", required_argument, NULL, 'S'},
+        {"filter", required_argument, NULL, 'f'},
+        {"dir", required_argument, NULL, 'd'},
+        {"shard", required_argument, NULL, 'n'},
+        {"merge", no_argument, NULL, 'm'},
+        {"centre", required_argument, NULL, 'c'},
+        {"box", required_argument, NULL, 'b'},
+        {"window", required_argument, NULL, 'w'},
+        {"from", required_argument, NULL, 'z'},
+        {"writers", required_argument, NULL, 'W'},
+        {"downsample", required_argument, NULL, 'u'},
+        {"format", required_argument, NULL, 'F'},
+        {"iterations", required_argument, NULL, 'I'},
+        {NULL, 0, NULL, 0}
+    };
+    tile_encoder_init(&encoder_options);
+    int option;
+    int dir_given = 0;
+    char extra;
+    while ((option = getopt_long(argc, argv, "ra:sA:i:p:l:S:f:d:n:mc:b:w:z:u:F:W:I:", long_options, NULL)) != -1) {
+        switch (option) {
+        case 'r':
+            resume = 1;
+            break;
+        case 'a':
+            archive_name = optarg;
+            break;
+        case 's':
+            use_subdivision = 1;
+            break;
+        case 'A':
+            antialias_samples = atoi(optarg);
+            if (antialias_samples < 1 || antialias_samples > ANTIALIAS_MAX_SAMPLES) usage(argv[0]);
+            break;
+        case 'i':
+            report_interval = atof(optarg);
+            break;
+        case 'p':
+            profile_name = optarg;
+            break;
+        case 'l':
+            encoder_options.level = atoi(optarg);
+            if (encoder_options.level < 0 || encoder_options.level > 9) usage(argv[0]);
+            break;
+        case 'S':
+            strategy_name = optarg;
+            encoder_options.strategy = encoder_strategy_from_name(optarg);
+            if (encoder_options.strategy < 0) usage(argv[0]);
+            break;
+        case 'f':
+            filters_name = optarg;
+            encoder_options.filters = encoder_filters_from_name(optarg);
+            if (encoder_options.filters < 0) usage(argv[0]);
+            break;
+        case 'd':
+            dirname = optarg;
+            dir_given = 1;
+            break;
+        case 'n':
+            if (sscanf(optarg, "%u/%u%c", &shard.id, &shard.count, &extra) != 2 || shard.id >= shard.count) usage(argv[0]);
+            break;
+        case 'm':
+            merging = 1;
+            break;
+        case 'c':
+            region.enabled = 1;
+            if (sscanf(optarg, "%Lf,%Lf%c", &region.min_r, &region.min_i, &extra) != 2) usage(argv[0]);
+            region.max_r = region.min_r;
+            region.max_i = region.min_i;
+            break;
+        case 'b':
+            region.enabled = 1;
+            if (sscanf(optarg, "%Lf,%Lf,%Lf,%Lf%c", &region.min_r, &region.min_i, &region.max_r, &region.max_i, &extra) != 4
+                || region.min_r > region.max_r || region.min_i > region.max_i) usage(argv[0]);
+            break;
+        case 'w':
+            region.window = atoi(optarg);
+            if (region.window < 1) usage(argv[0]);
+            break;
+        case 'z':
+            plan.min_zoom = atoi(optarg);
+            break;
+        case 'u':
+            downsample_name = optarg;
+            downsample_filter = downsample_filter_from_name(optarg);
+            if (downsample_filter < 0) usage(argv[0]);
+            break;
+        case 'F':
+            tile_format = tile_format_from_name(optarg);
+            if (tile_format < 0) usage(argv[0]);
+            break;
+        case 'W':
+            if (sscanf(optarg, "%u%c", &num_writers, &extra) != 1 || num_writers > 64) usage(argv[0]);
+            break;
+        case 'I':
+            if (sscanf(optarg, "%u%c", &raw_iterations, &extra) != 1 || raw_iterations < 1 || raw_iterations > RAW_MAX_ITERATIONS) usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (merging) {
+        if (argc == optind || resume || shard.count > 1) usage(argv[0]);
+        if (archive_name) merge_archives(argv + optind, argc - optind);
+        else merge_directories(argv + optind, argc - optind);
+        return EXIT_SUCCESS;
+    }
+    if (argc - optind != 2) usage(argv[0]);
+    max_zoom = atoi(argv[optind]);
+    if (max_zoom > MAX_DEPTH) {fprintf(stderr, "Error: Zoom level must be at most %d\n", MAX_DEPTH); exit(EXIT_FAILURE);}
+    if (resume && max_zoom > ID_MAX_DEPTH) {fprintf(stderr, "Error: Resuming is only supported up to zoom level %d\n", ID_MAX_DEPTH); exit(EXIT_FAILURE);}
+    if (archive_name && resume) {fprintf(stderr, "Error: An archive cannot be resumed\n"); exit(EXIT_FAILURE);}
+    if (archive_name && max_zoom > ID_MAX_DEPTH) {fprintf(stderr, "Error: Archives are only supported up to zoom level %d\n", ID_MAX_DEPTH); exit(EXIT_FAILURE);}
+    if (plan.min_zoom > max_zoom) {fprintf(stderr, "Error: The shallowest level must be at most the zoom level\n"); exit(EXIT_FAILURE);}
+    if (region.enabled && shard.count > 1) {fprintf(stderr, "Error: A region cannot be sharded\n"); exit(EXIT_FAILURE);}
+    if (!region.enabled && max_zoom > PYRAMID_MAX_DEPTH) {
+        fprintf(stderr, "Error: Zoom levels beyond %d need a region to render, given by -c or -b\n", PYRAMID_MAX_DEPTH);
+        exit(EXIT_FAILURE);
+    }
+    if (tile_format == TILE_RAW && (use_subdivision || antialias_samples || downsample_filter >= 0)) {
+        fprintf(stderr, "Error: Raw tiles are rendered point by point, without subdivision, anti-aliasing or downsampling\n");
+        exit(EXIT_FAILURE);
+    }
+    if (tile_format != TILE_RAW && raw_iterations != MAX_ITERATIONS) {
+        fprintf(stderr, "Error: Only raw tiles can hold counts beyond the %d levels of a PNG tile\n", MAX_ITERATIONS);
+        exit(EXIT_FAILURE);
+    }
+    unsigned int num_threads = atoi(argv[optind+1]);
+    if (num_writers == UINT_MAX) num_writers = num_threads; // storage that stalls one writer usually serves several at once
+    char shard_dirname[64];
+    if (shard.count > 1 && !dir_given) {
+        sprintf(shard_dirname, "map-%u-of-%u", shard.id, shard.count);
+        dirname = shard_dirname;
+    }
+    plan_shard();
+    plan_tiles();
+    char default_profile[256 + sizeof(PROFILE_NAME)];
+    if (profile_name == NULL) {
+        if (archive_name) snprintf(default_profile, sizeof(default_profile), "%s.%s", archive_name, PROFILE_NAME);
+        else snprintf(default_profile, sizeof(default_profile), "%s/%s", dirname, PROFILE_NAME);
+        profile_name = default_profile;
+    }
+    if (archive_name) {
+        archive = tile_archive_create(archive_name, IMAGE_SIZE, max_zoom, plan.num_tiles);
+        if (archive == NULL) {fprintf(stderr, "Error: Unable to create archive %s\n", archive_name); exit(EXIT_FAILURE);}
+    } else {
+        init_dir();
+        open_journal();
+        if (tile_format == TILE_RAW) open_iterations();
+    }
+    init_kernel();
+    dedup_table = calloc(1ULL << DEDUP_TABLE_BITS, sizeof(struct dedup_entry));
+    if (dedup_table == NULL) {fprintf(stderr, "Error: Unable to allocate deduplication table\n"); exit(EXIT_FAILURE);}
+    if (use_subdivision && downsample_filter < 0) {
+        // tiles whose parent is solid are copies of one pre-encoded all-black tile. Parents come after their
+        // children when downsampling, so subdivision then only saves work within each tile
+        solid_tiles = calloc((plan.num_tiles + 63) / 64, sizeof(*solid_tiles));
+        png_byte (*black)[IMAGE_SIZE] = calloc(IMAGE_SIZE, IMAGE_SIZE);
+        struct tile_encoder encoder = encoder_options;
+        if (solid_tiles == NULL || black == NULL || encode_tile(&encoder, tile_sink_buffer(&solid_tile), black)) {
+            fprintf(stderr, "Error: Unable to prepare subdivision\n");
+            exit(EXIT_FAILURE);
+        }
+        digest_tile(black, &solid_digest);
+        tile_encoder_free(&encoder);
+        free(black);
+    }
+    printf("Generating tile maps with zoom level %d using %d threads. Target resolution: %.0fx%.0f pixels\n", max_zoom, num_threads, IMAGE_SIZE * pow(2, max_zoom), IMAGE_SIZE * pow(2, max_zoom));
+    printf("Using %s kernel up to level %d, perturbation beyond\n", row_kernel_name, DOUBLE_MAX_DEPTH);
+    if (downsample_filter >= 0) {
+        printf("Rendering level %d and downsampling the levels above with the %s filter\n", max_zoom, downsample_name);
+    }
+    if (region.enabled) {
+        printf("Rendering a corridor of %" PRIu64 " tiles from level %u, %u tiles across, around %.21Lg%+.21Lgi\n", plan.num_tiles, plan.min_zoom,
+            region.window, (region.min_r + region.max_r) / 2, (region.min_i + region.max_i) / 2);
+    }
+    if (shard.count > 1) {
+        printf("Rendering shard %u of %u: %" PRIu64 " tiles, subtrees %" PRIu64 "-%" PRIu64 " of the %" PRIu64 " on level %u\n", shard.id, shard.count,
+            plan.num_tiles, shard.first_root, shard.end_root, (uint64_t)1 << (2 * shard.split_zoom), shard.split_zoom);
+    }
+    worker_dispatch(num_threads);
+    if (archive) {
+        if (tile_archive_close(archive)) {
+            fprintf(stderr, "Error: Unable to finish archive %s\n", archive_name);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    journal_flush();
+    if (write_params()) return EXIT_FAILURE;
+    close(journal_fd);
+    if (iterations_fd >= 0) close(iterations_fd);
+    close_dir();
+    free(completed_tiles);
+    free(deepen_tiles);
+    free(solid_tiles);
+    free(solid_tile.data);
+    free(dedup_table);
     return EXIT_SUCCESS;
 }
\ No newline at end of file
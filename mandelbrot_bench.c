@@ -0,0 +1,437 @@
+/* Source file for mandelbrot_bench.c, a benchmark of the renderer at five levels: the pixel kernels on fixed
+    sets of points, single tiles split into computing and encoding, whole pyramids generated by the mandelbrot
+    binary across thread counts, the julia_explore kernel drawn headlessly, and 1080p zoom animations rendered
+    by mandelbrot-zoom. Every measurement is printed as one JSON object per line so runs can be compared
+    against each other
+    Author: Max Croucher
+    Email: mpccroucher@gmail.com
+    July 2025
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include "tile_render.h"
+#include "julia_render.h"
+
+#define SET_SIZE 256 // each point set is a SET_SIZE x SET_SIZE grid
+#define JULIA_SIZE 800 // julia_explore draws an 800x800 texture
+#define PYRAMID_DIR_TEMPLATE "/tmp/mandelbrot-bench-XXXXXX"
+#define ZOOM_WIDTH 1920
+#define ZOOM_HEIGHT 1080
+#define ZOOM_FRAMES 120 // the first two keyframe intervals of the default animation
+
+enum bench_level {
+    BENCH_KERNEL = 1,
+    BENCH_TILE = 2,
+    BENCH_PYRAMID = 4,
+    BENCH_JULIA = 8,
+    BENCH_ZOOM = 16
+};
+
+struct point_set {
+    const char* name;
+    double centre_r;
+    double centre_i;
+    double width;
+}; // a square grid of points around a centre
+
+struct bench_tile {
+    const char* name;
+    unsigned int z;
+    double c_r;
+    double c_i;
+}; // the tile of level z containing c
+
+struct encoder_preset {
+    const char* name;
+    int level;
+    const char* strategy;
+    const char* filters;
+}; // compression settings the encode stage is timed with
+
+static const struct point_set point_sets[] = {
+    {"interior", -0.1225, 0.7449, 0.05}, // the period-3 bulb, beyond the closed-form tests, so caught by periodicity
+    {"boundary", -0.7436, 0.1318, 0.01}, // seahorse valley, where escape times vary most
+    {"exterior", 1.0, 1.0, 1.0}, // escapes within a few iterations
+};
+
+static const struct bench_tile bench_tiles[] = {
+    {"overview", 0, -0.5, 0.0},
+    {"seahorse", 8, -0.743643887037151, 0.131825904205330},
+    {"deep", 40, -0.743643887037151, 0.131825904205330}, // beyond DOUBLE_MAX_DEPTH, so rendered by perturbation
+};
+
+static const struct encoder_preset encoder_presets[] = {
+    {"default", ENCODER_DEFAULT_LEVEL, "filtered", "all"}, // libpng's own choice
+    {"fast", 1, "filtered", "sub"},
+    {"rle", 1, "rle", "up"},
+};
+
+double min_seconds = 1;
+
+
+static double now(void) {
+    /* monotonic time in seconds */
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+
+static uint64_t kernel_iterations(const png_byte* values, uint64_t n, const struct kernel_stats* stats) {
+    /* iterations performed to produce n kernel results. A pixel that escaped at iteration i holds 0xFF - i, and
+    every pixel holding 0 ran to MAX_ITERATIONS unless a shortcut stopped it, as counted in iterations_saved */
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < n; i++) total += values[i] ? 0x100 - values[i] : MAX_ITERATIONS;
+    return total - stats->iterations_saved;
+}
+
+
+static void bench_kernels(void) {
+    /* run mandelbrot_point and the selected row kernel over each point set */
+    png_byte* values = malloc(SET_SIZE * SET_SIZE);
+    for (unsigned int s = 0; s < sizeof(point_sets) / sizeof(point_sets[0]); s++) {
+        const struct point_set* set = &point_sets[s];
+        double step = set->width / SET_SIZE;
+        double start_r = set->centre_r - set->width / 2;
+        double start_i = set->centre_i - set->width / 2;
+        for (int vector = 0; vector < 2; vector++) {
+            uint64_t passes = 0;
+            struct kernel_stats stats = {0};
+            double start = now();
+            double elapsed;
+            do {
+                stats = (struct kernel_stats){0};
+                for (unsigned int y = 0; y < SET_SIZE; y++) {
+                    png_byte* row = values + y * SET_SIZE;
+                    if (vector) {
+                        row_kernel(row, start_r, start_i + step * y, step, 0, SET_SIZE, &stats);
+                    } else {
+                        for (unsigned int x = 0; x < SET_SIZE; x++) {
+                            row[x] = mandelbrot_point(start_r + step * x, start_i + step * y, step * PERIODICITY_EPSILON, &stats);
+                        }
+                    }
+                }
+                passes++;
+                elapsed = now() - start;
+            } while (elapsed < min_seconds);
+            uint64_t pixels = passes * SET_SIZE * SET_SIZE;
+            uint64_t iterations = passes * kernel_iterations(values, SET_SIZE * SET_SIZE, &stats);
+            printf("{\"bench\": \"kernel\", \"set\": \"%s\", \"kernel\": \"%s\", \"pixels\": %" PRIu64 ", \"seconds\": %.6f, "
+                "\"pixels_per_s\": %.0f, \"iterations_per_s\": %.0f}\n",
+                set->name, vector ? row_kernel_name : "point", pixels, elapsed, pixels / elapsed, iterations / elapsed);
+            fflush(stdout);
+        }
+    }
+    free(values);
+}
+
+
+static void bench_single_tiles(void) {
+    /* render and encode each benchmark tile, plainly, by subdivision and anti-aliased, timing the two stages separately */
+    static const struct {const char* name; int use_subdivision; unsigned int samples;} modes[] = {
+        {"plain", 0, 0},
+        {"subdivide", 1, 0},
+        {"antialias", 1, ANTIALIAS_DEFAULT_SAMPLES},
+    };
+    png_byte (*pixels)[IMAGE_SIZE] = malloc(IMAGE_SIZE * IMAGE_SIZE);
+    struct png_buffer buffer = {0};
+    struct tile_encoder encoder;
+    tile_encoder_init(&encoder);
+    for (unsigned int t = 0; t < sizeof(bench_tiles) / sizeof(bench_tiles[0]); t++) {
+        const struct bench_tile* tile = &bench_tiles[t];
+        double scale = ldexp(1, tile->z);
+        uint64_t x = (tile->c_r - MIN_X) / BASE_RANGE_X * scale;
+        uint64_t y = (tile->c_i - MIN_Y) / BASE_RANGE_Y * scale;
+        for (unsigned int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            uint64_t tiles = 0;
+            struct kernel_stats stats = {0};
+            double start = now();
+            double elapsed;
+            do {
+                stats = (struct kernel_stats){0};
+                render_tile(pixels, tile->z, x, y, modes[m].use_subdivision, modes[m].samples, NULL, &stats);
+                tiles++;
+                elapsed = now() - start;
+            } while (elapsed < min_seconds);
+            uint64_t pixels_rendered = tiles * IMAGE_SIZE * IMAGE_SIZE;
+            printf("{\"bench\": \"tile\", \"tile\": \"%s\", \"z\": %u, \"x\": %" PRIu64 ", \"y\": %" PRIu64 ", \"mode\": \"%s\", "
+                "\"stage\": \"compute\", \"tiles\": %" PRIu64 ", \"seconds\": %.6f, \"tiles_per_s\": %.2f, \"pixels_per_s\": %.0f, ",
+                tile->name, tile->z, x, y, modes[m].name, tiles, elapsed, tiles / elapsed, pixels_rendered / elapsed);
+            if (modes[m].use_subdivision) { // pixels filled by subdivision ran no iterations of their own, so no count is kept
+                printf("\"iterations_per_s\": null}\n");
+            } else {
+                printf("\"iterations_per_s\": %.0f}\n", tiles * kernel_iterations(&pixels[0][0], IMAGE_SIZE * IMAGE_SIZE, &stats) / elapsed);
+            }
+
+            for (unsigned int p = 0; p < sizeof(encoder_presets) / sizeof(encoder_presets[0]); p++) {
+                const struct encoder_preset* preset = &encoder_presets[p];
+                encoder.level = preset->level;
+                encoder.strategy = encoder_strategy_from_name(preset->strategy);
+                encoder.filters = encoder_filters_from_name(preset->filters);
+                tiles = 0;
+                start = now();
+                do {
+                    buffer.length = 0;
+                    if (encode_tile(&encoder, tile_sink_buffer(&buffer), pixels)) exit(EXIT_FAILURE);
+                    tiles++;
+                    elapsed = now() - start;
+                } while (elapsed < min_seconds);
+                printf("{\"bench\": \"tile\", \"tile\": \"%s\", \"z\": %u, \"x\": %" PRIu64 ", \"y\": %" PRIu64 ", \"mode\": \"%s\", "
+                    "\"stage\": \"encode\", \"encoder\": \"%s\", \"tiles\": %" PRIu64 ", \"seconds\": %.6f, \"tiles_per_s\": %.2f, "
+                    "\"pixels_per_s\": %.0f, \"bytes\": %zu}\n",
+                    tile->name, tile->z, x, y, modes[m].name, preset->name, tiles, elapsed, tiles / elapsed,
+                    tiles * IMAGE_SIZE * IMAGE_SIZE / elapsed, buffer.length);
+                fflush(stdout);
+            }
+        }
+    }
+    tile_encoder_free(&encoder);
+    free(buffer.data);
+    free(pixels);
+}
+
+
+static double run_generator(const char* generator, const char* directory, unsigned int levels, unsigned int threads) {
+    /* run the generator inside directory with its output discarded. Returns the wall time taken, or -1 if it failed */
+    char levels_arg[16], threads_arg[16];
+    sprintf(levels_arg, "%u", levels);
+    sprintf(threads_arg, "%u", threads);
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (chdir(directory) || null_fd < 0) _exit(EXIT_FAILURE);
+        dup2(null_fd, STDOUT_FILENO);
+        execl(generator, generator, levels_arg, threads_arg, (char*)NULL);
+        _exit(EXIT_FAILURE);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) return -1;
+    return now() - start;
+}
+
+
+static int bench_pyramid(const char* generator, unsigned int levels, unsigned int max_threads) {
+    /* generate a pyramid with 1, 2, 4... threads up to max_threads, reporting speedup and scaling efficiency
+    against the single-threaded run */
+    char resolved[PATH_MAX];
+    if (realpath(generator, resolved) == NULL) {
+        fprintf(stderr, "Error: Unable to find generator %s\n", generator);
+        return -1;
+    }
+    char directory[] = PYRAMID_DIR_TEMPLATE;
+    if (mkdtemp(directory) == NULL) {
+        fprintf(stderr, "Error: Unable to create a scratch directory\n");
+        return -1;
+    }
+    uint64_t num_tiles = ((UINT64_C(1) << (2 * (levels + 1))) - 1) / 3;
+    double single = 0;
+    int result = 0;
+    for (unsigned int threads = 1; ; threads *= 2) {
+        if (threads > max_threads) threads = max_threads;
+        double elapsed = run_generator(resolved, directory, levels, threads);
+        if (elapsed < 0) {
+            fprintf(stderr, "Error: Generator failed with %u threads\n", threads);
+            result = -1;
+            break;
+        }
+        if (threads == 1) single = elapsed;
+        printf("{\"bench\": \"pyramid\", \"levels\": %u, \"tiles\": %" PRIu64 ", \"threads\": %u, \"seconds\": %.6f, "
+            "\"tiles_per_s\": %.2f, \"speedup\": %.3f, \"efficiency\": %.3f}\n",
+            levels, num_tiles, threads, elapsed, num_tiles / elapsed, single / elapsed, single / elapsed / threads);
+        fflush(stdout);
+        if (threads == max_threads) break;
+    }
+    char command[sizeof(directory) + 16];
+    sprintf(command, "rm -rf %s", directory);
+    if (system(command)) fprintf(stderr, "Unable to remove %s\n", directory);
+    return result;
+}
+
+
+static int bench_zoom(const char* zoomer, unsigned int threads) {
+    /* render the start of the default zoom animation at 1080p with its frames discarded, reusing pixels between
+    frames and then computing every frame in full */
+    static const struct {const char* name; const char* keyframe;} modes[] = {
+        {"reuse", "60"},
+        {"exact", "1"},
+    };
+    char width_arg[16], height_arg[16], frames_arg[16], threads_arg[16];
+    sprintf(width_arg, "%d", ZOOM_WIDTH);
+    sprintf(height_arg, "%d", ZOOM_HEIGHT);
+    sprintf(frames_arg, "%d", ZOOM_FRAMES);
+    sprintf(threads_arg, "%u", threads);
+    for (unsigned int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        double start = now();
+        pid_t pid = fork();
+        if (pid < 0) return -1;
+        if (pid == 0) {
+            int null_fd = open("/dev/null", O_WRONLY);
+            if (null_fd < 0) _exit(EXIT_FAILURE);
+            dup2(null_fd, STDOUT_FILENO);
+            execl(zoomer, zoomer, "-W", width_arg, "-H", height_arg, "-n", frames_arg, "-k", modes[m].keyframe, "-t", threads_arg, (char*)NULL);
+            _exit(EXIT_FAILURE);
+        }
+        int status;
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            fprintf(stderr, "Error: Unable to run %s\n", zoomer);
+            return -1;
+        }
+        double elapsed = now() - start;
+        printf("{\"bench\": \"zoom\", \"width\": %d, \"height\": %d, \"mode\": \"%s\", \"threads\": %u, \"frames\": %d, \"seconds\": %.6f, "
+            "\"frames_per_s\": %.2f, \"pixels_per_s\": %.0f}\n", ZOOM_WIDTH, ZOOM_HEIGHT, modes[m].name, threads, ZOOM_FRAMES, elapsed,
+            ZOOM_FRAMES / elapsed, (double)ZOOM_FRAMES * ZOOM_WIDTH * ZOOM_HEIGHT / elapsed);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+
+static void bench_julia(void) {
+    /* draw the initial julia_explore view into an off-screen texture, on this thread and then progressively through
+    the render pool */
+    unsigned char (*texture)[JULIA_SIZE][3] = malloc(JULIA_SIZE * JULIA_SIZE * 3);
+    uint64_t frames = 0, iterations = 0;
+    double start = now();
+    double elapsed;
+    do {
+        draw_fractal(JULIA_SIZE, JULIA_SIZE, texture);
+        iterations += iterations_run;
+        frames++;
+        elapsed = now() - start;
+    } while (elapsed < min_seconds);
+    printf("{\"bench\": \"julia\", \"width\": %d, \"height\": %d, \"precision\": \"%s\", \"frames\": %" PRIu64 ", \"seconds\": %.6f, "
+        "\"frames_per_s\": %.2f, \"pixels_per_s\": %.0f, \"iterations_per_s\": %.0f}\n",
+        JULIA_SIZE, JULIA_SIZE, julia_precision_names[julia_precision_for(max_x - min_x, JULIA_SIZE)], frames, elapsed, frames / elapsed, (double)frames * JULIA_SIZE * JULIA_SIZE / elapsed, iterations / elapsed);
+    fflush(stdout);
+    free(texture);
+
+    // the same view through the progressive render pool, timing how long each level takes to appear
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct julia_pool* pool = julia_pool_create(JULIA_SIZE, JULIA_SIZE, num_threads);
+    if (pool == NULL) {
+        fprintf(stderr, "Error: Unable to start the julia render pool\n");
+        return;
+    }
+    struct julia_view view = {min_x, max_x, min_y, max_y, julia_seed_real, julia_seed_cplx, julia_max_iterations};
+    double level_seconds[JULIA_LEVELS] = {0};
+    frames = 0;
+    start = now();
+    do {
+        double frame_start = now();
+        julia_pool_render(pool, &view);
+        int best = -1;
+        while (best < JULIA_LEVELS - 1) {
+            unsigned int width, height;
+            const unsigned char* level_texture;
+            int level = julia_pool_best(pool, &width, &height, &level_texture, NULL);
+            for (int l = best + 1; l <= level; l++) level_seconds[l] += now() - frame_start;
+            if (level > best) best = level;
+            else usleep(100);
+        }
+        frames++;
+        elapsed = now() - start;
+    } while (elapsed < min_seconds);
+    julia_pool_destroy(pool);
+    printf("{\"bench\": \"julia_progressive\", \"width\": %d, \"height\": %d, \"threads\": %ld, \"frames\": %" PRIu64 ", \"seconds\": %.6f, "
+        "\"frames_per_s\": %.2f, \"level_seconds\": [", JULIA_SIZE, JULIA_SIZE, num_threads, frames, elapsed, frames / elapsed);
+    for (int l = 0; l < JULIA_LEVELS; l++) printf("%s%.6f", l ? ", " : "", level_seconds[l] / frames);
+    printf("]}\n");
+    fflush(stdout);
+}
+
+
+static unsigned int parse_levels(char* list) {
+    /* turn a comma separated list of benchmark levels into a mask of enum bench_level */
+    unsigned int mask = 0;
+    for (char* name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        if (!strcmp(name, "kernel")) mask |= BENCH_KERNEL;
+        else if (!strcmp(name, "tile")) mask |= BENCH_TILE;
+        else if (!strcmp(name, "pyramid")) mask |= BENCH_PYRAMID;
+        else if (!strcmp(name, "julia")) mask |= BENCH_JULIA;
+        else if (!strcmp(name, "zoom")) mask |= BENCH_ZOOM;
+        else return 0;
+    }
+    return mask;
+}
+
+
+static void usage(char* name) {
+    /* print the command line options and exit */
+    fprintf(stderr, "Usage: %s [options]\n", name);
+    fprintf(stderr, "  -b, --bench <list>       comma separated levels to run, from kernel,tile,pyramid,julia,zoom (default all)\n");
+    fprintf(stderr, "  -m, --min-time <s>       shortest time to repeat each kernel, tile and julia measurement (default 1)\n");
+    fprintf(stderr, "  -g, --generator <path>   mandelbrot binary used for the pyramid level (default ./mandelbrot)\n");
+    fprintf(stderr, "  -z, --zoom <levels>      zoom levels of the benchmark pyramid (default 6)\n");
+    fprintf(stderr, "  -Z, --zoomer <path>      mandelbrot-zoom binary used for the zoom level (default ./mandelbrot-zoom)\n");
+    fprintf(stderr, "  -t, --threads <n>        most threads the pyramid is generated with, and the zoom rendered with (default the number of CPUs)\n");
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"bench", required_argument, NULL, 'b'},
+        {"min-time", required_argument, NULL, 'm'},
+        {"generator", required_argument, NULL, 'g'},
+        {"zoom", required_argument, NULL, 'z'},
+        {"threads", required_argument, NULL, 't'},
+        {"zoomer", required_argument, NULL, 'Z'},
+        {NULL, 0, NULL, 0}
+    };
+    unsigned int selected = BENCH_KERNEL | BENCH_TILE | BENCH_PYRAMID | BENCH_JULIA | BENCH_ZOOM;
+    const char* generator = "./mandelbrot";
+    const char* zoomer = "./mandelbrot-zoom";
+    unsigned int pyramid_levels = 6;
+    long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int option;
+    while ((option = getopt_long(argc, argv, "b:m:g:z:t:Z:", long_options, NULL)) != -1) {
+        switch (option) {
+        case 'b':
+            selected = parse_levels(optarg);
+            if (selected == 0) usage(argv[0]);
+            break;
+        case 'm':
+            min_seconds = atof(optarg);
+            break;
+        case 'g':
+            generator = optarg;
+            break;
+        case 'z':
+            pyramid_levels = atoi(optarg);
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'Z':
+            zoomer = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc || max_threads < 1 || pyramid_levels > 12) usage(argv[0]);
+
+    init_kernel();
+    printf("{\"bench\": \"system\", \"kernel\": \"%s\", \"cpus\": %ld, \"image_size\": %d, \"max_iterations\": %d}\n",
+        row_kernel_name, sysconf(_SC_NPROCESSORS_ONLN), IMAGE_SIZE, MAX_ITERATIONS);
+    fflush(stdout);
+    if (selected & BENCH_KERNEL) bench_kernels();
+    if (selected & BENCH_TILE) bench_single_tiles();
+    if ((selected & BENCH_PYRAMID) && bench_pyramid(generator, pyramid_levels, max_threads)) return EXIT_FAILURE;
+    if (selected & BENCH_JULIA) bench_julia();
+    if ((selected & BENCH_ZOOM) && bench_zoom(zoomer, max_threads)) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
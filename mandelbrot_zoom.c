@@ -0,0 +1,453 @@
+/* Source file for mandelbrot_zoom.c, a renderer of zoom animations into the mandelbrot set. Frames follow an
+    exponential path towards a target point and are streamed to stdout as raw gray or RGB video for an encoder,
+    such as ffmpeg -f rawvideo. Each frame starts from the previous one scaled up around the target: a pixel
+    whose source neighbourhood is flat keeps its estimate, and every other pixel is computed exactly by the
+    row kernel, the rows with the most work first. Keyframes are computed in full so estimates never drift far
+    from the exact frame. A path that zooms out instead computes the border the previous frame does not cover.
+    Author: Max Croucher
+    Email: mpccroucher@gmail.com
+    July 2025
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "tile_render.h"
+
+#define DEFAULT_WIDTH 1920
+#define DEFAULT_HEIGHT 1080
+#define DEFAULT_FRAMES 600 // ten seconds at 60 frames/s
+#define DEFAULT_START_WIDTH 3.5 // the whole set across the first frame
+#define DEFAULT_END_WIDTH 1e-8
+#define DEFAULT_KEYFRAME 60 // frames between keyframes, which reuse nothing
+#define FRAME_QUEUE 4 // finished frames waiting to be written before rendering stalls
+#define MAX_FRAME_SIZE 8192 // widest and tallest frame accepted
+
+enum frame_format {
+    FRAME_GRAY, // 8-bit gray, 0xFF less the iteration count as in PNG tiles
+    FRAME_RGB // 24-bit RGB through the classic palette of mandelbrot-clientside.html
+};
+
+struct frame_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // signalled when a frame is queued or the last one has been
+    pthread_cond_t room; // signalled when a frame has been written and its slot is free
+    unsigned char* slots[FRAME_QUEUE];
+    unsigned int head; // oldest queued frame
+    unsigned int length;
+    int finished; // no more frames will be queued
+}; // frames passed in order from the workers to the writer
+
+struct zoom_state {
+    pthread_barrier_t barrier;
+    png_byte* previous; // values of the last frame
+    png_byte* current; // values of the frame being rendered
+    unsigned char* need; // pixels of the current frame still to be computed
+    unsigned int* row_work; // pixels to compute on each row
+    unsigned int* row_order; // rows by decreasing work, the order they are handed out in
+    int* source_x; // pixel of the previous frame nearest each column and row of the current one, or -1 outside it
+    int* source_y;
+    unsigned char* slot; // output slot the current frame is coloured into
+    _Atomic unsigned int next_row;
+    unsigned int frame;
+    int running; // cleared by the serial thread once every frame is done or the output has failed
+    int keyframe;
+    double step; // complex distance between neighbouring pixels
+    double start_r; // complex coordinate of the top-left pixel
+    double start_i;
+    _Atomic uint64_t reused; // pixels taken from the previous frame
+    _Atomic int failed; // the writer could not write a frame
+}; // shared by the workers, which move through the frames in lockstep
+
+struct worker_data {
+    unsigned int id;
+    struct kernel_stats stats;
+};
+
+unsigned int width = DEFAULT_WIDTH;
+unsigned int height = DEFAULT_HEIGHT;
+unsigned int num_frames = DEFAULT_FRAMES;
+unsigned int keyframe_interval = DEFAULT_KEYFRAME;
+double target_r = -0.743643887037151; // seahorse valley
+double target_i = 0.131825904205330;
+double start_width = DEFAULT_START_WIDTH;
+double end_width = DEFAULT_END_WIDTH;
+double zoom_factor; // ratio of the width of each frame to the one before
+enum frame_format frame_format = FRAME_RGB;
+unsigned int channels = 3;
+unsigned char palette[256][3]; // colour of each pixel value
+struct frame_queue queue = {.lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER, .room = PTHREAD_COND_INITIALIZER};
+struct zoom_state zoom;
+
+
+static double now(void) {
+    /* monotonic time in seconds */
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+
+static void init_palette(void) {
+    /* colour each pixel value by its iteration count, as the classic palette does, with the inside of the set black */
+    for (int value = 0; value < 256; value++) {
+        int col = 0xFF - value;
+        unsigned char* colour = palette[value];
+        if (value == 0) {
+            colour[0] = colour[1] = colour[2] = 0;
+        } else if (col < 16) { // blue to magenta
+            colour[0] = col * 16;
+            colour[1] = 0;
+            colour[2] = 255;
+        } else if (col < 64) { // magenta to red
+            colour[0] = 255;
+            colour[1] = 0;
+            colour[2] = 255 - (col - 16) / 3 * 16;
+        } else { // red to yellow
+            colour[0] = 255;
+            colour[1] = (col - 64) / 3 * 4;
+            colour[2] = 0;
+        }
+    }
+}
+
+
+static int write_all(int fd, const void* data, size_t length) {
+    /* write a whole buffer to a file descriptor */
+    const char* bytes = data;
+    while (length) {
+        ssize_t count = write(fd, bytes, length);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return -1;
+        bytes += count;
+        length -= count;
+    }
+    return 0;
+}
+
+
+static void* frame_writer(void* unused) {
+    /* write queued frames to stdout in order. Once a write fails the remaining frames are dropped so the
+    workers are never left waiting for a slot */
+    size_t frame_bytes = (size_t)width * height * channels;
+    pthread_mutex_lock(&queue.lock);
+    while (1) {
+        while (queue.length == 0 && !queue.finished) pthread_cond_wait(&queue.ready, &queue.lock);
+        if (queue.length == 0) break;
+        unsigned char* slot = queue.slots[queue.head];
+        pthread_mutex_unlock(&queue.lock);
+        if (!atomic_load(&zoom.failed) && write_all(STDOUT_FILENO, slot, frame_bytes)) atomic_store(&zoom.failed, 1);
+        pthread_mutex_lock(&queue.lock);
+        queue.head = (queue.head + 1) % FRAME_QUEUE;
+        queue.length--;
+        pthread_cond_signal(&queue.room);
+    }
+    pthread_mutex_unlock(&queue.lock);
+    return NULL;
+}
+
+
+static int synchronise(void) {
+    /* wait for every worker to reach this point. Returns nonzero in exactly one of them, which then does the
+    serial work between two phases */
+    return pthread_barrier_wait(&zoom.barrier) == PTHREAD_BARRIER_SERIAL_THREAD;
+}
+
+
+static int source_pixel(unsigned int position, unsigned int size) {
+    /* the pixel of the previous frame nearest a position along an axis of the current one, or -1 if it falls
+    outside the previous frame, as it does near the border when zooming out */
+    long source = lround((size - 1) / 2.0 + (position - (size - 1) / 2.0) * zoom_factor);
+    return source >= 0 && source < size ? source : -1;
+}
+
+
+static void start_frame(unsigned int frame) {
+    /* queue the frame just finished, then set up the view of the next and claim a slot to colour it into */
+    if (frame > 0) {
+        pthread_mutex_lock(&queue.lock);
+        queue.length++;
+        pthread_cond_signal(&queue.ready);
+        pthread_mutex_unlock(&queue.lock);
+        png_byte* swap = zoom.previous;
+        zoom.previous = zoom.current;
+        zoom.current = swap;
+    }
+    zoom.running = frame < num_frames && !atomic_load(&zoom.failed);
+    if (!zoom.running) return;
+
+    zoom.frame = frame;
+    zoom.keyframe = frame % keyframe_interval == 0;
+    zoom.step = start_width * pow(zoom_factor, frame) / width;
+    zoom.start_r = target_r - zoom.step * (width - 1) / 2.0;
+    zoom.start_i = target_i - zoom.step * (height - 1) / 2.0;
+    if (!zoom.keyframe) { // the previous frame is this one scaled by zoom_factor around the centre
+        for (unsigned int x = 0; x < width; x++) zoom.source_x[x] = source_pixel(x, width);
+        for (unsigned int y = 0; y < height; y++) zoom.source_y[y] = source_pixel(y, height);
+    }
+    atomic_store(&zoom.next_row, 0);
+
+    pthread_mutex_lock(&queue.lock);
+    while (queue.length == FRAME_QUEUE) pthread_cond_wait(&queue.room, &queue.lock);
+    zoom.slot = queue.slots[(queue.head + queue.length) % FRAME_QUEUE];
+    pthread_mutex_unlock(&queue.lock);
+}
+
+
+static void estimate_row(unsigned int y) {
+    /* fill a row of the current frame from the previous one, marking the pixels that must be computed: all of
+    them on a keyframe, otherwise those outside the previous frame or whose nearest source pixel differs from
+    any of its eight neighbours */
+    png_byte* row = zoom.current + (size_t)y * width;
+    unsigned char* need = zoom.need + (size_t)y * width;
+    if (zoom.keyframe || zoom.source_y[y] < 0) {
+        memset(need, 1, width);
+        zoom.row_work[y] = width;
+        return;
+    }
+    int source_y = zoom.source_y[y];
+    const png_byte* above = zoom.previous + (size_t)(source_y > 0 ? source_y - 1 : source_y) * width;
+    const png_byte* middle = zoom.previous + (size_t)source_y * width;
+    const png_byte* below = zoom.previous + (size_t)(source_y + 1 < height ? source_y + 1 : source_y) * width;
+    unsigned int work = 0;
+    for (unsigned int x = 0; x < width; x++) {
+        int sx = zoom.source_x[x];
+        if (sx < 0) {
+            need[x] = 1;
+            work++;
+            continue;
+        }
+        int left = sx > 0 ? sx - 1 : sx;
+        int right = sx + 1 < width ? sx + 1 : sx;
+        png_byte value = middle[sx];
+        int flat = above[left] == value && above[sx] == value && above[right] == value && middle[left] == value
+            && middle[right] == value && below[left] == value && below[sx] == value && below[right] == value;
+        row[x] = value;
+        need[x] = !flat;
+        work += !flat;
+    }
+    zoom.row_work[y] = work;
+    atomic_fetch_add(&zoom.reused, width - work);
+}
+
+
+static int compare_row_work(const void* a, const void* b) {
+    /* qsort comparison of rows by decreasing work, then by position so the order is the same on every run */
+    unsigned int row_a = *(const unsigned int*)a;
+    unsigned int row_b = *(const unsigned int*)b;
+    if (zoom.row_work[row_a] != zoom.row_work[row_b]) return zoom.row_work[row_a] < zoom.row_work[row_b] ? 1 : -1;
+    return (row_a > row_b) - (row_a < row_b);
+}
+
+
+static void schedule_rows(void) {
+    /* order the rows of the frame by the pixels left to compute on them, so the most expensive rows are
+    started first and no worker is left with a long row at the end */
+    for (unsigned int y = 0; y < height; y++) zoom.row_order[y] = y;
+    if (!zoom.keyframe) qsort(zoom.row_order, height, sizeof(unsigned int), compare_row_work);
+    atomic_store(&zoom.next_row, 0);
+}
+
+
+static void compute_row(unsigned int y, struct kernel_stats* stats) {
+    /* compute each run of marked pixels on a row with the row kernel, then colour the row into the output slot */
+    png_byte* row = zoom.current + (size_t)y * width;
+    const unsigned char* need = zoom.need + (size_t)y * width;
+    double c_i = zoom.start_i + zoom.step * y;
+    unsigned int x = 0;
+    while (x < width) {
+        if (!need[x]) {
+            x++;
+            continue;
+        }
+        unsigned int start = x;
+        while (x < width && need[x]) x++;
+        row_kernel(row + start, zoom.start_r + zoom.step * start, c_i, zoom.step, 0, x - start, stats);
+    }
+    unsigned char* out = zoom.slot + (size_t)y * width * channels;
+    if (frame_format == FRAME_GRAY) {
+        memcpy(out, row, width);
+    } else {
+        for (x = 0; x < width; x++) memcpy(out + 3 * x, palette[row[x]], 3);
+    }
+}
+
+
+static void* zoom_worker(void* worker_data_ptr) {
+    /* render every frame alongside the other workers: estimate rows from the previous frame, then compute the
+    marked pixels of the rows in order of their work. Frames depend on the one before, so the workers meet
+    between the phases and one of them does the serial work */
+    struct worker_data* worker = worker_data_ptr;
+    for (unsigned int frame = 0; ; frame++) {
+        if (synchronise()) start_frame(frame);
+        synchronise();
+        if (!zoom.running) break;
+
+        unsigned int y;
+        while ((y = atomic_fetch_add(&zoom.next_row, 1)) < height) estimate_row(y);
+        if (synchronise()) schedule_rows();
+        synchronise();
+
+        unsigned int next;
+        while ((next = atomic_fetch_add(&zoom.next_row, 1)) < height) compute_row(zoom.row_order[next], &worker->stats);
+    }
+    return NULL;
+}
+
+
+static void usage(char* name) {
+    /* print the command line options and exit */
+    fprintf(stderr, "Usage: %s [options] > frames\n", name);
+    fprintf(stderr, "  -W, --width <pixels>     frame width (default %d)\n", DEFAULT_WIDTH);
+    fprintf(stderr, "  -H, --height <pixels>    frame height (default %d)\n", DEFAULT_HEIGHT);
+    fprintf(stderr, "  -n, --frames <n>         frames in the animation (default %d)\n", DEFAULT_FRAMES);
+    fprintf(stderr, "  -c, --centre <re>,<im>   point zoomed into (default %.15g%+.15gi)\n", target_r, target_i);
+    fprintf(stderr, "  -s, --start <width>      width of the first frame in the complex plane (default %g)\n", DEFAULT_START_WIDTH);
+    fprintf(stderr, "  -e, --end <width>        width of the last frame (default %g)\n", DEFAULT_END_WIDTH);
+    fprintf(stderr, "  -k, --keyframe <n>       compute every pixel of each nth frame, 1 to reuse nothing (default %d)\n", DEFAULT_KEYFRAME);
+    fprintf(stderr, "  -f, --format <name>      gray, as PNG tiles, or rgb through the classic palette (default rgb)\n");
+    fprintf(stderr, "  -t, --threads <n>        render threads (default one per CPU)\n");
+    fprintf(stderr, "Frames are raw video, for example piped into\n");
+    fprintf(stderr, "  ffmpeg -f rawvideo -pixel_format rgb24 -video_size %dx%d -framerate 60 -i - zoom.mp4\n", DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"width", required_argument, NULL, 'W'},
+        {"height", required_argument, NULL, 'H'},
+        {"frames", required_argument, NULL, 'n'},
+        {"centre", required_argument, NULL, 'c'},
+        {"start", required_argument, NULL, 's'},
+        {"end", required_argument, NULL, 'e'},
+        {"keyframe", required_argument, NULL, 'k'},
+        {"format", required_argument, NULL, 'f'},
+        {"threads", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0}
+    };
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int option;
+    char extra;
+    while ((option = getopt_long(argc, argv, "W:H:n:c:s:e:k:f:t:", long_options, NULL)) != -1) {
+        switch (option) {
+        case 'W':
+            width = atoi(optarg);
+            break;
+        case 'H':
+            height = atoi(optarg);
+            break;
+        case 'n':
+            num_frames = atoi(optarg);
+            break;
+        case 'c':
+            if (sscanf(optarg, "%lf,%lf%c", &target_r, &target_i, &extra) != 2) usage(argv[0]);
+            break;
+        case 's':
+            start_width = atof(optarg);
+            break;
+        case 'e':
+            end_width = atof(optarg);
+            break;
+        case 'k':
+            keyframe_interval = atoi(optarg);
+            break;
+        case 'f':
+            if (!strcmp(optarg, "gray")) frame_format = FRAME_GRAY;
+            else if (!strcmp(optarg, "rgb")) frame_format = FRAME_RGB;
+            else usage(argv[0]);
+            break;
+        case 't':
+            num_threads = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc || width < 1 || height < 1 || width > MAX_FRAME_SIZE || height > MAX_FRAME_SIZE || num_frames < 1
+        || keyframe_interval < 1 || num_threads < 1 || !(start_width > 0) || !(end_width > 0)) usage(argv[0]);
+    if (fmin(start_width, end_width) / width < BASE_RANGE_X / IMAGE_SIZE * ldexp(1, -DOUBLE_MAX_DEPTH)) {
+        fprintf(stderr, "Error: The deepest frame is deeper than a double resolves, at least a width of %g across %u pixels\n",
+            BASE_RANGE_X / IMAGE_SIZE * ldexp(1, -DOUBLE_MAX_DEPTH) * width, width);
+        exit(EXIT_FAILURE);
+    }
+    if (isatty(STDOUT_FILENO)) {fprintf(stderr, "Error: Frames are raw video, pipe them into an encoder or a file\n"); exit(EXIT_FAILURE);}
+    signal(SIGPIPE, SIG_IGN); // an encoder that exits early fails the write instead
+    channels = frame_format == FRAME_RGB ? 3 : 1;
+    zoom_factor = num_frames > 1 ? pow(end_width / start_width, 1.0 / (num_frames - 1)) : 1;
+
+    size_t pixels = (size_t)width * height;
+    zoom.previous = malloc(pixels);
+    zoom.current = malloc(pixels);
+    zoom.need = malloc(pixels);
+    zoom.row_work = malloc(height * sizeof(unsigned int));
+    zoom.row_order = malloc(height * sizeof(unsigned int));
+    zoom.source_x = malloc(width * sizeof(int));
+    zoom.source_y = malloc(height * sizeof(int));
+    int allocated = zoom.previous && zoom.current && zoom.need && zoom.row_work && zoom.row_order && zoom.source_x && zoom.source_y;
+    for (unsigned int i = 0; i < FRAME_QUEUE; i++) {
+        queue.slots[i] = malloc(pixels * channels);
+        allocated &= queue.slots[i] != NULL;
+    }
+    if (!allocated) {fprintf(stderr, "Error: Unable to allocate frames of %ux%u\n", width, height); exit(EXIT_FAILURE);}
+
+    init_kernel();
+    init_palette();
+    fprintf(stderr, "Zooming into %.15g%+.15gi from width %g to %g over %u frames of %ux%u %s, using %s kernel and %ld threads\n",
+        target_r, target_i, start_width, end_width, num_frames, width, height, frame_format == FRAME_RGB ? "rgb24" : "gray",
+        row_kernel_name, num_threads);
+
+    double start = now();
+    pthread_t writer;
+    pthread_create(&writer, NULL, frame_writer, NULL);
+    pthread_barrier_init(&zoom.barrier, NULL, num_threads);
+    struct worker_data workers[num_threads];
+    pthread_t threads[num_threads];
+    for (unsigned int i = 0; i < num_threads; i++) {
+        workers[i] = (struct worker_data){.id = i};
+        pthread_create(&threads[i], NULL, zoom_worker, &workers[i]);
+    }
+    struct kernel_stats stats = {0};
+    for (unsigned int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        stats.cardioid += workers[i].stats.cardioid;
+        stats.bulb += workers[i].stats.bulb;
+        stats.periodic += workers[i].stats.periodic;
+    }
+    pthread_mutex_lock(&queue.lock);
+    queue.finished = 1;
+    pthread_cond_signal(&queue.ready);
+    pthread_mutex_unlock(&queue.lock);
+    pthread_join(writer, NULL);
+    double elapsed = now() - start;
+    pthread_barrier_destroy(&zoom.barrier);
+
+    if (atomic_load(&zoom.failed)) {
+        fprintf(stderr, "Error: Unable to write the frames, stopped at frame %u of %u\n", zoom.frame, num_frames);
+    } else {
+        fprintf(stderr, "Rendered %u frames in %.1f s, %.2f frames/s\n", num_frames, elapsed, num_frames / elapsed);
+        fprintf(stderr, "Reuse: %.1f%% of pixels taken from the previous frame, keyframe every %u frames\n",
+            100.0 * atomic_load(&zoom.reused) / ((double)pixels * num_frames), keyframe_interval);
+        fprintf(stderr, "Interior shortcuts: %" PRIu64 " cardioid, %" PRIu64 " bulb and %" PRIu64 " periodic pixels\n",
+            stats.cardioid, stats.bulb, stats.periodic);
+    }
+    for (unsigned int i = 0; i < FRAME_QUEUE; i++) free(queue.slots[i]);
+    free(zoom.previous);
+    free(zoom.current);
+    free(zoom.need);
+    free(zoom.row_work);
+    free(zoom.row_order);
+    free(zoom.source_x);
+    free(zoom.source_y);
+    return atomic_load(&zoom.failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
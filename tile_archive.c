@@ -0,0 +1,183 @@
+/* Source file for tile_archive.c, a single-file store of encoded tiles with a memory-mapped index.
+    Workers append tiles concurrently without locks: each reserves a range of the file with an atomic
+    add, writes its tile there, and claims an index slot with a compare-and-swap. Readers map the whole
+    file and look tiles up in O(1), handing out pointers straight into the mapping
+    Author: Max Croucher
+    Email: mpccroucher@gmail.com
+    July 2025
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tile_archive.h"
+
+
+static uint64_t slot_of(uint64_t id, uint64_t capacity) {
+    /* hash a tile id to its first index slot (Fibonacci hashing mixes the Morton bits into the low bits) */
+    return (id * 0x9E3779B97F4A7C15ULL >> 17) & (capacity - 1);
+}
+
+
+static uint64_t spread_bits(uint64_t v) {
+    /* move bit k of a 32-bit value to bit 2k */
+    v &= 0xFFFFFFFFULL;
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+    v = (v | (v << 8)) & 0x00FF00FF00FF00FFULL;
+    v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v << 2)) & 0x3333333333333333ULL;
+    return (v | (v << 1)) & 0x5555555555555555ULL;
+}
+
+
+uint64_t tile_archive_id(unsigned int z, uint64_t x, uint64_t y) {
+    /* the id an archive keys tile (x, y) of level z by, a 58-bit Morton index above a 6-bit depth. Unique up to
+    level 29, as every level an archive can hold */
+    return (((spread_bits(x) << 1) | spread_bits(y)) << 6) | z;
+}
+
+
+static size_t index_end(uint64_t capacity) {
+    /* offset of the first byte after the index, which is where tile data begins */
+    return sizeof(struct tile_archive_header) + capacity * sizeof(struct tile_archive_entry);
+}
+
+
+struct tile_archive* tile_archive_create(const char* filename, unsigned int image_size, unsigned int max_zoom, uint64_t num_tiles) {
+    /* create an empty archive with room in the index for num_tiles tiles, keeping the load factor under 3/4 */
+    uint64_t capacity = 1;
+    while (capacity < num_tiles + num_tiles / 3 + 1) capacity <<= 1;
+
+    struct tile_archive* archive = calloc(1, sizeof(struct tile_archive));
+    if (archive == NULL) return NULL;
+    archive->writable = 1;
+    archive->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    archive->map_length = index_end(capacity);
+    if (archive->fd < 0 || ftruncate(archive->fd, archive->map_length)) goto fail;
+    archive->map = mmap(NULL, archive->map_length, PROT_READ | PROT_WRITE, MAP_SHARED, archive->fd, 0);
+    if (archive->map == MAP_FAILED) goto fail;
+
+    archive->header = (struct tile_archive_header*)archive->map;
+    archive->index = (struct tile_archive_entry*)(archive->map + sizeof(struct tile_archive_header));
+    memcpy(archive->header->magic, TILE_ARCHIVE_MAGIC, sizeof(archive->header->magic));
+    archive->header->image_size = image_size;
+    archive->header->max_zoom = max_zoom;
+    archive->header->index_capacity = capacity;
+    for (uint64_t i = 0; i < capacity; i++) {
+        atomic_init(&archive->index[i].id, TILE_ARCHIVE_EMPTY);
+    }
+    atomic_init(&archive->data_end, archive->map_length);
+    return archive;
+
+fail:
+    if (archive->fd >= 0) close(archive->fd);
+    free(archive);
+    return NULL;
+}
+
+
+static int publish(struct tile_archive* archive, uint64_t id, uint64_t offset, uint32_t length) {
+    /* point the index entry of tile id at length bytes of tile data starting at offset */
+    uint64_t capacity = archive->header->index_capacity;
+    for (uint64_t probe = 0, slot = slot_of(id, capacity); probe < capacity; probe++, slot = (slot + 1) & (capacity - 1)) {
+        struct tile_archive_entry* entry = &archive->index[slot];
+        uint64_t expected = TILE_ARCHIVE_EMPTY;
+        if (atomic_compare_exchange_strong(&entry->id, &expected, id) || expected == id) {
+            entry->offset = offset;
+            atomic_store_explicit(&entry->length, length, memory_order_release);
+            return 0;
+        }
+    }
+    return -1; // index full
+}
+
+
+int tile_archive_append(struct tile_archive* archive, uint64_t id, const void* data, uint32_t length) {
+    /* append an encoded tile and publish it in the index. Safe to call from many threads at once */
+    uint64_t offset = atomic_fetch_add(&archive->data_end, length);
+    const unsigned char* bytes = data;
+    for (uint32_t written = 0; written < length;) {
+        ssize_t count = pwrite(archive->fd, bytes + written, length - written, offset + written);
+        if (count <= 0) return -1;
+        written += count;
+    }
+    return publish(archive, id, offset, length);
+}
+
+
+int tile_archive_link(struct tile_archive* archive, uint64_t id, uint64_t source) {
+    /* publish tile id as a copy of the already appended tile source, sharing its data instead of writing it again */
+    uint64_t capacity = archive->header->index_capacity;
+    for (uint64_t probe = 0, slot = slot_of(source, capacity); probe < capacity; probe++, slot = (slot + 1) & (capacity - 1)) {
+        struct tile_archive_entry* entry = &archive->index[slot];
+        uint64_t entry_id = atomic_load_explicit(&entry->id, memory_order_relaxed);
+        if (entry_id == TILE_ARCHIVE_EMPTY) return -1;
+        if (entry_id != source) continue;
+        uint32_t length = atomic_load_explicit(&entry->length, memory_order_acquire);
+        if (length == 0) return -1; // source not written yet
+        return publish(archive, id, entry->offset, length);
+    }
+    return -1;
+}
+
+
+struct tile_archive* tile_archive_open(const char* filename) {
+    /* map a finished archive for reading */
+    struct tile_archive* archive = calloc(1, sizeof(struct tile_archive));
+    if (archive == NULL) return NULL;
+    struct stat stats;
+    archive->fd = open(filename, O_RDONLY);
+    if (archive->fd < 0 || fstat(archive->fd, &stats) || stats.st_size < sizeof(struct tile_archive_header)) goto fail;
+    archive->map_length = stats.st_size;
+    archive->map = mmap(NULL, archive->map_length, PROT_READ, MAP_SHARED, archive->fd, 0);
+    if (archive->map == MAP_FAILED) goto fail;
+
+    archive->header = (struct tile_archive_header*)archive->map;
+    archive->index = (struct tile_archive_entry*)(archive->map + sizeof(struct tile_archive_header));
+    if (memcmp(archive->header->magic, TILE_ARCHIVE_MAGIC, sizeof(archive->header->magic))
+        || index_end(archive->header->index_capacity) > archive->map_length
+        || archive->header->data_end > archive->map_length) {
+        munmap(archive->map, archive->map_length);
+        goto fail;
+    }
+    return archive;
+
+fail:
+    if (archive->fd >= 0) close(archive->fd);
+    free(archive);
+    return NULL;
+}
+
+
+const void* tile_archive_lookup(const struct tile_archive* archive, uint64_t id, uint32_t* length) {
+    /* find a tile, returning a pointer into the mapped archive (or NULL if the tile is absent) and its length */
+    uint64_t capacity = archive->header->index_capacity;
+    for (uint64_t probe = 0, slot = slot_of(id, capacity); probe < capacity; probe++, slot = (slot + 1) & (capacity - 1)) {
+        struct tile_archive_entry* entry = &archive->index[slot];
+        uint64_t entry_id = atomic_load_explicit(&entry->id, memory_order_relaxed);
+        if (entry_id == TILE_ARCHIVE_EMPTY) return NULL;
+        if (entry_id != id) continue;
+        *length = atomic_load_explicit(&entry->length, memory_order_acquire);
+        if (*length == 0 || entry->offset + *length > archive->map_length) return NULL;
+        return archive->map + entry->offset;
+    }
+    return NULL;
+}
+
+
+int tile_archive_close(struct tile_archive* archive) {
+    /* finish an archive, recording where its data ends, and release it */
+    int code = 0;
+    if (archive->writable) {
+        archive->header->data_end = atomic_load(&archive->data_end);
+        code = msync(archive->map, archive->map_length, MS_SYNC);
+    }
+    munmap(archive->map, archive->map_length);
+    code |= close(archive->fd);
+    free(archive);
+    return code;
+}
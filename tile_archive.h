@@ -0,0 +1,58 @@
+/* Header file for tile_archive.c, a single-file store of encoded tiles with a memory-mapped index
+    Author: Max Croucher
+    Email: mpccroucher@gmail.com
+    July 2025
+*/
+
+#ifndef TILE_ARCHIVE_H
+#define TILE_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define TILE_ARCHIVE_MAGIC "MBTARC01"
+#define TILE_ARCHIVE_EMPTY UINT64_MAX // id of an unused index slot, never a valid tile id since its depth would be 63
+
+/* On disk, an archive is a header, then an open-addressed hash table of index entries keyed by tile id,
+then the encoded tiles back to back. Identical tiles may share one copy of their data, so several entries
+can point at the same offset. Every field is stored in native byte order */
+struct tile_archive_header {
+    char magic[8];
+    uint32_t image_size;
+    uint32_t max_zoom;
+    uint64_t index_capacity; // number of index slots, a power of two
+    uint64_t data_end; // one past the last byte of tile data
+};
+
+struct tile_archive_entry {
+    _Atomic uint64_t id;
+    uint64_t offset;
+    _Atomic uint32_t length; // 0 until the tile data is fully written
+    uint32_t reserved;
+};
+
+struct tile_archive {
+    int fd;
+    int writable;
+    unsigned char* map; // the whole file when reading, the header and index when writing
+    size_t map_length;
+    struct tile_archive_header* header;
+    struct tile_archive_entry* index;
+    atomic_uint_fast64_t data_end;
+};
+
+// writing
+struct tile_archive* tile_archive_create(const char* filename, unsigned int image_size, unsigned int max_zoom, uint64_t num_tiles);
+int tile_archive_append(struct tile_archive* archive, uint64_t id, const void* data, uint32_t length);
+int tile_archive_link(struct tile_archive* archive, uint64_t id, uint64_t source);
+
+uint64_t tile_archive_id(unsigned int z, uint64_t x, uint64_t y);
+
+// reading
+struct tile_archive* tile_archive_open(const char* filename);
+const void* tile_archive_lookup(const struct tile_archive* archive, uint64_t id, uint32_t* length);
+
+int tile_archive_close(struct tile_archive* archive);
+
+#endif
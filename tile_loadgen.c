@@ -0,0 +1,260 @@
+/* Source file for tile_loadgen.c, a load generator for tile_server.c. Each connection plays a user exploring
+    the map: it requests every tile of a small viewport, then pans or zooms and requests the next viewport,
+    over a keep-alive connection. Reports throughput and latency percentiles when the run ends
+    Author: Max Croucher
+    Email: mpccroucher@gmail.com
+    July 2025
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define VIEW_WIDTH 4 // tiles across a viewport
+#define VIEW_HEIGHT 3
+#define START_ZOOM 2 // every user starts at this level, so shallow tiles are shared between users
+#define RESPONSE_MAX (1 << 20) // largest response accepted, in bytes
+
+struct client_data {
+    unsigned int id;
+    unsigned int max_zoom;
+    double deadline;
+    double* latencies; // seconds taken by each completed request
+    uint64_t count;
+    uint64_t capacity;
+    uint64_t errors;
+};
+
+struct sockaddr_in server_address;
+
+
+static double now(void) {
+    /* monotonic time in seconds */
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+
+static int connect_server(void) {
+    /* open a connection to the server */
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    if (connect(fd, (struct sockaddr*)&server_address, sizeof(server_address))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+static int fetch_tile(int fd, char* buffer, unsigned int z, uint64_t x, uint64_t y) {
+    /* request a tile and read the whole response. Returns the status code, or -1 if the connection failed */
+    char request[256];
+    int length = snprintf(request, sizeof(request), "GET /%u/%" PRIu64 "/%" PRIu64 ".png HTTP/1.1\r\nHost: localhost\r\n\r\n", z, x, y);
+    if (send(fd, request, length, MSG_NOSIGNAL) != length) return -1;
+
+    size_t filled = 0;
+    char* body = NULL;
+    while (body == NULL) {
+        if (filled == RESPONSE_MAX) return -1;
+        ssize_t count = recv(fd, buffer + filled, RESPONSE_MAX - filled, 0);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return -1;
+        filled += count;
+        buffer[filled] = '\0';
+        body = strstr(buffer, "\r\n\r\n");
+    }
+    body += 4;
+    int status;
+    if (sscanf(buffer, "HTTP/1.%*d %d", &status) != 1) return -1;
+    char* content_length = strstr(buffer, "Content-Length:");
+    size_t expected = (body - buffer) + (content_length && content_length < body ? strtoull(content_length + 15, NULL, 10) : 0);
+    if (expected > RESPONSE_MAX) return -1;
+    while (filled < expected) {
+        ssize_t count = recv(fd, buffer + filled, expected - filled, 0);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return -1;
+        filled += count;
+    }
+    return status;
+}
+
+
+static void* client(void* client_data_ptr) {
+    /* explore the map until the deadline: request a viewport, then pan by a tile or zoom in or out */
+    struct client_data* data = client_data_ptr;
+    char* buffer = malloc(RESPONSE_MAX + 1);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error: Unable to allocate a response buffer for user %u\n", data->id);
+        data->errors++;
+        return NULL;
+    }
+    unsigned int seed = data->id * 2654435761u + 1;
+    unsigned int z = START_ZOOM;
+    int64_t x = rand_r(&seed) % (1 << z);
+    int64_t y = rand_r(&seed) % (1 << z);
+    int fd = connect_server();
+    while (fd >= 0 && now() < data->deadline) {
+        for (int64_t i = x - VIEW_WIDTH / 2; i < x + (VIEW_WIDTH + 1) / 2; i++) {
+            for (int64_t j = y - VIEW_HEIGHT / 2; j < y + (VIEW_HEIGHT + 1) / 2; j++) {
+                if (i < 0 || j < 0 || i >> z || j >> z) continue;
+                double start = now();
+                int status = fetch_tile(fd, buffer, z, i, j);
+                if (status < 0) { // reconnect and carry on, or give up on this user if the server is gone
+                    data->errors++;
+                    close(fd);
+                    fd = connect_server();
+                    if (fd < 0) goto finished;
+                    continue;
+                }
+                if (status != 200) {
+                    data->errors++;
+                    continue;
+                }
+                if (data->count == data->capacity) { // out of memory ends this user, keeping the latencies so far
+                    uint64_t capacity = data->capacity ? 2 * data->capacity : 1024;
+                    double* latencies = realloc(data->latencies, capacity * sizeof(double));
+                    if (latencies == NULL) {
+                        fprintf(stderr, "Error: Unable to record more latencies for user %u\n", data->id);
+                        data->errors++;
+                        goto finished;
+                    }
+                    data->latencies = latencies;
+                    data->capacity = capacity;
+                }
+                data->latencies[data->count++] = now() - start;
+            }
+        }
+        int move = rand_r(&seed) % 10;
+        if (move < 6) { // pan
+            x += (rand_r(&seed) % 3) - 1;
+            y += (rand_r(&seed) % 3) - 1;
+        } else if (move < 8 && z < data->max_zoom) { // zoom in around the centre
+            z++;
+            x = 2 * x + rand_r(&seed) % 2;
+            y = 2 * y + rand_r(&seed) % 2;
+        } else if (z > 1) { // zoom out
+            z--;
+            x /= 2;
+            y /= 2;
+        }
+        if (x < 0) x = 0;
+        if (y < 0) y = 0;
+        if (x >> z) x = (1 << z) - 1;
+        if (y >> z) y = (1 << z) - 1;
+    }
+finished:
+    if (fd >= 0) close(fd);
+    free(buffer);
+    return NULL;
+}
+
+
+static int compare_double(const void* a, const void* b) {
+    /* qsort comparison of doubles */
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+static void usage(char* name) {
+    /* print the command line options and exit */
+    fprintf(stderr, "Usage: %s [options]\n", name);
+    fprintf(stderr, "  -a, --address <address>  server address (default 127.0.0.1)\n");
+    fprintf(stderr, "  -p, --port <port>        server port (default 8080)\n");
+    fprintf(stderr, "  -c, --connections <n>    simulated users, one connection each (default 16)\n");
+    fprintf(stderr, "  -d, --duration <s>       length of the run in seconds (default 10)\n");
+    fprintf(stderr, "  -z, --zoom <level>       deepest level users zoom to (default 16)\n");
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"address", required_argument, NULL, 'a'},
+        {"port", required_argument, NULL, 'p'},
+        {"connections", required_argument, NULL, 'c'},
+        {"duration", required_argument, NULL, 'd'},
+        {"zoom", required_argument, NULL, 'z'},
+        {NULL, 0, NULL, 0}
+    };
+    const char* address = "127.0.0.1";
+    unsigned int port = 8080;
+    unsigned int num_clients = 16;
+    double duration = 10;
+    unsigned int max_zoom = 16;
+    int option;
+    while ((option = getopt_long(argc, argv, "a:p:c:d:z:", long_options, NULL)) != -1) {
+        switch (option) {
+        case 'a':
+            address = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            num_clients = atoi(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'z':
+            max_zoom = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc || num_clients < 1 || max_zoom < 1 || max_zoom > 30) usage(argv[0]);
+    server_address = (struct sockaddr_in){.sin_family = AF_INET, .sin_port = htons(port)};
+    if (inet_pton(AF_INET, address, &server_address.sin_addr) != 1) {fprintf(stderr, "Error: Invalid address %s\n", address); exit(EXIT_FAILURE);}
+
+    printf("Exploring http://%s:%u with %u users for %.0f seconds, down to level %u\n", address, port, num_clients, duration, max_zoom);
+    struct client_data clients[num_clients];
+    pthread_t threads[num_clients];
+    double start = now();
+    for (unsigned int i = 0; i < num_clients; i++) {
+        clients[i] = (struct client_data){.id = i, .max_zoom = max_zoom, .deadline = start + duration};
+        pthread_create(&threads[i], NULL, client, &clients[i]);
+    }
+    uint64_t total = 0, errors = 0;
+    for (unsigned int i = 0; i < num_clients; i++) {
+        pthread_join(threads[i], NULL);
+        total += clients[i].count;
+        errors += clients[i].errors;
+    }
+    double elapsed = now() - start;
+
+    // merge the latencies of every user to find the percentiles
+    double* latencies = malloc((total ? total : 1) * sizeof(double));
+    if (latencies == NULL) {fprintf(stderr, "Error: Unable to allocate the latencies of %" PRIu64 " tiles\n", total); exit(EXIT_FAILURE);}
+    uint64_t merged = 0;
+    for (unsigned int i = 0; i < num_clients; i++) {
+        memcpy(latencies + merged, clients[i].latencies, clients[i].count * sizeof(double));
+        merged += clients[i].count;
+        free(clients[i].latencies);
+    }
+    qsort(latencies, total, sizeof(double), compare_double);
+    printf("%" PRIu64 " tiles in %.1f s: %.1f tiles/s, %" PRIu64 " errors\n", total, elapsed, total / elapsed, errors);
+    if (total) {
+        printf("Latency: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n", 1e3 * latencies[total / 2],
+            1e3 * latencies[total * 9 / 10], 1e3 * latencies[total * 99 / 100], 1e3 * latencies[total - 1]);
+    }
+    free(latencies);
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,1129 @@
+/* Source file for tile_render.c, the renderer shared by the tile generator and the tile server. Tiles are
+    rendered by runtime-selected SIMD row kernels in double precision, or by perturbation around a double-double
+    reference orbit below DOUBLE_MAX_DEPTH, and encoded to PNG through an interchangeable output sink
+    Author: Max Croucher
+    Email: mpccroucher@gmail.com
+    July 2025
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <png.h>
+#include <zlib.h>
+#include <stdatomic.h>
+#include "tile_render.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+#define ARENA_ALIGN 16 // alignment of each block an encoder's arena hands out
+#define ANTIALIAS_RUN_GAP 8 // edge pixels this close along a row are refined as one run, keeping the vector lanes between them busy
+
+
+static int inside_cardioid(double c_r, double c_i) {
+    /* closed-form test for the main cardioid */
+    double x = c_r - 0.25;
+    double q = x * x + c_i * c_i;
+    return q * (q + x) <= 0.25 * c_i * c_i;
+}
+
+
+static int inside_bulb(double c_r, double c_i) {
+    /* closed-form test for the period-2 bulb, the disc of radius 1/4 around -1 */
+    return (c_r + 1) * (c_r + 1) + c_i * c_i <= 1.0 / 16;
+}
+
+
+static int escape_time(double c_r, double c_i, double epsilon, unsigned int max_iterations, struct kernel_stats* stats, double* escaped_r, double* escaped_i) {
+    /* determine the number of iterations required for z = z^2 + c to diverge, where z,c are complex, returning the
+    iteration on which z left the escape square and leaving z in escaped, -1 if it never does, or -2 if it has not
+    by max_iterations. Points in the main cardioid or period-2 bulb are answered without iterating, and an orbit
+    that returns within epsilon of the point saved at the last power-of-two iteration (Brent's method) has fallen
+    into a cycle and will never diverge */
+    if (inside_cardioid(c_r, c_i)) {
+        stats->cardioid++;
+        stats->iterations_saved += max_iterations;
+        return -1;
+    }
+    if (inside_bulb(c_r, c_i)) {
+        stats->bulb++;
+        stats->iterations_saved += max_iterations;
+        return -1;
+    }
+    double z_r = 0;
+    double z_i = 0;
+    double saved_r = 0;
+    double saved_i = 0;
+    unsigned int next_save = 1;
+    for (unsigned int i = 0; i < max_iterations; i++) {
+        double x_r = z_r * z_r - z_i * z_i;
+        double x_i = 2 * z_r * z_i;
+        z_r = x_r + c_r;
+        z_i = x_i + c_i;
+        if (-2 > z_r || z_r > 2 || -2 > z_i || z_i > 2) {
+            *escaped_r = z_r;
+            *escaped_i = z_i;
+            return i;
+        }
+        if (fabs(z_r - saved_r) < epsilon && fabs(z_i - saved_i) < epsilon) {
+            stats->periodic++;
+            stats->iterations_saved += max_iterations - 1 - i;
+            return -1;
+        }
+        if (i == next_save) {
+            saved_r = z_r;
+            saved_i = z_i;
+            next_save <<= 1;
+        }
+    }
+    return -2;
+    // return ((int)(x * 10) % 2 ^ (int)(y * 10) % 2);
+}
+
+
+int mandelbrot_point(double c_r, double c_i, double epsilon, struct kernel_stats* stats) {
+    /* the pixel value of point c, 0xFF less the iterations it takes to escape, or 0 inside the set */
+    double z_r, z_i;
+    int i = escape_time(c_r, c_i, epsilon, MAX_ITERATIONS, stats, &z_r, &z_i);
+    return i < 0 ? 0 : 0xFF - i;
+}
+
+
+static void mandelbrot_row_double(png_byte* row, double start_r, double start_i, double step_r, double step_i, unsigned int n, struct kernel_stats* stats) {
+    /* portable double precision kernel for n pixels along a row or column, starting at c = start and advancing
+    by step from one pixel to the next */
+    double epsilon = fmax(fabs(step_r), fabs(step_i)) * PERIODICITY_EPSILON;
+    for (unsigned int x = 0; x < n; x++) {
+        row[x] = mandelbrot_point(start_r + step_r * x, start_i + step_i * x, epsilon, stats);
+    }
+}
+
+
+#ifdef HAVE_X86_KERNELS
+/* The vector kernels below iterate two registers of pixels side by side (4, 8 or 16 pixels per
+group) so that the latency of one dependency chain hides behind the other. Each lane keeps
+iterating after it escapes or is caught in a cycle, but its result is latched by the mask and
+the group exits as soon as no lane is active. Every lane of a group reaches the power-of-two
+checkpoints of the periodicity test on the same iteration, so the saved points are shared.
+A line that does not fill the last group runs it with the lanes past its end masked off, which
+is still cheaper than finishing the line one pixel at a time. */
+
+__attribute__((target("sse2")))
+static __m128d interior_sse2(__m128d cr, __m128d ci, __m128d valid, struct kernel_stats* stats) {
+    /* valid lanes inside the main cardioid or the period-2 bulb */
+    __m128d x = _mm_sub_pd(cr, _mm_set1_pd(0.25));
+    __m128d q = _mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(ci, ci));
+    __m128d cardioid = _mm_and_pd(valid, _mm_cmple_pd(_mm_mul_pd(q, _mm_add_pd(q, x)), _mm_mul_pd(_mm_set1_pd(0.25), _mm_mul_pd(ci, ci))));
+    __m128d w = _mm_add_pd(cr, _mm_set1_pd(1));
+    __m128d bulb = _mm_andnot_pd(cardioid, _mm_and_pd(valid, _mm_cmple_pd(_mm_add_pd(_mm_mul_pd(w, w), _mm_mul_pd(ci, ci)), _mm_set1_pd(1.0 / 16))));
+    stats->cardioid += __builtin_popcount(_mm_movemask_pd(cardioid));
+    stats->bulb += __builtin_popcount(_mm_movemask_pd(bulb));
+    stats->iterations_saved += MAX_ITERATIONS * __builtin_popcount(_mm_movemask_pd(_mm_or_pd(cardioid, bulb)));
+    return _mm_or_pd(cardioid, bulb);
+}
+
+
+__attribute__((target("sse2")))
+static void mandelbrot_row_sse2(png_byte* row, double start_r, double start_i, double step_r, double step_i, unsigned int n, struct kernel_stats* stats) {
+    /* SSE2 line kernel, 2 groups of 2 doubles */
+    const __m128d bound = _mm_set1_pd(MANDELBROT_BOUND);
+    const __m128d neg_bound = _mm_set1_pd(-MANDELBROT_BOUND);
+    const __m128d sign = _mm_set1_pd(-0.0);
+    const __m128d epsilon = _mm_set1_pd(fmax(fabs(step_r), fabs(step_i)) * PERIODICITY_EPSILON);
+    for (unsigned int x = 0; x < n; x += 4) {
+        __m128d cr[2], ci[2], zr[2], zi[2], saved_r[2], saved_i[2], active[2], escape[2];
+        for (int g = 0; g < 2; g++) {
+            __m128d index = _mm_set_pd(x+2*g+1, x+2*g);
+            __m128d valid = _mm_cmplt_pd(index, _mm_set1_pd(n));
+            cr[g] = _mm_add_pd(_mm_set1_pd(start_r), _mm_mul_pd(_mm_set1_pd(step_r), index));
+            ci[g] = _mm_add_pd(_mm_set1_pd(start_i), _mm_mul_pd(_mm_set1_pd(step_i), index));
+            zr[g] = zi[g] = saved_r[g] = saved_i[g] = _mm_setzero_pd();
+            active[g] = _mm_andnot_pd(interior_sse2(cr[g], ci[g], valid, stats), valid);
+            escape[g] = _mm_set1_pd(-1);
+        }
+        unsigned int next_save = 1;
+        for (unsigned int i = 0; i < MAX_ITERATIONS; i++) {
+            int any_active = 0;
+            for (int g = 0; g < 2; g++) {
+                __m128d x_r = _mm_sub_pd(_mm_mul_pd(zr[g], zr[g]), _mm_mul_pd(zi[g], zi[g]));
+                __m128d x_i = _mm_mul_pd(_mm_add_pd(zr[g], zr[g]), zi[g]);
+                zr[g] = _mm_add_pd(x_r, cr[g]);
+                zi[g] = _mm_add_pd(x_i, ci[g]);
+                __m128d out = _mm_or_pd(
+                    _mm_or_pd(_mm_cmplt_pd(zr[g], neg_bound), _mm_cmpgt_pd(zr[g], bound)),
+                    _mm_or_pd(_mm_cmplt_pd(zi[g], neg_bound), _mm_cmpgt_pd(zi[g], bound))
+                );
+                __m128d escaped_now = _mm_and_pd(out, active[g]);
+                escape[g] = _mm_or_pd(_mm_and_pd(escaped_now, _mm_set1_pd(i)), _mm_andnot_pd(escaped_now, escape[g]));
+                active[g] = _mm_andnot_pd(out, active[g]);
+                __m128d periodic = _mm_and_pd(active[g], _mm_and_pd(
+                    _mm_cmplt_pd(_mm_andnot_pd(sign, _mm_sub_pd(zr[g], saved_r[g])), epsilon),
+                    _mm_cmplt_pd(_mm_andnot_pd(sign, _mm_sub_pd(zi[g], saved_i[g])), epsilon)
+                ));
+                int caught = __builtin_popcount(_mm_movemask_pd(periodic));
+                stats->periodic += caught;
+                stats->iterations_saved += caught * (MAX_ITERATIONS - 1 - i);
+                active[g] = _mm_andnot_pd(periodic, active[g]);
+                any_active |= _mm_movemask_pd(active[g]);
+            }
+            if (!any_active) break;
+            if (i == next_save) {
+                for (int g = 0; g < 2; g++) {
+                    saved_r[g] = zr[g];
+                    saved_i[g] = zi[g];
+                }
+                next_save <<= 1;
+            }
+        }
+        double lanes[4];
+        _mm_storeu_pd(lanes, escape[0]);
+        _mm_storeu_pd(lanes+2, escape[1]);
+        for (int l = 0; l < 4 && x + l < n; l++) row[x+l] = lanes[l] < 0 ? 0 : 0xFF - (int)lanes[l];
+    }
+}
+
+
+__attribute__((target("avx2")))
+static __m256d interior_avx2(__m256d cr, __m256d ci, __m256d valid, struct kernel_stats* stats) {
+    /* valid lanes inside the main cardioid or the period-2 bulb */
+    __m256d x = _mm256_sub_pd(cr, _mm256_set1_pd(0.25));
+    __m256d q = _mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(ci, ci));
+    __m256d cardioid = _mm256_and_pd(valid, _mm256_cmp_pd(_mm256_mul_pd(q, _mm256_add_pd(q, x)), _mm256_mul_pd(_mm256_set1_pd(0.25), _mm256_mul_pd(ci, ci)), _CMP_LE_OQ));
+    __m256d w = _mm256_add_pd(cr, _mm256_set1_pd(1));
+    __m256d bulb = _mm256_andnot_pd(cardioid, _mm256_and_pd(valid, _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(w, w), _mm256_mul_pd(ci, ci)), _mm256_set1_pd(1.0 / 16), _CMP_LE_OQ)));
+    stats->cardioid += __builtin_popcount(_mm256_movemask_pd(cardioid));
+    stats->bulb += __builtin_popcount(_mm256_movemask_pd(bulb));
+    stats->iterations_saved += MAX_ITERATIONS * __builtin_popcount(_mm256_movemask_pd(_mm256_or_pd(cardioid, bulb)));
+    return _mm256_or_pd(cardioid, bulb);
+}
+
+
+__attribute__((target("avx2")))
+static void mandelbrot_row_avx2(png_byte* row, double start_r, double start_i, double step_r, double step_i, unsigned int n, struct kernel_stats* stats) {
+    /* AVX2 line kernel, 2 groups of 4 doubles */
+    const __m256d bound = _mm256_set1_pd(MANDELBROT_BOUND);
+    const __m256d neg_bound = _mm256_set1_pd(-MANDELBROT_BOUND);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d epsilon = _mm256_set1_pd(fmax(fabs(step_r), fabs(step_i)) * PERIODICITY_EPSILON);
+    for (unsigned int x = 0; x < n; x += 8) {
+        __m256d cr[2], ci[2], zr[2], zi[2], saved_r[2], saved_i[2], active[2], escape[2];
+        for (int g = 0; g < 2; g++) {
+            __m256d index = _mm256_set_pd(x+4*g+3, x+4*g+2, x+4*g+1, x+4*g);
+            __m256d valid = _mm256_cmp_pd(index, _mm256_set1_pd(n), _CMP_LT_OQ);
+            cr[g] = _mm256_add_pd(_mm256_set1_pd(start_r), _mm256_mul_pd(_mm256_set1_pd(step_r), index));
+            ci[g] = _mm256_add_pd(_mm256_set1_pd(start_i), _mm256_mul_pd(_mm256_set1_pd(step_i), index));
+            zr[g] = zi[g] = saved_r[g] = saved_i[g] = _mm256_setzero_pd();
+            active[g] = _mm256_andnot_pd(interior_avx2(cr[g], ci[g], valid, stats), valid);
+            escape[g] = _mm256_set1_pd(-1);
+        }
+        unsigned int next_save = 1;
+        for (unsigned int i = 0; i < MAX_ITERATIONS; i++) {
+            int any_active = 0;
+            for (int g = 0; g < 2; g++) {
+                __m256d x_r = _mm256_sub_pd(_mm256_mul_pd(zr[g], zr[g]), _mm256_mul_pd(zi[g], zi[g]));
+                __m256d x_i = _mm256_mul_pd(_mm256_add_pd(zr[g], zr[g]), zi[g]);
+                zr[g] = _mm256_add_pd(x_r, cr[g]);
+                zi[g] = _mm256_add_pd(x_i, ci[g]);
+                __m256d out = _mm256_or_pd(
+                    _mm256_or_pd(_mm256_cmp_pd(zr[g], neg_bound, _CMP_LT_OQ), _mm256_cmp_pd(zr[g], bound, _CMP_GT_OQ)),
+                    _mm256_or_pd(_mm256_cmp_pd(zi[g], neg_bound, _CMP_LT_OQ), _mm256_cmp_pd(zi[g], bound, _CMP_GT_OQ))
+                );
+                escape[g] = _mm256_blendv_pd(escape[g], _mm256_set1_pd(i), _mm256_and_pd(out, active[g]));
+                active[g] = _mm256_andnot_pd(out, active[g]);
+                __m256d periodic = _mm256_and_pd(active[g], _mm256_and_pd(
+                    _mm256_cmp_pd(_mm256_andnot_pd(sign, _mm256_sub_pd(zr[g], saved_r[g])), epsilon, _CMP_LT_OQ),
+                    _mm256_cmp_pd(_mm256_andnot_pd(sign, _mm256_sub_pd(zi[g], saved_i[g])), epsilon, _CMP_LT_OQ)
+                ));
+                int caught = __builtin_popcount(_mm256_movemask_pd(periodic));
+                stats->periodic += caught;
+                stats->iterations_saved += caught * (MAX_ITERATIONS - 1 - i);
+                active[g] = _mm256_andnot_pd(periodic, active[g]);
+                any_active |= _mm256_movemask_pd(active[g]);
+            }
+            if (!any_active) break;
+            if (i == next_save) {
+                for (int g = 0; g < 2; g++) {
+                    saved_r[g] = zr[g];
+                    saved_i[g] = zi[g];
+                }
+                next_save <<= 1;
+            }
+        }
+        double lanes[8];
+        _mm256_storeu_pd(lanes, escape[0]);
+        _mm256_storeu_pd(lanes+4, escape[1]);
+        for (int l = 0; l < 8 && x + l < n; l++) row[x+l] = lanes[l] < 0 ? 0 : 0xFF - (int)lanes[l];
+    }
+}
+
+
+__attribute__((target("avx512f")))
+static __mmask8 interior_avx512(__m512d cr, __m512d ci, __mmask8 valid, struct kernel_stats* stats) {
+    /* valid lanes inside the main cardioid or the period-2 bulb */
+    __m512d x = _mm512_sub_pd(cr, _mm512_set1_pd(0.25));
+    __m512d q = _mm512_add_pd(_mm512_mul_pd(x, x), _mm512_mul_pd(ci, ci));
+    __mmask8 cardioid = valid & _mm512_cmp_pd_mask(_mm512_mul_pd(q, _mm512_add_pd(q, x)), _mm512_mul_pd(_mm512_set1_pd(0.25), _mm512_mul_pd(ci, ci)), _CMP_LE_OQ);
+    __m512d w = _mm512_add_pd(cr, _mm512_set1_pd(1));
+    __mmask8 bulb = valid & ~cardioid & _mm512_cmp_pd_mask(_mm512_add_pd(_mm512_mul_pd(w, w), _mm512_mul_pd(ci, ci)), _mm512_set1_pd(1.0 / 16), _CMP_LE_OQ);
+    stats->cardioid += __builtin_popcount(cardioid);
+    stats->bulb += __builtin_popcount(bulb);
+    stats->iterations_saved += MAX_ITERATIONS * __builtin_popcount(cardioid | bulb);
+    return cardioid | bulb;
+}
+
+
+__attribute__((target("avx512f")))
+static void mandelbrot_row_avx512(png_byte* row, double start_r, double start_i, double step_r, double step_i, unsigned int n, struct kernel_stats* stats) {
+    /* AVX-512 line kernel, 2 groups of 8 doubles */
+    const __m512d bound = _mm512_set1_pd(MANDELBROT_BOUND);
+    const __m512d neg_bound = _mm512_set1_pd(-MANDELBROT_BOUND);
+    const __m512d epsilon = _mm512_set1_pd(fmax(fabs(step_r), fabs(step_i)) * PERIODICITY_EPSILON);
+    const __m512d lane_index = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0);
+    for (unsigned int x = 0; x < n; x += 16) {
+        __m512d cr[2], ci[2], zr[2], zi[2], saved_r[2], saved_i[2], escape[2];
+        __mmask8 active[2];
+        for (int g = 0; g < 2; g++) {
+            __m512d index = _mm512_add_pd(lane_index, _mm512_set1_pd(x+8*g));
+            __mmask8 valid = _mm512_cmp_pd_mask(index, _mm512_set1_pd(n), _CMP_LT_OQ);
+            cr[g] = _mm512_fmadd_pd(_mm512_set1_pd(step_r), index, _mm512_set1_pd(start_r));
+            ci[g] = _mm512_fmadd_pd(_mm512_set1_pd(step_i), index, _mm512_set1_pd(start_i));
+            zr[g] = zi[g] = saved_r[g] = saved_i[g] = _mm512_setzero_pd();
+            active[g] = valid & ~interior_avx512(cr[g], ci[g], valid, stats);
+            escape[g] = _mm512_set1_pd(-1);
+        }
+        unsigned int next_save = 1;
+        for (unsigned int i = 0; i < MAX_ITERATIONS; i++) {
+            for (int g = 0; g < 2; g++) {
+                __m512d x_r = _mm512_sub_pd(_mm512_mul_pd(zr[g], zr[g]), _mm512_mul_pd(zi[g], zi[g]));
+                __m512d x_i = _mm512_mul_pd(_mm512_add_pd(zr[g], zr[g]), zi[g]);
+                zr[g] = _mm512_add_pd(x_r, cr[g]);
+                zi[g] = _mm512_add_pd(x_i, ci[g]);
+                __mmask8 out = _mm512_cmp_pd_mask(zr[g], neg_bound, _CMP_LT_OQ) | _mm512_cmp_pd_mask(zr[g], bound, _CMP_GT_OQ)
+                    | _mm512_cmp_pd_mask(zi[g], neg_bound, _CMP_LT_OQ) | _mm512_cmp_pd_mask(zi[g], bound, _CMP_GT_OQ);
+                escape[g] = _mm512_mask_mov_pd(escape[g], out & active[g], _mm512_set1_pd(i));
+                active[g] &= ~out;
+                __mmask8 periodic = active[g]
+                    & _mm512_cmp_pd_mask(_mm512_abs_pd(_mm512_sub_pd(zr[g], saved_r[g])), epsilon, _CMP_LT_OQ)
+                    & _mm512_cmp_pd_mask(_mm512_abs_pd(_mm512_sub_pd(zi[g], saved_i[g])), epsilon, _CMP_LT_OQ);
+                int caught = __builtin_popcount(periodic);
+                stats->periodic += caught;
+                stats->iterations_saved += caught * (MAX_ITERATIONS - 1 - i);
+                active[g] &= ~periodic;
+            }
+            if (!(active[0] | active[1])) break;
+            if (i == next_save) {
+                for (int g = 0; g < 2; g++) {
+                    saved_r[g] = zr[g];
+                    saved_i[g] = zi[g];
+                }
+                next_save <<= 1;
+            }
+        }
+        double lanes[16];
+        _mm512_storeu_pd(lanes, escape[0]);
+        _mm512_storeu_pd(lanes+8, escape[1]);
+        for (int l = 0; l < 16 && x + l < n; l++) row[x+l] = lanes[l] < 0 ? 0 : 0xFF - (int)lanes[l];
+    }
+}
+#endif
+
+
+row_kernel_t row_kernel = mandelbrot_row_double;
+const char* row_kernel_name = "scalar";
+
+
+void init_kernel(void) {
+    /* select the widest row kernel supported by the CPU we are running on */
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        row_kernel = mandelbrot_row_avx512;
+        row_kernel_name = "AVX-512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        row_kernel = mandelbrot_row_avx2;
+        row_kernel_name = "AVX2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        row_kernel = mandelbrot_row_sse2;
+        row_kernel_name = "SSE2";
+    }
+#endif
+}
+
+
+typedef struct {
+    double hi;
+    double lo;
+} dd_t; // double-double, an unevaluated sum hi + lo giving ~106 bits of mantissa
+
+
+static dd_t dd_add(dd_t a, dd_t b) {
+    /* add two double-doubles (two-sum of the high parts, with the low parts folded into the error) */
+    double s = a.hi + b.hi;
+    double v = s - a.hi;
+    double e = (a.hi - (s - v)) + (b.hi - v) + a.lo + b.lo;
+    double hi = s + e;
+    return (dd_t){hi, e - (hi - s)};
+}
+
+
+static dd_t dd_mul(dd_t a, dd_t b) {
+    /* multiply two double-doubles, using fma to recover the rounding error of the high product */
+    double p = a.hi * b.hi;
+    double e = fma(a.hi, b.hi, -p) + a.hi * b.lo + a.lo * b.hi;
+    double hi = p + e;
+    return (dd_t){hi, e - (hi - p)};
+}
+
+
+static dd_t dd_from_index(uint64_t index) {
+    /* exactly convert a tile index (up to 58 bits) to a double-double */
+    return dd_add((dd_t){(double)(index & ~0xFFFFFFFFULL), 0}, (dd_t){(double)(index & 0xFFFFFFFFULL), 0});
+}
+
+
+struct reference_orbit {
+    double z_r[MAX_ITERATIONS+1];
+    double z_i[MAX_ITERATIONS+1];
+    double z_r_lo[MAX_ITERATIONS+1]; // low parts of the double-double orbit, only needed for exact escape tests
+    double z_i_lo[MAX_ITERATIONS+1];
+    unsigned int length; // index of the last usable point of the orbit
+};
+
+
+struct tile_view {
+    unsigned int z;
+    double step; // distance between adjacent pixels
+    double start_x; // coordinates of pixel (0, 0), only valid when z <= DOUBLE_MAX_DEPTH
+    double start_y;
+    struct reference_orbit orbit; // orbit of pixel (IMAGE_SIZE/2, IMAGE_SIZE/2), only valid when z > DOUBLE_MAX_DEPTH
+    _Atomic int* cancel; // when set and nonzero, rendering stops early
+};
+
+
+static int dd_escaped(dd_t z) {
+    /* test whether a double-double lies outside [-MANDELBROT_BOUND, MANDELBROT_BOUND] */
+    return -MANDELBROT_BOUND > z.hi || z.hi > MANDELBROT_BOUND
+        || (z.hi == -MANDELBROT_BOUND && z.lo < 0) || (z.hi == MANDELBROT_BOUND && z.lo > 0);
+}
+
+
+static int perturbed_escaped(double ref, double ref_lo, double d) {
+    /* test whether ref + ref_lo + d lies outside [-MANDELBROT_BOUND, MANDELBROT_BOUND]. Rounding ref + d to a
+    double would blur the bound by an ulp of 2, which at deep zoom is many pixels wide, so values close to the
+    bound are compared as (ref -/+ bound) + ref_lo + d, where the first difference is exact */
+    double z = ref + d;
+    if (fabs(z) < MANDELBROT_BOUND * (1 - 0x1p-40)) return 0;
+    if (z > 0) return (ref - MANDELBROT_BOUND) + ref_lo + d > 0;
+    return (ref + MANDELBROT_BOUND) + ref_lo + d < 0;
+}
+
+
+static void compute_reference_orbit(struct reference_orbit* orbit, dd_t c_r, dd_t c_i) {
+    /* iterate z = z^2 + c in double-double precision, storing each point rounded to double. The orbit
+    stops at the first point outside MANDELBROT_BOUND, since nothing can be perturbed past it */
+    dd_t z_r = {0, 0};
+    dd_t z_i = {0, 0};
+    orbit->z_r[0] = orbit->z_r_lo[0] = 0;
+    orbit->z_i[0] = orbit->z_i_lo[0] = 0;
+    orbit->length = MAX_ITERATIONS;
+    for (unsigned int i = 1; i <= MAX_ITERATIONS; i++) {
+        dd_t x_r = dd_add(dd_mul(z_r, z_r), dd_mul((dd_t){-z_i.hi, -z_i.lo}, z_i));
+        dd_t x_i = dd_mul((dd_t){2 * z_r.hi, 2 * z_r.lo}, z_i);
+        z_r = dd_add(x_r, c_r);
+        z_i = dd_add(x_i, c_i);
+        orbit->z_r[i] = z_r.hi;
+        orbit->z_i[i] = z_i.hi;
+        orbit->z_r_lo[i] = z_r.lo;
+        orbit->z_i_lo[i] = z_i.lo;
+        if (dd_escaped(z_r) || dd_escaped(z_i)) {
+            orbit->length = i;
+            return;
+        }
+    }
+}
+
+
+static void tile_view_init(struct tile_view* view, unsigned int z, uint64_t x, uint64_t y) {
+    /* compute the coordinates of tile (z, x, y). Shallow tiles are addressed directly in double precision,
+    deep tiles are addressed as offsets from a reference orbit through the centre of the tile */
+    double range_x = ldexp(BASE_RANGE_X, -z);
+    double range_y = ldexp(BASE_RANGE_Y, -z);
+    view->z = z;
+    view->step = range_x / IMAGE_SIZE;
+    if (z <= DOUBLE_MAX_DEPTH) {
+        view->start_x = MIN_X + range_x * x;
+        view->start_y = MIN_Y + range_y * y;
+        return;
+    }
+    dd_t centre_x = dd_add((dd_t){MIN_X, 0}, dd_mul(dd_add(dd_from_index(x), (dd_t){0.5, 0}), (dd_t){range_x, 0}));
+    dd_t centre_y = dd_add((dd_t){MIN_Y, 0}, dd_mul(dd_add(dd_from_index(y), (dd_t){0.5, 0}), (dd_t){range_y, 0}));
+    compute_reference_orbit(&view->orbit, centre_x, centre_y);
+}
+
+
+static int perturb_escape_time(const struct reference_orbit* orbit, double dc_r, double dc_i, unsigned int max_iterations, double* escaped_r, double* escaped_i) {
+    /* iterate a pixel of a deep tile by its offset d from the reference orbit Z: d' = 2Zd + d^2 + dc, returning
+    the iteration on which Z+d left the escape square and leaving Z+d in escaped, or -2 if it has not by
+    max_iterations. Nothing is proven inside the set here, so every such pixel counts as capped.
+    Whenever the full value Z+d becomes smaller than d (where the offset would otherwise lose precision and
+    glitch), or the reference orbit runs out, the pixel is rebased onto the start of the reference orbit
+    with d = Z+d */
+    double d_r = 0;
+    double d_i = 0;
+    unsigned int m = 0;
+    for (unsigned int i = 0; i < max_iterations; i++) {
+        double ref_r = orbit->z_r[m];
+        double ref_i = orbit->z_i[m];
+        double next_r = 2 * (ref_r * d_r - ref_i * d_i) + d_r * d_r - d_i * d_i + dc_r;
+        double next_i = 2 * (ref_r * d_i + ref_i * d_r + d_r * d_i) + dc_i;
+        d_r = next_r;
+        d_i = next_i;
+        m++;
+        if (perturbed_escaped(orbit->z_r[m], orbit->z_r_lo[m], d_r) || perturbed_escaped(orbit->z_i[m], orbit->z_i_lo[m], d_i)) {
+            *escaped_r = orbit->z_r[m] + d_r;
+            *escaped_i = orbit->z_i[m] + d_i;
+            return i;
+        }
+        double z_r = orbit->z_r[m] + d_r;
+        double z_i = orbit->z_i[m] + d_i;
+        if (m == orbit->length || z_r * z_r + z_i * z_i < d_r * d_r + d_i * d_i) { // rebase
+            d_r = z_r;
+            d_i = z_i;
+            m = 0;
+        }
+    }
+    return -2;
+}
+
+
+static int perturb_point(const struct reference_orbit* orbit, double dc_r, double dc_i) {
+    /* the pixel value of a deep point at offset dc from the reference orbit, as mandelbrot_point */
+    double z_r, z_i;
+    int i = perturb_escape_time(orbit, dc_r, dc_i, MAX_ITERATIONS, &z_r, &z_i);
+    return i < 0 ? 0 : 0xFF - i;
+}
+
+
+static void mandelbrot_row(const struct tile_view* view, unsigned int y, unsigned int start, unsigned int n, png_byte* row, struct kernel_stats* stats) {
+    /* render n pixels of row y of a tile, starting at column start. Tiles shallow enough for double precision go
+    through the vector kernel, deeper tiles are rendered by perturbation. y may be IMAGE_SIZE, the first row of the
+    next tile */
+    if (view->z <= DOUBLE_MAX_DEPTH) {
+        row_kernel(row, view->start_x + view->step * start, view->start_y + view->step * y, view->step, 0, n, stats);
+        return;
+    }
+    for (unsigned int x = 0; x < n; x++) {
+        row[x] = perturb_point(&view->orbit, view->step * ((int)(start + x) - IMAGE_SIZE/2), view->step * ((int)y - IMAGE_SIZE/2));
+    }
+}
+
+
+static void mandelbrot_column(const struct tile_view* view, unsigned int x, unsigned int start, unsigned int n, png_byte* column, struct kernel_stats* stats) {
+    /* render n pixels of column x of a tile into the contiguous buffer column, starting at row start, for the
+    columns traced by subdivision. x may be IMAGE_SIZE, the first column of the next tile */
+    if (view->z <= DOUBLE_MAX_DEPTH) {
+        row_kernel(column, view->start_x + view->step * x, view->start_y + view->step * start, 0, view->step, n, stats);
+        return;
+    }
+    for (unsigned int y = 0; y < n; y++) {
+        column[y] = perturb_point(&view->orbit, view->step * ((int)x - IMAGE_SIZE/2), view->step * ((int)(start + y) - IMAGE_SIZE/2));
+    }
+}
+
+
+static int uniform_border(png_byte pixels[IMAGE_SIZE][IMAGE_SIZE], unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1) {
+    /* test whether every pixel on the border of the rectangle from (x0, y0) to (x1, y1) inclusive has the same value */
+    png_byte value = pixels[y0][x0];
+    for (unsigned int x = x0; x <= x1; x++) {
+        if (pixels[y0][x] != value || pixels[y1][x] != value) return 0;
+    }
+    for (unsigned int y = y0; y <= y1; y++) {
+        if (pixels[y][x0] != value || pixels[y][x1] != value) return 0;
+    }
+    return 1;
+}
+
+
+static int cancelled(const struct tile_view* view) {
+    /* test whether the render of a tile has been abandoned */
+    return view->cancel && atomic_load_explicit(view->cancel, memory_order_relaxed);
+}
+
+
+static void subdivide(const struct tile_view* view, png_byte pixels[IMAGE_SIZE][IMAGE_SIZE], unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, struct kernel_stats* stats) {
+    /* Mariani-Silver subdivision of the rectangle from (x0, y0) to (x1, y1), whose border is already rendered.
+    The set is connected, so a rectangle with a uniform border can be filled without rendering its inside.
+    Otherwise the rectangle is cut into quarters by rendering a row and a column through its middle */
+    if (x1 - x0 < 2 || y1 - y0 < 2 || cancelled(view)) return;
+    if (uniform_border(pixels, x0, y0, x1, y1)) {
+        for (unsigned int y = y0 + 1; y < y1; y++) {
+            memset(&pixels[y][x0+1], pixels[y0][x0], x1 - x0 - 1);
+        }
+        stats->filled += (uint64_t)(x1 - x0 - 1) * (y1 - y0 - 1);
+        return;
+    }
+    if (x1 - x0 <= SUBDIVIDE_MIN_SIZE || y1 - y0 <= SUBDIVIDE_MIN_SIZE) {
+        for (unsigned int y = y0 + 1; y < y1; y++) {
+            mandelbrot_row(view, y, x0 + 1, x1 - x0 - 1, &pixels[y][x0+1], stats);
+        }
+        return;
+    }
+    unsigned int xm = (x0 + x1) / 2;
+    unsigned int ym = (y0 + y1) / 2;
+    png_byte column[IMAGE_SIZE];
+    mandelbrot_row(view, ym, x0 + 1, x1 - x0 - 1, &pixels[ym][x0+1], stats);
+    mandelbrot_column(view, xm, y0 + 1, y1 - y0 - 1, column, stats);
+    for (unsigned int y = y0 + 1; y < y1; y++) {
+        pixels[y][xm] = column[y - y0 - 1];
+    }
+    subdivide(view, pixels, x0, y0, xm, ym, stats);
+    subdivide(view, pixels, xm, y0, x1, ym, stats);
+    subdivide(view, pixels, x0, ym, xm, y1, stats);
+    subdivide(view, pixels, xm, ym, x1, y1, stats);
+}
+
+
+static int compute_tile(const struct tile_view* view, png_byte pixels[IMAGE_SIZE][IMAGE_SIZE], int use_subdivision, struct kernel_stats* stats) {
+    /* render every pixel of a tile, row by row or by subdivision. Returns 1 when subdivision proves the whole
+    closed square of the tile, up to the first row and column of its neighbours, lies inside the set: every
+    tile below it in the quadtree is then solid as well. Returns -1 if the render was cancelled */
+    if (!use_subdivision) {
+        for (unsigned int y = 0; y < IMAGE_SIZE; y++) {
+            if (cancelled(view)) return -1;
+            mandelbrot_row(view, y, 0, IMAGE_SIZE, pixels[y], stats);
+        }
+        return 0;
+    }
+    mandelbrot_row(view, 0, 0, IMAGE_SIZE, pixels[0], stats);
+    mandelbrot_row(view, IMAGE_SIZE - 1, 0, IMAGE_SIZE, pixels[IMAGE_SIZE-1], stats);
+    png_byte left[IMAGE_SIZE], right[IMAGE_SIZE];
+    mandelbrot_column(view, 0, 1, IMAGE_SIZE - 2, left, stats);
+    mandelbrot_column(view, IMAGE_SIZE - 1, 1, IMAGE_SIZE - 2, right, stats);
+    for (unsigned int y = 1; y < IMAGE_SIZE - 1; y++) {
+        pixels[y][0] = left[y-1];
+        pixels[y][IMAGE_SIZE-1] = right[y-1];
+    }
+    int solid = 0;
+    if (pixels[0][0] == 0 && uniform_border(pixels, 0, 0, IMAGE_SIZE - 1, IMAGE_SIZE - 1)) {
+        png_byte bottom[IMAGE_SIZE + 1], edge[IMAGE_SIZE];
+        mandelbrot_row(view, IMAGE_SIZE, 0, IMAGE_SIZE + 1, bottom, stats);
+        mandelbrot_column(view, IMAGE_SIZE, 0, IMAGE_SIZE, edge, stats);
+        solid = 1;
+        for (unsigned int i = 0; i < IMAGE_SIZE; i++) {
+            if (bottom[i] || edge[i]) solid = 0;
+        }
+        if (bottom[IMAGE_SIZE]) solid = 0;
+    }
+    subdivide(view, pixels, 0, 0, IMAGE_SIZE - 1, IMAGE_SIZE - 1, stats);
+    return cancelled(view) ? -1 : solid;
+}
+
+
+static uint32_t jitter_hash(uint32_t value) {
+    /* mix the bits of value (the finaliser of murmur3), so that jitter is random looking but the same on every run */
+    value ^= value >> 16;
+    value *= 0x85EBCA6B;
+    value ^= value >> 13;
+    value *= 0xC2B2AE35;
+    return value ^ (value >> 16);
+}
+
+
+static void sample_run(const struct tile_view* view, double x, double y, unsigned int n, png_byte* out, struct kernel_stats* stats) {
+    /* render n points a pixel apart along a row, starting at fractional pixel coordinates (x, y) of a tile */
+    if (view->z <= DOUBLE_MAX_DEPTH) {
+        row_kernel(out, view->start_x + view->step * x, view->start_y + view->step * y, view->step, 0, n, stats);
+        return;
+    }
+    for (unsigned int i = 0; i < n; i++) {
+        out[i] = perturb_point(&view->orbit, view->step * (x + i - IMAGE_SIZE/2), view->step * (y - IMAGE_SIZE/2));
+    }
+}
+
+
+static void antialias_tile(const struct tile_view* view, png_byte pixels[IMAGE_SIZE][IMAGE_SIZE], unsigned int samples, struct kernel_stats* stats) {
+    /* refine the pixels on edges, those differing sharply from a neighbour, by averaging them with samples more
+    points jittered across the pixel. Samples are stratified over a grid of cells, one each, and taken for a run
+    of nearby edge pixels at once so they go through the vector kernel. The jitter is seeded by the run, so a
+    tile always renders the same. Flat areas, most of a tile, cost nothing more */
+    uint64_t edges[IMAGE_SIZE][IMAGE_SIZE / 64] = {{0}};
+    for (unsigned int y = 0; y < IMAGE_SIZE; y++) {
+        for (unsigned int x = 0; x < IMAGE_SIZE; x++) {
+            int value = pixels[y][x];
+            if (x + 1 < IMAGE_SIZE && abs(value - pixels[y][x+1]) > ANTIALIAS_THRESHOLD) {
+                edges[y][x / 64] |= 1ULL << (x % 64);
+                edges[y][(x+1) / 64] |= 1ULL << ((x+1) % 64);
+            }
+            if (y + 1 < IMAGE_SIZE && abs(value - pixels[y+1][x]) > ANTIALIAS_THRESHOLD) {
+                edges[y][x / 64] |= 1ULL << (x % 64);
+                edges[y+1][x / 64] |= 1ULL << (x % 64);
+            }
+        }
+    }
+    unsigned int cells = 1;
+    while (cells * cells < samples) cells++;
+    unsigned int sums[IMAGE_SIZE];
+    png_byte values[IMAGE_SIZE];
+    for (unsigned int y = 0; y < IMAGE_SIZE; y++) {
+        if (cancelled(view)) return;
+        unsigned int x = 0;
+        while (x < IMAGE_SIZE) {
+            if (!(edges[y][x / 64] & (1ULL << (x % 64)))) {
+                x++;
+                continue;
+            }
+            unsigned int start = x, end = x + 1;
+            for (; x < IMAGE_SIZE && x < end + ANTIALIAS_RUN_GAP; x++) {
+                if (edges[y][x / 64] & (1ULL << (x % 64))) end = x + 1;
+            }
+            x = end;
+            unsigned int n = end - start;
+            for (unsigned int i = 0; i < n; i++) sums[i] = pixels[y][start + i];
+            uint32_t seed = jitter_hash(y * IMAGE_SIZE + start);
+            for (unsigned int s = 0; s < samples; s++) {
+                double offset_x = ((s % cells) + jitter_hash(seed + 2*s) * 0x1p-32) / cells - 0.5;
+                double offset_y = ((s / cells) + jitter_hash(seed + 2*s + 1) * 0x1p-32) / cells - 0.5;
+                sample_run(view, start + offset_x, y + offset_y, n, values, stats);
+                for (unsigned int i = 0; i < n; i++) sums[i] += values[i];
+            }
+            for (unsigned int i = start; i < end; i++) {
+                if (!(edges[y][i / 64] & (1ULL << (i % 64)))) continue; // sampled only to fill the run
+                pixels[y][i] = (sums[i - start] + (samples + 1) / 2) / (samples + 1);
+                stats->refined++;
+            }
+        }
+    }
+}
+
+
+static void* arena_alloc(struct tile_encoder* encoder, size_t size) {
+    /* carve a block out of the encoder's arena. Once the arena is used up the heap takes over for the rest of
+    the tile, and the arena is grown to fit before the next one */
+    size_t start = (encoder->arena_used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    encoder->arena_used = start + size;
+    if (encoder->arena_used <= encoder->arena_size) return encoder->arena + start;
+    return malloc(size);
+}
+
+
+static void arena_release(struct tile_encoder* encoder, void* ptr) {
+    /* free a block from arena_alloc. Arena blocks are all released at once when the next tile starts */
+    unsigned char* block = ptr;
+    if (block < encoder->arena || block >= encoder->arena + encoder->arena_size) free(ptr);
+}
+
+
+static void arena_begin(struct tile_encoder* encoder) {
+    /* grow the arena to what the largest tile so far has needed, and empty it for the next tile */
+    if (encoder->arena_needed > encoder->arena_size) {
+        unsigned char* arena = realloc(encoder->arena, encoder->arena_needed);
+        if (arena) {
+            encoder->arena = arena;
+            encoder->arena_size = encoder->arena_needed;
+        }
+    }
+    encoder->arena_used = 0;
+}
+
+
+static void arena_end(struct tile_encoder* encoder) {
+    /* note how much of the arena a tile needed */
+    if (encoder->arena_used > encoder->arena_needed) encoder->arena_needed = encoder->arena_used;
+}
+
+
+static png_voidp arena_malloc(png_structp png_ptr, png_alloc_size_t size) {
+    /* libpng and zlib allocation callback for PNG tiles */
+    return arena_alloc(png_get_mem_ptr(png_ptr), size);
+}
+
+
+static void arena_free(png_structp png_ptr, png_voidp ptr) {
+    /* libpng and zlib free callback for PNG tiles */
+    arena_release(png_get_mem_ptr(png_ptr), ptr);
+}
+
+
+static voidpf arena_zalloc(voidpf opaque, uInt items, uInt size) {
+    /* zlib allocation callback for raw tiles */
+    return arena_alloc(opaque, (size_t)items * size);
+}
+
+
+static void arena_zfree(voidpf opaque, voidpf ptr) {
+    /* zlib free callback for raw tiles */
+    arena_release(opaque, ptr);
+}
+
+
+static int lookup_name(const char* const names[], const int values[], unsigned int count, const char* name) {
+    /* the value paired with name, or -1 if it is not one of the names */
+    for (unsigned int i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) return values[i];
+    }
+    return -1;
+}
+
+
+int encoder_strategy_from_name(const char* name) {
+    /* the zlib strategy called name, one of default, filtered, huffman, rle or fixed. Returns -1 for any other name */
+    static const char* const names[] = {"default", "filtered", "huffman", "rle", "fixed"};
+    static const int values[] = {Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED};
+    return lookup_name(names, values, sizeof(values) / sizeof(values[0]), name);
+}
+
+
+int encoder_filters_from_name(const char* name) {
+    /* the PNG row filters called name, one of none, sub, up, average, paeth or all. Returns -1 for any other name */
+    static const char* const names[] = {"none", "sub", "up", "average", "paeth", "all"};
+    static const int values[] = {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH, PNG_ALL_FILTERS};
+    return lookup_name(names, values, sizeof(values) / sizeof(values[0]), name);
+}
+
+
+void tile_encoder_init(struct tile_encoder* encoder) {
+    /* set up an encoder with libpng's default compression and an empty arena, which is sized by the first tile */
+    *encoder = (struct tile_encoder){.level = ENCODER_DEFAULT_LEVEL, .strategy = Z_FILTERED, .filters = PNG_ALL_FILTERS};
+}
+
+
+void tile_encoder_free(struct tile_encoder* encoder) {
+    /* release the arena of an encoder */
+    free(encoder->arena);
+    encoder->arena = NULL;
+    encoder->arena_size = 0;
+}
+
+
+static int buffer_write(void* target, const void* data, size_t length) {
+    /* sink callback appending to a growable buffer */
+    struct png_buffer* buffer = target;
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < buffer->length + length) capacity *= 2;
+        png_byte* grown = realloc(buffer->data, capacity);
+        if (grown == NULL) return -1;
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 0;
+}
+
+
+static int file_write(void* target, const void* data, size_t length) {
+    /* sink callback writing to a stdio stream */
+    return fwrite(data, 1, length, target) == length ? 0 : -1;
+}
+
+
+struct tile_sink tile_sink_buffer(struct png_buffer* buffer) {
+    /* a sink appending to buffer, which keeps its capacity between tiles */
+    return (struct tile_sink){buffer_write, buffer};
+}
+
+
+struct tile_sink tile_sink_file(FILE* file) {
+    /* a sink writing to an open file */
+    return (struct tile_sink){file_write, file};
+}
+
+
+static void sink_write(png_structp png_ptr, png_bytep data, png_size_t length) {
+    /* libpng write callback passing encoded bytes to the sink */
+    struct tile_sink* sink = png_get_io_ptr(png_ptr);
+    if (sink->write(sink->target, data, length)) png_error(png_ptr, "unable to write encoded tile");
+}
+
+
+static void sink_flush(png_structp png_ptr) {
+    /* libpng flush callback, sinks are flushed by their owners */
+}
+
+
+int encode_tile(struct tile_encoder* encoder, struct tile_sink sink, png_byte pixels[IMAGE_SIZE][IMAGE_SIZE]) {
+    /* encode a square png image IMAGE_SIZE pixels in width, row by row, into sink. libpng and zlib allocate from
+    the encoder's arena, so once it has grown to fit a tile, encoding makes no heap allocations */
+    arena_begin(encoder);
+    png_structp png_ptr = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL, encoder, arena_malloc, arena_free);
+    if (png_ptr == NULL) { // creating write struct failed
+        fprintf(stderr, "Error: Unable to initialise PNG image\n");
+        return -1;
+    }
+    png_infop png_info = png_create_info_struct(png_ptr);
+    if (png_info == NULL || setjmp(png_jmpbuf(png_ptr))) { // creating info struct or writing failed
+        png_destroy_write_struct(&png_ptr, &png_info);
+        arena_end(encoder);
+        fprintf(stderr, "Error: Unable to encode PNG image\n");
+        return -1;
+    }
+    // Set header
+    png_set_IHDR(
+        png_ptr,
+        png_info,
+        IMAGE_SIZE,
+        IMAGE_SIZE,
+        IMAGE_BIT_DEPTH,
+        PNG_COLOR_TYPE_GRAY,
+        PNG_INTERLACE_NONE,
+        PNG_COMPRESSION_TYPE_DEFAULT,
+        PNG_FILTER_TYPE_DEFAULT
+    );
+    png_set_compression_level(png_ptr, encoder->level);
+    png_set_compression_strategy(png_ptr, encoder->strategy);
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, encoder->filters);
+    png_set_write_fn(png_ptr, &sink, sink_write, sink_flush);
+
+    // write png
+    png_write_info(png_ptr, png_info);
+    for (unsigned int row = 0; row < IMAGE_SIZE; row++) {
+        png_write_row(png_ptr, pixels[row]);
+    }
+    png_write_end(png_ptr, png_info);
+    png_destroy_write_struct(&png_ptr, &png_info);
+    arena_end(encoder);
+    return 0;
+}
+
+
+int decode_tile(const char* filename, png_byte pixels[IMAGE_SIZE][IMAGE_SIZE]) {
+    /* read back a tile written by encode_tile into pixels. Returns -1 if the file is missing or is not a
+    tile IMAGE_SIZE pixels across */
+    png_image image = {.version = PNG_IMAGE_VERSION};
+    if (png_image_begin_read_from_file(&image, filename) == 0) return -1;
+    if (image.width != IMAGE_SIZE || image.height != IMAGE_SIZE) {
+        png_image_free(&image);
+        return -1;
+    }
+    image.format = PNG_FORMAT_GRAY;
+    return png_image_finish_read(&image, NULL, pixels, IMAGE_SIZE, NULL) ? 0 : -1;
+}
+
+
+int render_tile(png_byte pixels[IMAGE_SIZE][IMAGE_SIZE], unsigned int z, uint64_t x, uint64_t y, int use_subdivision, unsigned int samples, _Atomic int* cancel, struct kernel_stats* stats) {
+    /* render tile (x, y) of zoom level z into pixels, by Mariani-Silver subdivision if use_subdivision is set, then
+    anti-alias its edges with samples extra samples per pixel unless samples is 0. Returns 1 when subdivision proves
+    the tile and everything below it to be inside the set. cancel may be NULL, otherwise the render is abandoned,
+    returning -1, soon after another thread sets it */
+    struct tile_view view;
+    view.cancel = cancel;
+    tile_view_init(&view, z, x, y);
+    int result = compute_tile(&view, pixels, use_subdivision, stats);
+    if (result == 0 && samples) {
+        antialias_tile(&view, pixels, samples, stats);
+        if (cancelled(&view)) return -1;
+    }
+    return result;
+}
+
+
+void downsample_tile(png_byte parent[IMAGE_SIZE][IMAGE_SIZE], unsigned int quadrant_x, unsigned int quadrant_y, png_byte child[IMAGE_SIZE][IMAGE_SIZE], int filter) {
+    /* reduce each 2x2 block of child to one pixel of the quadrant of parent it covers. The inner loops are
+    plain enough for the compiler to vectorise */
+    for (unsigned int y = 0; y < IMAGE_SIZE / 2; y++) {
+        const png_byte* top = child[2*y];
+        const png_byte* bottom = child[2*y+1];
+        png_byte* out = parent[quadrant_y * IMAGE_SIZE / 2 + y] + quadrant_x * IMAGE_SIZE / 2;
+        if (filter == DOWNSAMPLE_MIN) {
+            for (unsigned int x = 0; x < IMAGE_SIZE / 2; x++) {
+                png_byte left = top[2*x] < bottom[2*x] ? top[2*x] : bottom[2*x];
+                png_byte right = top[2*x+1] < bottom[2*x+1] ? top[2*x+1] : bottom[2*x+1];
+                out[x] = left < right ? left : right;
+            }
+        } else {
+            for (unsigned int x = 0; x < IMAGE_SIZE / 2; x++) {
+                out[x] = (top[2*x] + top[2*x+1] + bottom[2*x] + bottom[2*x+1] + 2) >> 2;
+            }
+        }
+    }
+}
+
+
+int downsample_filter_from_name(const char* name) {
+    /* the downsampling filter called name, box or min. Returns -1 for any other name */
+    static const char* const names[] = {"box", "min"};
+    static const int values[] = {DOWNSAMPLE_BOX, DOWNSAMPLE_MIN};
+    return lookup_name(names, values, sizeof(values) / sizeof(values[0]), name);
+}
+
+
+static uint16_t smooth_value(int i, double z_r, double z_i, double c_r, double c_i) {
+    /* the raw value of a point that left the escape square on iteration i at z, or of a point inside the set when
+    i is -1. The orbit is followed on out to SMOOTH_BAILOUT, beyond which each iteration adds one to log2 log |z|,
+    so subtracting that leaves an iteration count that varies smoothly across the bands of the set. Measuring
+    log |z| against log MANDELBROT_BOUND keeps it within one of the escape count the PNG tiles are coloured by */
+    if (i < 0) return 0;
+    double modulus = z_r * z_r + z_i * z_i;
+    while (modulus < SMOOTH_BAILOUT * SMOOTH_BAILOUT) {
+        double x_r = z_r * z_r - z_i * z_i + c_r;
+        z_i = 2 * z_r * z_i + c_i;
+        z_r = x_r;
+        modulus = z_r * z_r + z_i * z_i;
+        i++;
+    }
+    double smooth = i + 1 - log2(log(modulus) / (2 * log(MANDELBROT_BOUND)));
+    double value = 1 + round(smooth * (1 << RAW_FRACTION_BITS));
+    return value < 1 ? 1 : value > UINT16_MAX ? UINT16_MAX : value;
+}
+
+
+int render_raw_tile(uint16_t values[IMAGE_SIZE][IMAGE_SIZE], unsigned int z, uint64_t x, uint64_t y, unsigned int max_iterations, int deepen,
+    _Atomic int* cancel, struct kernel_stats* stats) {
+    /* render tile (x, y) of zoom level z as smooth iteration counts, giving each point up to max_iterations and
+    sampling the same points as render_tile. The vector kernels only keep the 8-bit count, so raw tiles go through
+    the scalar kernel. When deepen is set, values already holds the tile rendered with a smaller budget, and only
+    its points inside the set are iterated again, since the value of a point that escaped never depends on the
+    budget. Returns the number of points still bounded when the budget ran out, which a larger one could change,
+    or -1 if cancelled */
+    struct tile_view view;
+    view.cancel = cancel;
+    tile_view_init(&view, z, x, y);
+    double epsilon = view.step * PERIODICITY_EPSILON;
+    int capped = 0;
+    for (unsigned int row = 0; row < IMAGE_SIZE; row++) {
+        if (cancelled(&view)) return -1;
+        for (unsigned int column = 0; column < IMAGE_SIZE; column++) {
+            if (deepen && values[row][column]) continue;
+            double z_r = 0, z_i = 0, c_r, c_i;
+            int i;
+            if (z <= DOUBLE_MAX_DEPTH) {
+                c_r = view.start_x + view.step * column;
+                c_i = view.start_y + view.step * row;
+                i = escape_time(c_r, c_i, epsilon, max_iterations, stats, &z_r, &z_i);
+            } else { // past the escape square the orbit no longer needs the reference, and c is Z_1 + dc
+                double dc_r = view.step * ((int)column - IMAGE_SIZE/2), dc_i = view.step * ((int)row - IMAGE_SIZE/2);
+                c_r = view.orbit.z_r[1] + dc_r;
+                c_i = view.orbit.z_i[1] + dc_i;
+                i = perturb_escape_time(&view.orbit, dc_r, dc_i, max_iterations, &z_r, &z_i);
+            }
+            capped += i == -2;
+            values[row][column] = smooth_value(i, z_r, z_i, c_r, c_i);
+        }
+    }
+    stats->capped += capped;
+    return capped;
+}
+
+
+static uint16_t predict_value(uint16_t left, uint16_t up, uint16_t up_left) {
+    /* the median edge detector of LOCO-I: the smaller of left and up above a rising edge, the larger below a
+    falling one, and otherwise the plane through the three neighbours */
+    uint16_t low = left < up ? left : up;
+    uint16_t high = left < up ? up : left;
+    if (up_left >= high) return low;
+    if (up_left <= low) return high;
+    return left + up - up_left;
+}
+
+
+int encode_raw_tile(struct tile_encoder* encoder, struct tile_sink sink, uint16_t values[IMAGE_SIZE][IMAGE_SIZE]) {
+    /* encode a raw tile into sink: a RAW_HEADER_SIZE byte header, then a zlib stream of the residuals of each value
+    from its prediction, zigzagged so small negatives are small too, and split into a plane of high bytes followed
+    by a plane of low bytes. Smooth counts change slowly, so the high plane is almost all zeroes. The residuals
+    are mostly runs of small values, for which Z_RLE is both the fastest strategy and about the smallest, so only
+    the encoder's level is used. Allocates from the encoder's arena, like encode_tile */
+    arena_begin(encoder);
+    unsigned char header[RAW_HEADER_SIZE] = {RAW_MAGIC[0], RAW_MAGIC[1], RAW_MAGIC[2], RAW_MAGIC[3], RAW_VERSION, RAW_FRACTION_BITS,
+        IMAGE_SIZE & 0xFF, IMAGE_SIZE >> 8};
+    unsigned char* planes = arena_alloc(encoder, 2 * IMAGE_SIZE * IMAGE_SIZE);
+    int code = -1;
+    z_stream stream = {.zalloc = arena_zalloc, .zfree = arena_zfree, .opaque = encoder};
+    if (planes == NULL || sink.write(sink.target, header, sizeof(header))) goto done;
+    for (unsigned int row = 0; row < IMAGE_SIZE; row++) {
+        for (unsigned int column = 0; column < IMAGE_SIZE; column++) {
+            uint16_t prediction;
+            if (row == 0) prediction = column ? values[0][column-1] : 0;
+            else if (column == 0) prediction = values[row-1][0];
+            else prediction = predict_value(values[row][column-1], values[row-1][column], values[row-1][column-1]);
+            int16_t residual = (int16_t)(values[row][column] - prediction);
+            uint16_t zigzag = ((uint16_t)residual << 1) ^ (uint16_t)(residual >> 15);
+            planes[row * IMAGE_SIZE + column] = zigzag >> 8;
+            planes[IMAGE_SIZE * IMAGE_SIZE + row * IMAGE_SIZE + column] = zigzag & 0xFF;
+        }
+    }
+    if (deflateInit2(&stream, encoder->level, Z_DEFLATED, MAX_WBITS, 8, Z_RLE) != Z_OK) goto done;
+    stream.next_in = planes;
+    stream.avail_in = 2 * IMAGE_SIZE * IMAGE_SIZE;
+    unsigned char out[16384];
+    int status;
+    do {
+        stream.next_out = out;
+        stream.avail_out = sizeof(out);
+        status = deflate(&stream, Z_FINISH);
+        if (status == Z_STREAM_ERROR || sink.write(sink.target, out, sizeof(out) - stream.avail_out)) break;
+    } while (status != Z_STREAM_END);
+    if (status == Z_STREAM_END) code = 0;
+    deflateEnd(&stream);
+done:
+    arena_release(encoder, planes);
+    arena_end(encoder);
+    if (code) fprintf(stderr, "Error: Unable to encode raw tile\n");
+    return code;
+}
+
+
+int decode_raw_tile(const char* filename, uint16_t values[IMAGE_SIZE][IMAGE_SIZE]) {
+    /* read back a tile written by encode_raw_tile into values, undoing its prediction. Returns -1 if the file is
+    missing or is not a raw tile IMAGE_SIZE values across with RAW_FRACTION_BITS fraction bits */
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) return -1;
+    unsigned char header[RAW_HEADER_SIZE];
+    unsigned char* planes = malloc(2 * IMAGE_SIZE * IMAGE_SIZE);
+    unsigned char in[16384];
+    z_stream stream = {0};
+    int status = Z_DATA_ERROR;
+    if (planes == NULL || fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, RAW_MAGIC, 4)
+        || header[4] != RAW_VERSION || header[5] != RAW_FRACTION_BITS || (header[6] | header[7] << 8) != IMAGE_SIZE
+        || inflateInit(&stream) != Z_OK) {
+        fclose(file);
+        free(planes);
+        return -1;
+    }
+    stream.next_out = planes;
+    stream.avail_out = 2 * IMAGE_SIZE * IMAGE_SIZE;
+    do {
+        if (stream.avail_in == 0) {
+            stream.next_in = in;
+            stream.avail_in = fread(in, 1, sizeof(in), file);
+            if (stream.avail_in == 0) break;
+        }
+        status = inflate(&stream, Z_NO_FLUSH);
+    } while (status == Z_OK);
+    inflateEnd(&stream);
+    fclose(file);
+    if (status != Z_STREAM_END || stream.avail_out) {
+        free(planes);
+        return -1;
+    }
+    for (unsigned int row = 0; row < IMAGE_SIZE; row++) {
+        for (unsigned int column = 0; column < IMAGE_SIZE; column++) {
+            uint16_t prediction;
+            if (row == 0) prediction = column ? values[0][column-1] : 0;
+            else if (column == 0) prediction = values[row-1][0];
+            else prediction = predict_value(values[row][column-1], values[row-1][column], values[row-1][column-1]);
+            uint16_t zigzag = planes[row * IMAGE_SIZE + column] << 8 | planes[IMAGE_SIZE * IMAGE_SIZE + row * IMAGE_SIZE + column];
+            values[row][column] = prediction + (uint16_t)((zigzag >> 1) ^ -(zigzag & 1));
+        }
+    }
+    free(planes);
+    return 0;
+}
+
+
+int tile_format_from_name(const char* name) {
+    /* the tile format called name, png or raw. Returns -1 for any other name */
+    static const char* const names[] = {"png", "raw"};
+    static const int values[] = {TILE_PNG, TILE_RAW};
+    return lookup_name(names, values, sizeof(values) / sizeof(values[0]), name);
+}
+
+
+const char* tile_format_extension(int format) {
+    /* the file extension of tiles in a format, which is also its name */
+    return format == TILE_RAW ? "raw" : "png";
+}
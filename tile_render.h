@@ -0,0 +1,110 @@
+/* Header file for tile_render.c, the renderer shared by the tile generator and the tile server
+    Author: Max Croucher
+    Email: mpccroucher@gmail.com
+    July 2025
+*/
+
+#ifndef TILE_RENDER_H
+#define TILE_RENDER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <png.h>
+
+#define IMAGE_SIZE 256
+#define IMAGE_BIT_DEPTH 8
+#define IMAGE_BYTES (((IMAGE_SIZE*IMAGE_BIT_DEPTH)+7)/8) // guarantees rounding up if IMAGE_SIZE is not divisible by 8
+
+#define MAX_ITERATIONS 256
+#define MANDELBROT_BOUND 2
+#define MAX_DEPTH 58 // enables a 58-bit index and a 6-bit depth (6 bits are required to encode 58) as a single 64-bit value
+#define DOUBLE_MAX_DEPTH 34 // deepest zoom level at which a double still resolves each pixel with ~10 bits to spare
+#define PERIODICITY_EPSILON (1.0 / 1024) // fraction of a pixel within which an orbit returning to a saved point is taken as a cycle
+#define SUBDIVIDE_MIN_SIZE 16 // rectangles this narrow are rendered outright rather than subdivided further
+#define ANTIALIAS_THRESHOLD 16 // a pixel whose value differs from a neighbour's by more than this is on an edge and refined
+#define ANTIALIAS_DEFAULT_SAMPLES 8 // extra samples taken in each refined pixel
+#define ANTIALIAS_MAX_SAMPLES 64
+#define ENCODER_DEFAULT_LEVEL 6 // zlib compression level, libpng's own default
+#define RAW_MAGIC "MRAW" // first bytes of a raw tile
+#define RAW_VERSION 1
+#define RAW_HEADER_SIZE 8 // magic, version, fraction bits and the tile size as a little endian 16-bit value
+#define RAW_FRACTION_BITS 4 // raw values are smooth iteration counts in 12.4 fixed point, plus one so 0 is inside the set
+#define SMOOTH_BAILOUT 256.0 // radius an escaped orbit is followed out to before its fractional iteration count is taken
+#define RAW_MAX_ITERATIONS 4094 // largest iteration budget of a raw tile whose smooth counts still fit its 16-bit values
+
+#define MIN_X -2.0
+#define MIN_Y -1.25
+#define BASE_RANGE_X 2.5
+#define BASE_RANGE_Y 2.5
+
+struct png_buffer {
+    png_byte* data;
+    size_t length;
+    size_t capacity;
+};
+
+struct tile_sink {
+    int (*write)(void* target, const void* data, size_t length); // returns 0 once every byte is written
+    void* target;
+}; // where an encoder sends the bytes of a tile
+
+struct tile_encoder {
+    unsigned char* arena; // memory libpng and zlib allocate from, reused for every tile
+    size_t arena_size;
+    size_t arena_used;
+    size_t arena_needed; // most memory a tile has needed, the size the arena grows to
+    int level; // zlib compression level, 0 to 9
+    int strategy; // zlib strategy, such as Z_FILTERED or Z_RLE
+    int filters; // PNG_FILTER_ flags, libpng picking between them for each row
+}; // one per thread, as an encoder encodes a single tile at a time
+
+struct kernel_stats {
+    uint64_t cardioid; // pixels found inside the main cardioid
+    uint64_t bulb; // pixels found inside the period-2 bulb
+    uint64_t periodic; // pixels whose orbit was caught in a cycle
+    uint64_t iterations_saved; // iterations these shortcuts avoided, compared to running to MAX_ITERATIONS
+    uint64_t filled; // pixels filled in by subdivision without being rendered
+    uint64_t solid_tiles; // tiles emitted without rendering because an ancestor was proven inside the set
+    uint64_t duplicates; // tiles emitted as a link to an identical tile instead of being encoded
+    uint64_t refined; // edge pixels anti-aliased with extra samples
+    uint64_t capped; // pixels of raw tiles still bounded when their iteration budget ran out
+};
+
+enum tile_format {
+    TILE_PNG, // 8-bit grayscale PNG of 0xFF less the iteration count, the colour mapping baked in
+    TILE_RAW // smooth 16-bit iteration counts, predicted and deflated, for clients to colour themselves
+};
+
+enum downsample_filter {
+    DOWNSAMPLE_BOX, // average of each 2x2 block, anti-aliasing the parent
+    DOWNSAMPLE_MIN // darkest pixel of each block, keeping thin filaments of the set visible
+}; // how a parent tile is reduced from its four children
+
+typedef void (*row_kernel_t)(png_byte* row, double start_r, double start_i, double step_r, double step_i, unsigned int n, struct kernel_stats* stats);
+
+extern row_kernel_t row_kernel; // widest kernel the CPU supports, once init_kernel has run
+extern const char* row_kernel_name;
+
+
+void init_kernel(void);
+int mandelbrot_point(double c_r, double c_i, double epsilon, struct kernel_stats* stats);
+int render_tile(png_byte pixels[IMAGE_SIZE][IMAGE_SIZE], unsigned int z, uint64_t x, uint64_t y, int use_subdivision, unsigned int samples, _Atomic int* cancel, struct kernel_stats* stats);
+void downsample_tile(png_byte parent[IMAGE_SIZE][IMAGE_SIZE], unsigned int quadrant_x, unsigned int quadrant_y, png_byte child[IMAGE_SIZE][IMAGE_SIZE], int filter);
+int downsample_filter_from_name(const char* name);
+int encoder_strategy_from_name(const char* name);
+int encoder_filters_from_name(const char* name);
+void tile_encoder_init(struct tile_encoder* encoder);
+void tile_encoder_free(struct tile_encoder* encoder);
+struct tile_sink tile_sink_buffer(struct png_buffer* buffer);
+struct tile_sink tile_sink_file(FILE* file);
+int encode_tile(struct tile_encoder* encoder, struct tile_sink sink, png_byte pixels[IMAGE_SIZE][IMAGE_SIZE]);
+int decode_tile(const char* filename, png_byte pixels[IMAGE_SIZE][IMAGE_SIZE]);
+int render_raw_tile(uint16_t values[IMAGE_SIZE][IMAGE_SIZE], unsigned int z, uint64_t x, uint64_t y, unsigned int max_iterations, int deepen,
+    _Atomic int* cancel, struct kernel_stats* stats);
+int decode_raw_tile(const char* filename, uint16_t values[IMAGE_SIZE][IMAGE_SIZE]);
+int encode_raw_tile(struct tile_encoder* encoder, struct tile_sink sink, uint16_t values[IMAGE_SIZE][IMAGE_SIZE]);
+int tile_format_from_name(const char* name);
+const char* tile_format_extension(int format);
+
+#endif
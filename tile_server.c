@@ -0,0 +1,884 @@
+/* Source file for tile_server.c, a multithreaded HTTP server rendering mandelbrot tiles on demand for
+    mandelbrot-live.html. Each connection is served by its own thread, up to a limit past which new connections
+    are refused. Tiles come from a bounded in-memory LRU cache of encoded PNGs, then from tiles pre-rendered
+    under map/, and are otherwise rendered by a fixed pool of workers. Concurrent requests for the same tile
+    share a single render. Tiles are served as coloured PNGs at /{z}/{x}/{y}.png, or as raw smooth iteration
+    counts at /{z}/{x}/{y}.raw for clients that colour them themselves. Pre-rendered tiles may instead come from
+    an archive written by mandelbrot -a, mapped into memory once at startup
+    Author: Max Croucher
+    Email: mpccroucher@gmail.com
+    July 2025
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "tile_archive.h"
+#include "tile_render.h"
+
+#define DEFAULT_PORT 8080
+#define DEFAULT_CACHE_MB 256
+#define CACHE_BUCKETS 65536 // chains in the hash table of cached and pending tiles, a power of two
+#define REQUEST_MAX 8192 // longest request head accepted, in bytes
+#define DEFAULT_MAX_CONNECTIONS 1024 // open connections, each with its own thread, beyond which new ones are refused
+#define IDLE_TIMEOUT 30 // seconds a keep-alive connection may sit idle before it is closed
+#define CACHE_CONTROL "public, max-age=31536000, immutable" // a tile never changes once rendered
+#define PREFETCH_MAX 64 // speculative tiles queued at once, the oldest guesses are dropped first
+#define DISCONNECT_POLL_MS 50 // interval at which a waiting request checks whether its client has gone
+#define STARVATION_MS 250 // a queued request older than this is served before newer ones
+
+enum entry_state {ENTRY_PENDING, ENTRY_READY, ENTRY_FAILED};
+enum entry_queue {QUEUE_NONE, QUEUE_DEMAND, QUEUE_PREFETCH};
+
+struct tile_entry {
+    unsigned int z;
+    uint64_t x;
+    uint64_t y;
+    enum tile_format format;
+    enum entry_state state;
+    struct png_buffer png; // the encoded tile, once state is ENTRY_READY
+    unsigned int refs; // requests holding the entry, plus one while it is in the hash table
+    pthread_cond_t done; // broadcast when the entry stops being pending
+    struct tile_entry* chain; // next entry in the same hash bucket
+    struct tile_entry* newer; // LRU list of ready entries
+    struct tile_entry* older;
+    enum entry_queue queue; // the queue a pending entry is waiting in for a worker
+    size_t slot; // its position in that queue
+    uint64_t priority; // demand entries are rendered most recently requested first
+    double queued_at; // when the entry joined the demand queue, in seconds
+    unsigned int waiters; // requests blocked until a pending entry is finished
+    int prefetched; // queued or rendered speculatively, and not requested since
+    _Atomic int cancel; // set to abandon the render of an entry nobody is waiting for
+};
+
+struct tile_cache {
+    pthread_mutex_t lock;
+    pthread_cond_t work; // signalled when a pending entry is queued for the workers
+    struct tile_entry* buckets[CACHE_BUCKETS];
+    struct tile_entry* newest;
+    struct tile_entry* oldest;
+    struct tile_entry** demand; // max-heap of requested entries by priority
+    size_t demand_length;
+    size_t demand_capacity;
+    struct tile_entry* prefetch[PREFETCH_MAX]; // ring of speculative entries, taken newest first
+    unsigned int prefetch_bottom;
+    unsigned int prefetch_length;
+    uint64_t next_priority;
+    struct tile_entry** running; // entry each worker is rendering, or NULL
+    unsigned int num_workers;
+    unsigned int idle_workers;
+    size_t bytes; // encoded bytes held by ready entries
+    size_t capacity;
+};
+
+struct server_stats {
+    _Atomic uint64_t requests;
+    _Atomic uint64_t cache_hits;
+    _Atomic uint64_t disk_hits;
+    _Atomic uint64_t coalesced; // requests that waited on a render started by another request
+    _Atomic uint64_t rendered;
+    _Atomic uint64_t not_modified;
+    _Atomic uint64_t evicted;
+    _Atomic uint64_t dropped; // queued renders dropped because every client waiting for them disconnected
+    _Atomic uint64_t cancelled; // renders abandoned part way because every client waiting for them disconnected
+    _Atomic uint64_t preempted; // speculative renders abandoned to free a worker for a request
+    _Atomic uint64_t prefetched; // tiles rendered ahead of any request
+    _Atomic uint64_t prefetch_hits; // requests answered by a prefetched tile
+    _Atomic uint64_t refused; // connections turned away because max_connections were already open
+};
+
+char* dirname = "map";
+const char* archive_name = NULL;
+struct tile_archive* archive = NULL; // serves pre-rendered tiles instead of dirname when given
+int use_subdivision = 0;
+unsigned int antialias_samples = 0; // extra samples taken in each edge pixel, 0 for none
+unsigned int raw_iterations = MAX_ITERATIONS; // iteration budget of raw tiles
+struct tile_encoder encoder_options; // compression settings copied into the encoder of every worker
+struct tile_cache cache;
+struct server_stats stats;
+unsigned int max_connections = DEFAULT_MAX_CONNECTIONS;
+_Atomic unsigned int open_connections; // connections with a thread serving them
+volatile sig_atomic_t stopping = 0;
+
+
+static double now(void) {
+    /* monotonic time in seconds */
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+
+static uint64_t bucket_of(unsigned int z, uint64_t x, uint64_t y, enum tile_format format) {
+    /* hash a tile to its bucket in the cache */
+    uint64_t h = (x * 0x9E3779B97F4A7C15ULL) ^ (y * 0xC2B2AE3D27D4EB4FULL) ^ z ^ ((uint64_t)format << 8);
+    return (h ^ (h >> 29)) & (CACHE_BUCKETS - 1);
+}
+
+
+static void entry_release(struct tile_entry* entry) {
+    /* drop a reference to an entry, freeing it with the last one. The cache lock must be held */
+    if (--entry->refs) return;
+    pthread_cond_destroy(&entry->done);
+    free(entry->png.data);
+    free(entry);
+}
+
+
+static void cache_unlink(struct tile_entry* entry) {
+    /* remove an entry from the hash table, and from the LRU list if it is ready. The cache lock must be held */
+    struct tile_entry** link = &cache.buckets[bucket_of(entry->z, entry->x, entry->y, entry->format)];
+    while (*link != entry) link = &(*link)->chain;
+    *link = entry->chain;
+    if (entry->state == ENTRY_READY) {
+        if (entry->newer) entry->newer->older = entry->older; else cache.newest = entry->older;
+        if (entry->older) entry->older->newer = entry->newer; else cache.oldest = entry->newer;
+        cache.bytes -= entry->png.length;
+    }
+    entry_release(entry);
+}
+
+
+static void lru_push(struct tile_entry* entry) {
+    /* make a ready entry the most recently used. The cache lock must be held */
+    entry->older = cache.newest;
+    entry->newer = NULL;
+    if (cache.newest) cache.newest->newer = entry; else cache.oldest = entry;
+    cache.newest = entry;
+}
+
+
+static void lru_touch(struct tile_entry* entry) {
+    /* move a ready entry to the front of the LRU list. The cache lock must be held */
+    if (cache.newest == entry) return;
+    entry->newer->older = entry->older;
+    if (entry->older) entry->older->newer = entry->newer; else cache.oldest = entry->newer;
+    lru_push(entry);
+}
+
+
+static void entry_complete(struct tile_entry* entry, struct png_buffer* png) {
+    /* publish the outcome of a pending entry, taking ownership of png, or marking the entry failed when png is
+    NULL. Ready entries join the cache, evicting the least recently used tiles beyond its capacity. The cache
+    lock must be held */
+    if (png) {
+        entry->png = *png;
+        entry->state = ENTRY_READY;
+        lru_push(entry);
+        cache.bytes += png->length;
+        while (cache.bytes > cache.capacity && cache.oldest != entry) {
+            cache_unlink(cache.oldest);
+            atomic_fetch_add(&stats.evicted, 1);
+        }
+    } else {
+        entry->state = ENTRY_FAILED;
+        cache_unlink(entry);
+    }
+    pthread_cond_broadcast(&entry->done);
+}
+
+
+static void entry_finish(struct tile_entry* entry, struct png_buffer* png) {
+    /* entry_complete, taking the cache lock */
+    pthread_mutex_lock(&cache.lock);
+    entry_complete(entry, png);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+
+static void demand_place(struct tile_entry* entry, size_t slot) {
+    /* store an entry in the demand heap. The cache lock must be held */
+    cache.demand[slot] = entry;
+    entry->slot = slot;
+}
+
+
+static void demand_sift_up(size_t slot) {
+    /* restore the heap order above an entry whose priority has grown */
+    struct tile_entry* entry = cache.demand[slot];
+    while (slot > 0 && cache.demand[(slot - 1) / 2]->priority < entry->priority) {
+        demand_place(cache.demand[(slot - 1) / 2], slot);
+        slot = (slot - 1) / 2;
+    }
+    demand_place(entry, slot);
+}
+
+
+static void demand_sift_down(size_t slot) {
+    /* restore the heap order below an entry */
+    struct tile_entry* entry = cache.demand[slot];
+    while (2 * slot + 1 < cache.demand_length) {
+        size_t child = 2 * slot + 1;
+        if (child + 1 < cache.demand_length && cache.demand[child + 1]->priority > cache.demand[child]->priority) child++;
+        if (cache.demand[child]->priority <= entry->priority) break;
+        demand_place(cache.demand[child], slot);
+        slot = child;
+    }
+    demand_place(entry, slot);
+}
+
+
+static void demand_push(struct tile_entry* entry) {
+    /* queue a requested entry for the workers. The cache lock must be held */
+    if (cache.demand_length == cache.demand_capacity) {
+        size_t capacity = cache.demand_capacity ? 2 * cache.demand_capacity : 256;
+        struct tile_entry** demand = realloc(cache.demand, capacity * sizeof(struct tile_entry*));
+        if (demand == NULL) {
+            entry_complete(entry, NULL);
+            return;
+        }
+        cache.demand = demand;
+        cache.demand_capacity = capacity;
+    }
+    entry->queue = QUEUE_DEMAND;
+    entry->queued_at = now();
+    demand_place(entry, cache.demand_length++);
+    demand_sift_up(entry->slot);
+    pthread_cond_signal(&cache.work);
+
+    // with every worker busy, make room by abandoning a speculative render
+    if (cache.idle_workers) return;
+    for (unsigned int w = 0; w < cache.num_workers; w++) {
+        struct tile_entry* running = cache.running[w];
+        if (running && running->prefetched && !atomic_load(&running->cancel)) {
+            atomic_store(&running->cancel, 1);
+            return;
+        }
+    }
+}
+
+
+static void queue_remove(struct tile_entry* entry) {
+    /* take a pending entry out of the queue it is waiting in. The cache lock must be held */
+    if (entry->queue == QUEUE_DEMAND) {
+        struct tile_entry* last = cache.demand[--cache.demand_length];
+        if (last != entry) {
+            demand_place(last, entry->slot);
+            demand_sift_up(last->slot);
+            demand_sift_down(last->slot);
+        }
+    } else if (entry->queue == QUEUE_PREFETCH) {
+        cache.prefetch[entry->slot] = NULL; // skipped when the ring reaches it
+    }
+    entry->queue = QUEUE_NONE;
+}
+
+
+static void prefetch_push(struct tile_entry* entry) {
+    /* queue a speculative entry, dropping the oldest guess if the ring is full. The cache lock must be held */
+    if (cache.prefetch_length == PREFETCH_MAX) {
+        struct tile_entry* oldest = cache.prefetch[cache.prefetch_bottom];
+        cache.prefetch_bottom = (cache.prefetch_bottom + 1) % PREFETCH_MAX;
+        cache.prefetch_length--;
+        if (oldest) {
+            oldest->queue = QUEUE_NONE;
+            entry_complete(oldest, NULL);
+        }
+    }
+    unsigned int slot = (cache.prefetch_bottom + cache.prefetch_length++) % PREFETCH_MAX;
+    cache.prefetch[slot] = entry;
+    entry->queue = QUEUE_PREFETCH;
+    entry->slot = slot;
+}
+
+
+static struct tile_entry* next_job(void) {
+    /* take the most recently requested entry, or failing that the newest speculative one. Serving the newest
+    request first would let a busy server starve an old one, so a request queued for longer than STARVATION_MS
+    goes first. The queue only holds requests whose clients are still waiting, so it is short enough to scan.
+    The cache lock must be held */
+    if (cache.demand_length) {
+        struct tile_entry* entry = cache.demand[0];
+        double starved = now() - STARVATION_MS * 1e-3;
+        for (size_t slot = 1; slot < cache.demand_length; slot++) {
+            if (cache.demand[slot]->queued_at < entry->queued_at) entry = cache.demand[slot];
+        }
+        if (entry->queued_at > starved) entry = cache.demand[0];
+        queue_remove(entry);
+        return entry;
+    }
+    while (cache.prefetch_length) {
+        struct tile_entry* entry = cache.prefetch[(cache.prefetch_bottom + --cache.prefetch_length) % PREFETCH_MAX];
+        if (entry) {
+            entry->queue = QUEUE_NONE;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+
+static int load_archived_tile(unsigned int z, uint64_t x, uint64_t y, enum tile_format format, struct png_buffer* png) {
+    /* copy a pre-rendered tile out of the mapped archive, if it holds one in the requested format. An archive
+    holds a single format, told apart by the first bytes of each tile */
+    static const unsigned char png_signature[4] = {0x89, 'P', 'N', 'G'};
+    if (z > archive->header->max_zoom) return -1;
+    uint32_t length;
+    const unsigned char* data = tile_archive_lookup(archive, tile_archive_id(z, x, y), &length);
+    if (data == NULL || length < 4 || memcmp(data, format == TILE_RAW ? (const void*)RAW_MAGIC : png_signature, 4)) return -1;
+    if ((png->data = malloc(length)) == NULL) return -1;
+    memcpy(png->data, data, length);
+    png->length = png->capacity = length;
+    return 0;
+}
+
+
+static int load_tile(unsigned int z, uint64_t x, uint64_t y, enum tile_format format, struct png_buffer* png) {
+    /* read a pre-rendered tile from the archive or dirname, if there is one */
+    if (archive) return load_archived_tile(z, x, y, format, png);
+    char tile_name[256];
+    snprintf(tile_name, sizeof(tile_name), "%s/%u/%" PRIu64 "/%" PRIu64 ".%s", dirname, z, x, y, tile_format_extension(format));
+    FILE* file = fopen(tile_name, "rb");
+    if (file == NULL) return -1;
+    struct stat info;
+    if (fstat(fileno(file), &info) || info.st_size <= 0 || (png->data = malloc(info.st_size)) == NULL) {
+        fclose(file);
+        return -1;
+    }
+    png->length = png->capacity = fread(png->data, 1, info.st_size, file);
+    fclose(file);
+    if (png->length != info.st_size) {
+        free(png->data);
+        return -1;
+    }
+    return 0;
+}
+
+
+static int client_gone(int fd) {
+    /* test without blocking whether the client of a connection has closed it */
+    char byte;
+    ssize_t count = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+
+static int wait_for(struct tile_entry* entry, int fd) {
+    /* wait with the cache lock held until a pending entry is finished, making it the newest request. Returns -1 if
+    the client disconnects first. When no one else is waiting for the entry, its render is dropped from the queue,
+    or abandoned if a worker has already started it */
+    entry->waiters++;
+    entry->prefetched = 0;
+    entry->priority = ++cache.next_priority;
+    atomic_store(&entry->cancel, 0);
+    if (entry->queue == QUEUE_PREFETCH) {
+        queue_remove(entry);
+        demand_push(entry);
+    } else if (entry->queue == QUEUE_DEMAND) {
+        demand_sift_up(entry->slot);
+    }
+    while (entry->state == ENTRY_PENDING) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += DISCONNECT_POLL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&entry->done, &cache.lock, &deadline) != ETIMEDOUT || !client_gone(fd)) continue;
+        if (--entry->waiters == 0 && entry->state == ENTRY_PENDING) {
+            if (entry->queue == QUEUE_DEMAND) {
+                queue_remove(entry);
+                entry_complete(entry, NULL);
+                atomic_fetch_add(&stats.dropped, 1);
+            } else {
+                atomic_store(&entry->cancel, 1);
+            }
+        }
+        return -1;
+    }
+    entry->waiters--;
+    return 0;
+}
+
+
+static struct tile_entry* cache_acquire(int fd, unsigned int z, uint64_t x, uint64_t y, enum tile_format format) {
+    /* find the encoded tile (z, x, y) in the given format for the client on fd, loading or rendering it if it is
+    not cached, and return it with a reference held. A request for a tile that is already pending waits for that
+    render instead of starting another. Returns NULL if the client disconnects while waiting */
+    pthread_mutex_lock(&cache.lock);
+    struct tile_entry* entry = cache.buckets[bucket_of(z, x, y, format)];
+    while (entry && (entry->z != z || entry->x != x || entry->y != y || entry->format != format)) entry = entry->chain;
+    if (entry) {
+        entry->refs++;
+        if (entry->state == ENTRY_READY) {
+            lru_touch(entry);
+            atomic_fetch_add(entry->prefetched ? &stats.prefetch_hits : &stats.cache_hits, 1);
+            entry->prefetched = 0;
+        } else if (entry->prefetched) {
+            atomic_fetch_add(&stats.prefetch_hits, 1);
+        } else {
+            atomic_fetch_add(&stats.coalesced, 1);
+        }
+        if (entry->state == ENTRY_PENDING && wait_for(entry, fd)) {
+            entry_release(entry);
+            entry = NULL;
+        }
+        pthread_mutex_unlock(&cache.lock);
+        return entry;
+    }
+
+    // first request for this tile: claim it, then look for it on disk outside the lock
+    entry = calloc(1, sizeof(struct tile_entry));
+    if (entry == NULL) {
+        pthread_mutex_unlock(&cache.lock);
+        return NULL;
+    }
+    *entry = (struct tile_entry){.z = z, .x = x, .y = y, .format = format, .state = ENTRY_PENDING, .refs = 2};
+    pthread_cond_init(&entry->done, NULL);
+    uint64_t bucket = bucket_of(z, x, y, format);
+    entry->chain = cache.buckets[bucket];
+    cache.buckets[bucket] = entry;
+    pthread_mutex_unlock(&cache.lock);
+
+    struct png_buffer png = {0};
+    if (load_tile(z, x, y, format, &png) == 0) {
+        atomic_fetch_add(&stats.disk_hits, 1);
+        entry_finish(entry, &png);
+        return entry;
+    }
+
+    // hand the tile to the workers and wait for it
+    pthread_mutex_lock(&cache.lock);
+    if (entry->state == ENTRY_PENDING && entry->queue == QUEUE_NONE) demand_push(entry);
+    if (entry->state == ENTRY_PENDING && wait_for(entry, fd)) {
+        entry_release(entry);
+        entry = NULL;
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return entry;
+}
+
+
+static void cache_release(struct tile_entry* entry) {
+    /* drop the reference returned by cache_acquire */
+    pthread_mutex_lock(&cache.lock);
+    entry_release(entry);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+
+static void prefetch_candidate(unsigned int z, uint64_t x, uint64_t y, enum tile_format format) {
+    /* queue a speculative render of a tile that is neither cached nor pending. The cache lock must be held */
+    uint64_t bucket = bucket_of(z, x, y, format);
+    for (struct tile_entry* entry = cache.buckets[bucket]; entry; entry = entry->chain) {
+        if (entry->z == z && entry->x == x && entry->y == y && entry->format == format) return;
+    }
+    struct tile_entry* entry = calloc(1, sizeof(struct tile_entry));
+    if (entry == NULL) return;
+    *entry = (struct tile_entry){.z = z, .x = x, .y = y, .format = format, .state = ENTRY_PENDING, .refs = 1, .prefetched = 1};
+    pthread_cond_init(&entry->done, NULL);
+    entry->chain = cache.buckets[bucket];
+    cache.buckets[bucket] = entry;
+    prefetch_push(entry);
+}
+
+
+static void prefetch_around(unsigned int z, uint64_t x, uint64_t y, enum tile_format format) {
+    /* guess the tiles a user will ask for after (z, x, y): its parent, the ring of its neighbours and its children,
+    the children being taken first, all in the format of the request. Nothing is guessed while requests are
+    queued, so prefetching only ever uses workers that would otherwise be idle */
+    pthread_mutex_lock(&cache.lock);
+    if (cache.demand_length == 0 && cache.idle_workers > 0) {
+        if (z > 0) prefetch_candidate(z - 1, x / 2, y / 2, format);
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                if ((dx || dy) && !((x + dx) >> z) && !((y + dy) >> z)) prefetch_candidate(z, x + dx, y + dy, format);
+            }
+        }
+        if (z < MAX_DEPTH) {
+            for (int child = 0; child < 4; child++) prefetch_candidate(z + 1, 2 * x + (child >> 1), 2 * y + (child & 1), format);
+        }
+        pthread_cond_broadcast(&cache.work);
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+
+
+static void* render_worker(void* worker_id) {
+    /* render queued tiles until the server stops */
+    unsigned int id = (unsigned int)(intptr_t)worker_id;
+    png_byte (*pixels)[IMAGE_SIZE] = malloc(IMAGE_SIZE * IMAGE_SIZE);
+    uint16_t (*values)[IMAGE_SIZE] = malloc(IMAGE_SIZE * IMAGE_SIZE * sizeof(uint16_t));
+    struct kernel_stats kernel_stats = {0};
+    struct tile_encoder encoder = encoder_options;
+    struct png_buffer scratch = {0}; // reused for every tile, so a rendered tile costs one allocation of its exact size
+    if (pixels == NULL || values == NULL) {
+        fprintf(stderr, "Error: Unable to allocate tile buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_lock(&cache.lock);
+    while (1) {
+        struct tile_entry* entry;
+        cache.idle_workers++;
+        while ((entry = next_job()) == NULL) pthread_cond_wait(&cache.work, &cache.lock);
+        cache.idle_workers--;
+        cache.running[id] = entry;
+        int prefetched = entry->prefetched;
+        pthread_mutex_unlock(&cache.lock);
+
+        struct png_buffer png = {0};
+        if (prefetched && load_tile(entry->z, entry->x, entry->y, entry->format, &png) == 0) {
+            pthread_mutex_lock(&cache.lock);
+            cache.running[id] = NULL;
+            entry_complete(entry, &png);
+            continue;
+        }
+        int result, failed = 0;
+        scratch.length = 0;
+        if (entry->format == TILE_RAW) {
+            result = render_raw_tile(values, entry->z, entry->x, entry->y, raw_iterations, 0, &entry->cancel, &kernel_stats);
+            failed = result >= 0 && encode_raw_tile(&encoder, tile_sink_buffer(&scratch), values);
+        } else {
+            result = render_tile(pixels, entry->z, entry->x, entry->y, use_subdivision, antialias_samples, &entry->cancel, &kernel_stats);
+            failed = result >= 0 && encode_tile(&encoder, tile_sink_buffer(&scratch), pixels);
+        }
+        if (failed) {
+            fprintf(stderr, "Error: Unable to encode tile %u/%" PRIu64 "/%" PRIu64 "\n", entry->z, entry->x, entry->y);
+        } else if (result >= 0 && (png.data = malloc(scratch.length))) {
+            memcpy(png.data, scratch.data, scratch.length);
+            png.length = png.capacity = scratch.length;
+            atomic_fetch_add(prefetched ? &stats.prefetched : &stats.rendered, 1);
+        }
+
+        pthread_mutex_lock(&cache.lock);
+        cache.running[id] = NULL;
+        if (result < 0 && entry->waiters) { // a request arrived after the render was abandoned
+            demand_push(entry);
+        } else {
+            if (result < 0) atomic_fetch_add(prefetched ? &stats.preempted : &stats.cancelled, 1);
+            entry_complete(entry, png.data ? &png : NULL);
+        }
+    }
+    return NULL;
+}
+
+
+static int send_all(int fd, const void* data, size_t length) {
+    /* write a whole buffer to a socket */
+    const char* bytes = data;
+    while (length) {
+        ssize_t count = send(fd, bytes, length, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return -1;
+        bytes += count;
+        length -= count;
+    }
+    return 0;
+}
+
+
+static int send_status(int fd, const char* status, int keep_alive) {
+    /* send a response without a body */
+    char head[256];
+    int length = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n",
+        status, keep_alive ? "keep-alive" : "close");
+    return send_all(fd, head, length);
+}
+
+
+static const char* header_value(const char* head, const char* name) {
+    /* find the value of a header in a request head, or NULL if it is absent */
+    size_t name_length = strlen(name);
+    for (const char* line = strstr(head, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, name_length) == 0 && line[name_length] == ':') {
+            line += name_length + 1;
+            while (*line == ' ' || *line == '\t') line++;
+            return line;
+        }
+    }
+    return NULL;
+}
+
+
+static int parse_tile_path(const char* path, unsigned int* z, uint64_t* x, uint64_t* y, enum tile_format* format) {
+    /* parse a request path of the form /{z}/{x}/{y}.png or /{z}/{x}/{y}.raw, ignoring any query string */
+    char extension[4];
+    int end = 0;
+    if (sscanf(path, "/%u/%" SCNu64 "/%" SCNu64 ".%3[a-z]%n", z, x, y, extension, &end) != 4 || end == 0) return -1;
+    if (path[end] != '\0' && path[end] != '?') return -1;
+    int found = tile_format_from_name(extension);
+    if (found < 0) return -1;
+    *format = found;
+    return 0;
+}
+
+
+static int serve_request(int fd, char* head, int* keep_alive) {
+    /* answer one request whose head (up to the blank line) is NUL terminated. Returns -1 if the connection
+    should be closed */
+    char* method = head;
+    char* path = strchr(method, ' ');
+    if (path == NULL) return send_status(fd, "400 Bad Request", 0), -1;
+    *path++ = '\0';
+    char* version = strchr(path, ' ');
+    if (version == NULL) return send_status(fd, "400 Bad Request", 0), -1;
+    *version++ = '\0';
+
+    // HTTP/1.1 connections stay open unless the client asks otherwise, HTTP/1.0 ones only if it asks
+    const char* connection = header_value(version, "Connection");
+    if (strncmp(version, "HTTP/1.1", 8) == 0) {
+        *keep_alive = connection == NULL || strncasecmp(connection, "close", 5) != 0;
+    } else {
+        *keep_alive = connection && strncasecmp(connection, "keep-alive", 10) == 0;
+    }
+    atomic_fetch_add(&stats.requests, 1);
+
+    int head_only = strcmp(method, "HEAD") == 0;
+    if (!head_only && strcmp(method, "GET") != 0) return send_status(fd, "405 Method Not Allowed", 0), -1; // any body is left unread
+    unsigned int z;
+    uint64_t x, y;
+    enum tile_format format;
+    if (parse_tile_path(path, &z, &x, &y, &format)) return send_status(fd, "400 Bad Request", *keep_alive);
+    if (z > MAX_DEPTH || x >> z || y >> z) return send_status(fd, "404 Not Found", *keep_alive);
+
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%u-%" PRIu64 "-%" PRIu64 "%s\"", z, x, y, format == TILE_RAW ? "-raw" : "");
+    const char* if_none_match = header_value(version, "If-None-Match");
+    if (if_none_match && strncmp(if_none_match, etag, strlen(etag)) == 0) {
+        atomic_fetch_add(&stats.not_modified, 1);
+        char head_out[256];
+        int length = snprintf(head_out, sizeof(head_out), "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nCache-Control: %s\r\n"
+            "Connection: %s\r\n\r\n", etag, CACHE_CONTROL, *keep_alive ? "keep-alive" : "close");
+        return send_all(fd, head_out, length);
+    }
+
+    struct tile_entry* entry = cache_acquire(fd, z, x, y, format);
+    if (entry == NULL) return -1; // client gone
+    if (entry->state != ENTRY_READY) {
+        cache_release(entry);
+        return send_status(fd, "500 Internal Server Error", *keep_alive);
+    }
+    char head_out[512];
+    int length = snprintf(head_out, sizeof(head_out), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+        "Cache-Control: %s\r\nETag: %s\r\nAccess-Control-Allow-Origin: *\r\nConnection: %s\r\n\r\n",
+        format == TILE_RAW ? "application/octet-stream" : "image/png", entry->png.length, CACHE_CONTROL, etag, *keep_alive ? "keep-alive" : "close");
+    int code = send_all(fd, head_out, length);
+    if (code == 0 && !head_only) code = send_all(fd, entry->png.data, entry->png.length);
+    cache_release(entry);
+    if (code == 0) prefetch_around(z, x, y, format);
+    return code;
+}
+
+
+static void* serve_connection(void* arg) {
+    /* read requests from a connection and answer them in order until the client closes it */
+    int fd = (int)(intptr_t)arg;
+    char buffer[REQUEST_MAX + 1];
+    size_t filled = 0;
+    int keep_alive = 1;
+    while (keep_alive) {
+        buffer[filled] = '\0';
+        char* end = strstr(buffer, "\r\n\r\n");
+        if (end == NULL) {
+            if (filled == REQUEST_MAX) {
+                send_status(fd, "431 Request Header Fields Too Large", 0);
+                break;
+            }
+            ssize_t count = recv(fd, buffer + filled, REQUEST_MAX - filled, 0);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0) break;
+            filled += count;
+            continue;
+        }
+        end[2] = '\0'; // keep the last header's line ending for header_value
+        if (serve_request(fd, buffer, &keep_alive)) break;
+        size_t used = end + 4 - buffer;
+        memmove(buffer, buffer + used, filled - used);
+        filled -= used;
+    }
+    close(fd);
+    atomic_fetch_sub(&open_connections, 1);
+    return NULL;
+}
+
+
+static void stop(int signal) {
+    /* ask the accept loop to finish */
+    stopping = 1;
+}
+
+
+static void usage(char* name) {
+    /* print the command line options and exit */
+    fprintf(stderr, "Usage: %s [options]\n", name);
+    fprintf(stderr, "  -p, --port <port>      port to listen on (default %d)\n", DEFAULT_PORT);
+    fprintf(stderr, "  -b, --bind <address>   address to listen on (default 127.0.0.1)\n");
+    fprintf(stderr, "  -t, --threads <count>  render workers (default one per CPU)\n");
+    fprintf(stderr, "  -c, --cache <MB>       memory for cached tiles (default %d)\n", DEFAULT_CACHE_MB);
+    fprintf(stderr, "  -C, --connections <n>  open connections, one thread each, before new ones are refused with 503 (default %d)\n", DEFAULT_MAX_CONNECTIONS);
+    fprintf(stderr, "  -d, --dir <dir>        serve pre-rendered tiles from this directory (default %s)\n", dirname);
+    fprintf(stderr, "  -a, --archive <file>   serve pre-rendered tiles from this archive instead\n");
+    fprintf(stderr, "  -s, --subdivide        render by Mariani-Silver subdivision\n");
+    fprintf(stderr, "  -A, --antialias <n>    take n more samples in each edge pixel, matching tiles generated with -A\n");
+    fprintf(stderr, "  -I, --iterations <n>   iteration budget of raw tiles, matching tiles generated with -I (default %d)\n", MAX_ITERATIONS);
+    fprintf(stderr, "  -l, --level <0-9>      zlib compression level (default %d)\n", ENCODER_DEFAULT_LEVEL);
+    fprintf(stderr, "  -S, --strategy <name>  zlib strategy: default, filtered, huffman, rle or fixed (default filtered)\n");
+    fprintf(stderr, "  -f, --filter <name>    PNG row filter: none, sub, up, average, paeth, or all (default all)\n");
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"port", required_argument, NULL, 'p'},
+        {"bind", required_argument, NULL, 'b'},
+        {"threads", required_argument, NULL, 't'},
+        {"cache", required_argument, NULL, 'c'},
+        {"connections", required_argument, NULL, 'C'},
+        {"dir", required_argument, NULL, 'd'},
+        {"archive", required_argument, NULL, 'a'},
+        {"subdivide", no_argument, NULL, 's'},
+        {"antialias", required_argument, NULL, 'A'},
+        {"iterations", required_argument, NULL, 'I'},
+        {"level", required_argument, NULL, 'l'},
+        {"strategy", required_argument, NULL, 'S'},
+        {"filter", required_argument, NULL, 'f'},
+        {NULL, 0, NULL, 0}
+    };
+    tile_encoder_init(&encoder_options);
+    unsigned int port = DEFAULT_PORT;
+    const char* address = "127.0.0.1";
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t cache_mb = DEFAULT_CACHE_MB;
+    int option;
+    while ((option = getopt_long(argc, argv, "p:b:t:c:C:d:a:sA:I:l:S:f:", long_options, NULL)) != -1) {
+        switch (option) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'b':
+            address = optarg;
+            break;
+        case 't':
+            num_threads = atoi(optarg);
+            break;
+        case 'c':
+            cache_mb = atoi(optarg);
+            break;
+        case 'C':
+            max_connections = atoi(optarg);
+            if (max_connections < 1) usage(argv[0]);
+            break;
+        case 'd':
+            dirname = optarg;
+            break;
+        case 'a':
+            archive_name = optarg;
+            break;
+        case 's':
+            use_subdivision = 1;
+            break;
+        case 'A':
+            antialias_samples = atoi(optarg);
+            if (antialias_samples < 1 || antialias_samples > ANTIALIAS_MAX_SAMPLES) usage(argv[0]);
+            break;
+        case 'I':
+            raw_iterations = atoi(optarg);
+            if (raw_iterations < 1 || raw_iterations > RAW_MAX_ITERATIONS) usage(argv[0]);
+            break;
+        case 'l':
+            encoder_options.level = atoi(optarg);
+            if (encoder_options.level < 0 || encoder_options.level > 9) usage(argv[0]);
+            break;
+        case 'S':
+            encoder_options.strategy = encoder_strategy_from_name(optarg);
+            if (encoder_options.strategy < 0) usage(argv[0]);
+            break;
+        case 'f':
+            encoder_options.filters = encoder_filters_from_name(optarg);
+            if (encoder_options.filters < 0) usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc || num_threads < 1) usage(argv[0]);
+    if (archive_name) {
+        archive = tile_archive_open(archive_name);
+        if (archive == NULL) {fprintf(stderr, "Error: Unable to open archive %s\n", archive_name); exit(EXIT_FAILURE);}
+        if (archive->header->image_size != IMAGE_SIZE) {fprintf(stderr, "Error: %s has %upx tiles, not %dpx\n", archive_name, archive->header->image_size, IMAGE_SIZE); exit(EXIT_FAILURE);}
+    }
+
+    struct sockaddr_in listen_address = {.sin_family = AF_INET, .sin_port = htons(port)};
+    if (inet_pton(AF_INET, address, &listen_address.sin_addr) != 1) {fprintf(stderr, "Error: Invalid address %s\n", address); exit(EXIT_FAILURE);}
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&listen_address, sizeof(listen_address)) || listen(listen_fd, SOMAXCONN)) {
+        fprintf(stderr, "Error: Unable to listen on %s:%u\n", address, port);
+        exit(EXIT_FAILURE);
+    }
+
+    init_kernel();
+    pthread_mutex_init(&cache.lock, NULL);
+    pthread_cond_init(&cache.work, NULL);
+    cache.capacity = cache_mb << 20;
+    cache.num_workers = num_threads;
+    cache.running = calloc(num_threads, sizeof(struct tile_entry*));
+    pthread_attr_t detached;
+    pthread_attr_init(&detached);
+    pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+    for (long i = 0; i < num_threads; i++) {
+        pthread_t worker;
+        pthread_create(&worker, &detached, render_worker, (void*)(intptr_t)i);
+    }
+
+    // stop on ^C without restarting accept, so the summary can be printed
+    struct sigaction action = {.sa_handler = stop};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    printf("Server started http://%s:%u with %ld render workers and a %zu MB cache, using the %s kernel\n",
+        address, port, num_threads, cache_mb, row_kernel_name);
+
+    while (!stopping) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        struct timeval timeout = {.tv_sec = IDLE_TIMEOUT};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        if (atomic_fetch_add(&open_connections, 1) >= max_connections) { // no thread to spare, answer and hang up
+            atomic_fetch_sub(&open_connections, 1);
+            atomic_fetch_add(&stats.refused, 1);
+            send_status(fd, "503 Service Unavailable", 0);
+            close(fd);
+            continue;
+        }
+        pthread_t connection;
+        if (pthread_create(&connection, &detached, serve_connection, (void*)(intptr_t)fd)) {
+            atomic_fetch_sub(&open_connections, 1);
+            close(fd);
+        }
+    }
+    close(listen_fd);
+    printf("Server stopped after %" PRIu64 " requests: %" PRIu64 " cache hits, %" PRIu64 " read from %s, %" PRIu64
+        " rendered, %" PRIu64 " coalesced, %" PRIu64 " not modified, %" PRIu64 " evicted, %" PRIu64 " connections refused\n",
+        atomic_load(&stats.requests), atomic_load(&stats.cache_hits), atomic_load(&stats.disk_hits), archive ? archive_name : dirname,
+        atomic_load(&stats.rendered), atomic_load(&stats.coalesced), atomic_load(&stats.not_modified), atomic_load(&stats.evicted),
+        atomic_load(&stats.refused));
+    printf("Scheduling: %" PRIu64 " renders dropped and %" PRIu64 " cancelled after clients left, %" PRIu64
+        " tiles prefetched, %" PRIu64 " prefetches preempted, %" PRIu64 " requests answered by prefetching\n",
+        atomic_load(&stats.dropped), atomic_load(&stats.cancelled), atomic_load(&stats.prefetched),
+        atomic_load(&stats.preempted), atomic_load(&stats.prefetch_hits));
+    if (archive) tile_archive_close(archive);
+    return EXIT_SUCCESS;
+}